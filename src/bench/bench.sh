@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# End-to-end tailall benchmark, prints one JSON object per run.
+#
+#   bench.sh TAILALL [TAGEN OPTIONS]
+#
+# Environment
+#   BENCH_DIR    scratch directory (default /tmp/tailall-bench)
+#   BENCH_OUT    also append the JSON line to this file
+#   BENCH_ARGS   extra tailall options, e.g. "-p"
+#
+# Example
+#   bench.sh ./tailall -d 3 -f 4 -n 1000 -r 50000 -s 200 -t 20 -c 50
+
+set -e
+
+BIN=$1
+shift
+HERE=$(cd "$(dirname "$0")" && pwd)
+DIR=${BENCH_DIR:-/tmp/tailall-bench}
+ROOT=$DIR/root
+
+rm -rf "$DIR"
+mkdir -p "$ROOT"
+mkfifo "$DIR/pipe"
+
+"$HERE/tagen" setup "$ROOT" "$@"
+
+"$HERE/tasink" "$DIR/ready" < "$DIR/pipe" > "$DIR/sink.json" &
+SINK=$!
+
+START=$(date +%s%N)
+$BIN $BENCH_ARGS "$ROOT" > "$DIR/pipe" 2> "$DIR/stderr" &
+PID=$!
+
+"$HERE/tagen" ready "$ROOT" "$DIR/ready"
+"$HERE/tagen" run "$ROOT" "$@" > "$DIR/gen.json"
+
+# let the tail drain
+sleep 1
+
+HZ=$(getconf CLK_TCK)
+RSS=$(awk '/VmRSS/ { print $2 }' /proc/$PID/status)
+HWM=$(awk '/VmHWM/ { print $2 }' /proc/$PID/status)
+FDS=$(ls /proc/$PID/fd | wc -l)
+CPU=$(awk -v hz="$HZ" '{ printf "%.3f", ($14 + $15) / hz }' /proc/$PID/stat)
+
+kill $PID
+wait $SINK || true
+
+READY=$(sed 's/.*"ready_ns":\([0-9]*\).*/\1/' "$DIR/sink.json")
+SCAN_MS=$(( (READY - START) / 1000000 ))
+
+JSON=$(printf '{"args":"%s","tailall_args":"%s","startup_ms":%d,"rss_kb":%d,"hwm_kb":%d,"fds":%d,"cpu_s":%s,%s,%s}' \
+    "$*" "$BENCH_ARGS" "$SCAN_MS" "$RSS" "$HWM" "$FDS" "$CPU" \
+    "$(cat "$DIR/gen.json")" "$(cat "$DIR/sink.json")")
+
+echo "$JSON"
+
+if [ -n "$BENCH_OUT" ]; then
+    echo "$JSON" >> "$BENCH_OUT"
+fi
@@ -0,0 +1,251 @@
+/*
+ * Lookup scaling of chashtable.c against hashtable.c behind its mutex.
+ *
+ *   chashbench [-n OPS] [-p POWER] [-l KEYLEN] [-t THREADS,...] [-w]
+ *
+ * For every thread count, that many readers each do OPS hits on a table
+ * of 2^POWER keys, one read section per lookup for chashtable. With -w a
+ * writer replaces keys one after the other meanwhile, so retired data is
+ * reclaimed under the readers. Prints one JSON object per table and thread
+ * count, get_ns is the wall time of a lookup per thread.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../hashtable.h"
+#include "../chashtable.h"
+
+#define MAX_THREADS     CHASHTABLE_MAX_READERS
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// same keys as hashbench
+static char* make_key(unsigned long n, int len)
+{
+    char *key = malloc(len + 1), num[24];
+    int nlen, i;
+
+    nlen = snprintf(num, sizeof(num), "%lu", n);
+
+    for(i = 0; i < len; i++)
+        key[i] = "/var/log/app/"[i % 13];
+
+    memcpy(key + (len > nlen ? len - nlen : 0), num, len > nlen ? nlen : len);
+    key[len] = '\0';
+
+    return key;
+}
+
+static int parse_list(const char *arg, int *out, int max)
+{
+    int n = 0;
+    char *end;
+
+    while(n < max)
+    {
+        out[n++] = strtol(arg, &end, 10);
+        if(*end != ',')
+            break;
+        arg = end + 1;
+    }
+
+    return n;
+}
+
+typedef struct _bench
+{
+    hashtable_t         *table;
+    chashtable_t        *ctable;
+    char                **keys;
+    unsigned long       nkeys;
+    long                ops;
+    int                 stop;       // for the writer
+    uint64_t            replaces;
+} bench_t;
+
+typedef struct _reader
+{
+    bench_t             *b;
+    unsigned long       seed;
+    uint64_t            found;
+    uint64_t            ns;
+} reader_t;
+
+static int dummy;
+
+static void* hash_reader(void *arg)
+{
+    reader_t *r = arg;
+    bench_t *b = r->b;
+    unsigned long i = r->seed;
+    uint64_t t0 = now_ns();
+    long j;
+
+    for(j = 0; j < b->ops; j++, i += 7)
+        r->found += hashtable_get(b->table, b->keys[i % b->nkeys]) != NULL;
+
+    r->ns = now_ns() - t0;
+
+    return NULL;
+}
+
+static void* chash_reader(void *arg)
+{
+    reader_t *r = arg;
+    bench_t *b = r->b;
+    chashtable_reader_t *cr = chashtable_reader_init(b->ctable);
+    hashtable_data_t *data;
+    unsigned long i = r->seed;
+    uint64_t t0 = now_ns();
+    long j;
+
+    for(j = 0; j < b->ops; j++, i += 7)
+    {
+        chashtable_read_begin(b->ctable, cr);
+        data = chashtable_get(b->ctable, b->keys[i % b->nkeys]);
+        r->found += data != NULL && data->data == &dummy;
+        chashtable_read_end(cr);
+    }
+
+    r->ns = now_ns() - t0;
+    chashtable_reader_free(cr);
+
+    return NULL;
+}
+
+static void* writer(void *arg)
+{
+    bench_t *b = arg;
+    unsigned long i = 0;
+
+    while(!__atomic_load_n(&b->stop, __ATOMIC_RELAXED))
+    {
+        if(b->ctable != NULL)
+            chashtable_replace(b->ctable, hashtable_data_init(b->keys[i % b->nkeys], &dummy, NULL));
+        else
+            hashtable_replace(b->table, hashtable_data_init(b->keys[i % b->nkeys], &dummy, NULL));
+
+        b->replaces++;
+        i++;
+    }
+
+    return NULL;
+}
+
+static void run_case(const char *name, bench_t *b, int threads, int write)
+{
+    pthread_t tids[MAX_THREADS], wtid;
+    reader_t readers[MAX_THREADS];
+    uint64_t ns = 0, found = 0;
+    int i;
+
+    b->stop = 0;
+    b->replaces = 0;
+
+    if(write)
+        pthread_create(&wtid, NULL, writer, b);
+
+    for(i = 0; i < threads; i++)
+    {
+        readers[i].b = b;
+        readers[i].seed = (unsigned long)i * 7919;
+        readers[i].found = 0;
+        readers[i].ns = 0;
+        pthread_create(&tids[i], NULL, b->ctable != NULL ? chash_reader : hash_reader, &readers[i]);
+    }
+
+    for(i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        ns += readers[i].ns;
+        found += readers[i].found;
+    }
+
+    __atomic_store_n(&b->stop, 1, __ATOMIC_RELAXED);
+    if(write)
+        pthread_join(wtid, NULL);
+
+    if(found != (uint64_t)b->ops * threads)
+        fprintf(stderr, "chashbench: %s found %llu keys, want %llu\n", name,
+                (unsigned long long)found, (unsigned long long)b->ops * threads);
+
+    printf("{\"table\":\"%s\",\"threads\":%d,\"writer\":%d,\"get_ns\":%.1f,\"mops\":%.1f,\"replaces\":%llu}\n",
+            name, threads, write, (double)ns / threads / b->ops,
+            (double)b->ops * threads * threads / ns * 1000.0,
+            (unsigned long long)b->replaces);
+}
+
+int main(int argc, char **argv)
+{
+    int threads[16] = { 1, 2, 4, 8 }, nthreads = 4;
+    int power = 14, keylen = 32, write = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    bench_t b;
+    unsigned long i;
+    int c, t;
+
+    memset(&b, 0, sizeof(b));
+    b.ops = 2000000;
+
+    while((c = getopt(argc, argv, "n:p:l:t:w")) != -1)
+    {
+        switch(c)
+        {
+            case 'n': b.ops = atol(optarg); break;
+            case 'p': power = atoi(optarg); break;
+            case 'l': keylen = atoi(optarg); break;
+            case 't': nthreads = parse_list(optarg, threads, 16); break;
+            case 'w': write = 1; break;
+            default:
+                fprintf(stderr, "Usage: chashbench [-n ops] [-p power] [-l keylen] [-t threads,...] [-w]\n");
+                return 1;
+        }
+    }
+
+    b.nkeys = hashsize(power);
+    b.keys = malloc(b.nkeys * sizeof(char *));
+
+    for(i = 0; i < b.nkeys; i++)
+        b.keys[i] = make_key(i, keylen);
+
+    for(t = 0; t < nthreads; t++)
+    {
+        if(threads[t] < 1 || threads[t] > MAX_THREADS)
+            continue;
+
+        b.table = hashtable_init(power, &lock);
+        b.ctable = NULL;
+        for(i = 0; i < b.nkeys; i++)
+            hashtable_set(b.table, hashtable_data_init(b.keys[i], &dummy, NULL));
+
+        run_case("hashtable", &b, threads[t], write);
+        hashtable_free(b.table);
+
+        b.ctable = chashtable_init(power);
+        for(i = 0; i < b.nkeys; i++)
+            chashtable_set(b.ctable, hashtable_data_init(b.keys[i], &dummy, NULL));
+
+        run_case("chashtable", &b, threads[t], write);
+        chashtable_free(b.ctable);
+    }
+
+    for(i = 0; i < b.nkeys; i++)
+        free(b.keys[i]);
+
+    free(b.keys);
+
+    return 0;
+}
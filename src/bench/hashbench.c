@@ -0,0 +1,167 @@
+/*
+ * Microbenchmark for hash.c and hashtable.c.
+ *
+ *   hashbench [-n OPS] [-p POWER,...] [-l KEYLEN,...] [-f LOAD,...]
+ *
+ * For every table power, key length and load factor (keys per bucket) it
+ * fills a table and times hashtable_set, hashtable_get (hits and misses),
+ * hashtable_replace and hashtable_del, plus raw hash() throughput, and
+ * prints one JSON object per case. Build against either hash function
+ * (make HASH=wyhash) to compare.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hashtable.h"
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// "/var/log/app/0000001234.log" style keys padded to len, sharing a prefix
+// like real paths do
+static char* make_key(unsigned long n, int len, int miss)
+{
+    char *key = malloc(len + 1), num[24];
+    int nlen, i;
+
+    nlen = snprintf(num, sizeof(num), "%s%lu", miss ? "m" : "", n);
+
+    for(i = 0; i < len; i++)
+        key[i] = "/var/log/app/"[i % 13];
+
+    memcpy(key + (len > nlen ? len - nlen : 0), num, len > nlen ? nlen : len);
+    key[len] = '\0';
+
+    return key;
+}
+
+static int parse_list(const char *arg, int *out, int max)
+{
+    int n = 0;
+    char *end;
+
+    while(n < max)
+    {
+        out[n++] = strtol(arg, &end, 10);
+        if(*end != ',')
+            break;
+        arg = end + 1;
+    }
+
+    return n;
+}
+
+static volatile uint64_t sink;
+
+static void run_case(int power, int keylen, int load, long ops)
+{
+    unsigned long nkeys = hashsize(power) * load, i;
+    char **keys = malloc(nkeys * sizeof(char *));
+    char **miss = malloc(nkeys * sizeof(char *));
+    hashtable_t *table = hashtable_init(power, NULL);
+    int dummy;
+    uint64_t t0, t_set, t_get, t_miss, t_rep, t_del, t_hash;
+    long j;
+
+    for(i = 0; i < nkeys; i++)
+    {
+        keys[i] = make_key(i, keylen, 0);
+        miss[i] = make_key(i, keylen, 1);
+    }
+
+    t0 = now_ns();
+    for(i = 0; i < nkeys; i++)
+        hashtable_set(table, hashtable_data_init(keys[i], &dummy, NULL));
+    t_set = now_ns() - t0;
+
+    t0 = now_ns();
+    for(j = 0; j < ops; j++)
+        sink += hashtable_get(table, keys[j % nkeys]) != NULL;
+    t_get = now_ns() - t0;
+
+    t0 = now_ns();
+    for(j = 0; j < ops; j++)
+        sink += hashtable_get(table, miss[j % nkeys]) != NULL;
+    t_miss = now_ns() - t0;
+
+    t0 = now_ns();
+    for(i = 0; i < nkeys; i++)
+        hashtable_replace(table, hashtable_data_init(keys[i], &dummy, NULL));
+    t_rep = now_ns() - t0;
+
+    t0 = now_ns();
+    for(j = 0; j < ops; j++)
+        sink += hash(keys[j % nkeys], keylen, 0);
+    t_hash = now_ns() - t0;
+
+    if(table->data_count != nkeys)
+        fprintf(stderr, "hashbench: %llu keys in table, want %lu\n", (unsigned long long)table->data_count, nkeys);
+
+    t0 = now_ns();
+    for(i = 0; i < nkeys; i++)
+        hashtable_del(table, keys[i]);
+    t_del = now_ns() - t0;
+
+    printf("{\"hash\":\"%s\",\"power\":%d,\"keylen\":%d,\"load\":%d,"
+           "\"set_ns\":%.1f,\"get_ns\":%.1f,\"miss_ns\":%.1f,\"replace_ns\":%.1f,\"del_ns\":%.1f,\"hash_ns\":%.1f}\n",
+#ifdef HASH_WYHASH
+            "wyhash",
+#else
+            "jenkins",
+#endif
+            power, keylen, load,
+            (double)t_set / nkeys, (double)t_get / ops, (double)t_miss / ops,
+            (double)t_rep / nkeys, (double)t_del / nkeys, (double)t_hash / ops);
+
+    for(i = 0; i < nkeys; i++)
+    {
+        free(keys[i]);
+        free(miss[i]);
+    }
+
+    free(keys);
+    free(miss);
+    free(table->idx);
+    free(table);
+}
+
+int main(int argc, char **argv)
+{
+    int powers[16] = { 8, 12, 16 }, npowers = 3;
+    int lens[16] = { 8, 32, 128 }, nlens = 3;
+    int loads[16] = { 1, 4 }, nloads = 2;
+    long ops = 2000000;
+    int c, p, l, f;
+
+    while((c = getopt(argc, argv, "n:p:l:f:")) != -1)
+    {
+        switch(c)
+        {
+            case 'n': ops = atol(optarg); break;
+            case 'p': npowers = parse_list(optarg, powers, 16); break;
+            case 'l': nlens = parse_list(optarg, lens, 16); break;
+            case 'f': nloads = parse_list(optarg, loads, 16); break;
+            default:
+                fprintf(stderr, "Usage: hashbench [-n ops] [-p power,...] [-l keylen,...] [-f load,...]\n");
+                return 1;
+        }
+    }
+
+    for(p = 0; p < npowers; p++)
+        for(l = 0; l < nlens; l++)
+            for(f = 0; f < nloads; f++)
+                run_case(powers[p], lens[l], loads[f], ops);
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Collector stand-in for tailall -F, see forward.h for the frames.
+ *
+ *   tacollect [-c CONNS] [-i MS] PORT
+ *
+ * Listens on 127.0.0.1:PORT and serves CONNS connections one after the
+ * other (default 1). A connection idle for MS ms (default 1000) is closed
+ * from this side, everything sent until then read, so tailall has to
+ * reconnect for the next one. The data of every frame goes to stdout, a
+ * frame or the part of it already received at its (path, offset) is
+ * dropped as a resend. A frame cut by the close is dropped too. Prints a
+ * JSON summary on stderr.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define BUF_SIZE        (4*1024*1024)
+#define FRAME_DATA      1
+#define FRAME_HEADER    16
+#define MAX_PATHS       4096
+
+typedef struct _source
+{
+    char                *path;
+    uint64_t            end;        // bytes received up to
+} source_t;
+
+static source_t sources[MAX_PATHS];
+static int nsources;
+static uint64_t frames, bytes, resent, gaps, cut, bad;
+
+static source_t* source_get(const char *path, size_t len)
+{
+    int i;
+
+    for(i = 0; i < nsources; i++)
+    {
+        if(strlen(sources[i].path) == len && memcmp(sources[i].path, path, len) == 0)
+            return &sources[i];
+    }
+
+    if(nsources == MAX_PATHS)
+        return NULL;
+
+    sources[nsources].path = strndup(path, len);
+    sources[nsources].end = 0;
+
+    return &sources[nsources++];
+}
+
+static void frame(const unsigned char *p, size_t len)
+{
+    uint16_t plen;
+    uint32_t hi, lo;
+    uint64_t offset;
+    size_t dlen, skip = 0;
+    source_t *src;
+
+    memcpy(&plen, p + 6, 2);
+    plen = ntohs(plen);
+    memcpy(&hi, p + 8, 4);
+    memcpy(&lo, p + 12, 4);
+    offset = (uint64_t)ntohl(hi) << 32 | ntohl(lo);
+
+    if(p[4] != FRAME_DATA || FRAME_HEADER + plen > len)
+    {
+        bad++;
+        return;
+    }
+
+    src = source_get((const char *)p + FRAME_HEADER, plen);
+    dlen = len - FRAME_HEADER - plen;
+    frames++;
+
+    if(src == NULL)
+        return;
+
+    if(offset > src->end && src->end > 0)
+        gaps++;
+
+    if(offset + dlen <= src->end && dlen > 0)
+    {
+        resent++;
+        return;
+    }
+
+    if(offset < src->end)
+        skip = src->end - offset;
+
+    fwrite(p + FRAME_HEADER + plen + skip, 1, dlen - skip, stdout);
+    bytes += dlen - skip;
+    src->end = offset + dlen;
+}
+
+static void serve(int fd, int idle)
+{
+    static unsigned char buf[BUF_SIZE];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    size_t len = 0;
+    uint32_t flen;
+    ssize_t ret;
+
+    while(poll(&pfd, 1, idle) > 0)
+    {
+        ret = read(fd, buf + len, BUF_SIZE - len);
+        if(ret <= 0)
+            break;
+
+        len += ret;
+
+        while(len >= 4)
+        {
+            memcpy(&flen, buf, 4);
+            flen = ntohl(flen);
+
+            if(flen + 4 > BUF_SIZE)
+            {
+                bad++;
+                len = 0;
+                break;
+            }
+
+            if(len < flen + 4)
+                break;
+
+            frame(buf, flen + 4);
+            memmove(buf, buf + flen + 4, len - flen - 4);
+            len -= flen + 4;
+        }
+    }
+
+    if(len > 0)
+        cut++;
+
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    int conns = 1, idle = 1000, served = 0;
+    int c, lfd, fd, one = 1;
+
+    while((c = getopt(argc, argv, "c:i:")) != -1)
+    {
+        switch(c)
+        {
+            case 'c': conns = atoi(optarg); break;
+            case 'i': idle = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: tacollect [-c conns] [-i ms] PORT\n");
+                return 1;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        fprintf(stderr, "Usage: tacollect [-c conns] [-i ms] PORT\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[optind]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0)
+    {
+        perror("tacollect");
+        return 1;
+    }
+
+    for(; served < conns; served++)
+    {
+        fd = accept(lfd, NULL, NULL);
+        if(fd < 0)
+            break;
+
+        serve(fd, idle);
+        close(fd);
+    }
+
+    close(lfd);
+
+    fprintf(stderr, "{\"connections\":%d,\"frames\":%llu,\"bytes\":%llu,\"resent\":%llu,\"gaps\":%llu,"
+            "\"cut\":%llu,\"bad\":%llu,\"paths\":%d}\n", served,
+            (unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)resent,
+            (unsigned long long)gaps, (unsigned long long)cut, (unsigned long long)bad, nsources);
+
+    return 0;
+}
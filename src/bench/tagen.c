@@ -0,0 +1,300 @@
+/*
+ * Synthetic log tree generator for the tailall benchmark.
+ *
+ *   tagen setup ROOT [options]     create the tree and its files
+ *   tagen ready ROOT READYFILE     append markers until READYFILE exists
+ *   tagen run ROOT [options]       append lines, create/delete/rotate
+ *
+ * Options
+ *   -d DEPTH    directory depth (default 2)
+ *   -f FANOUT   sub-directories per directory (default 4)
+ *   -n FILES    files spread over the tree (default 100)
+ *   -r RATE     lines per second over all files (default 10000)
+ *   -s SIZE     line size in bytes (default 120)
+ *   -t SECONDS  run time (default 10)
+ *   -c CHURN    create/delete/rotate operations per second (default 0)
+ *
+ * Every line starts with "TAGEN <realtime ns> <seq> " so the consumer can
+ * measure event-to-output latency.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PATH_LEN    4096
+
+typedef struct
+{
+    char    *root;
+    int     depth;
+    int     fanout;
+    int     files;
+    long    rate;
+    int     size;
+    double  seconds;
+    double  churn;
+} opt_t;
+
+static char     **dirs;
+static int      ndirs;
+static char     **paths;
+static int      *fds;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *what, const char *path)
+{
+    fprintf(stderr, "tagen: %s %s: %s\n", what, path, strerror(errno));
+    exit(1);
+}
+
+static void build_dirs(const char *path, int level, const opt_t *opt)
+{
+    char buf[PATH_LEN];
+    int i;
+
+    dirs = realloc(dirs, sizeof(char *) * (ndirs + 1));
+    dirs[ndirs++] = strdup(path);
+
+    if(level == opt->depth)
+        return;
+
+    for(i = 0; i < opt->fanout; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/d%d", path, i);
+        build_dirs(buf, level + 1, opt);
+    }
+}
+
+static void build_paths(const opt_t *opt)
+{
+    char buf[PATH_LEN];
+    int i;
+
+    build_dirs(opt->root, 0, opt);
+
+    paths = calloc(opt->files, sizeof(char *));
+    fds = calloc(opt->files, sizeof(int));
+
+    for(i = 0; i < opt->files; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/f%d.log", dirs[i % ndirs], i);
+        paths[i] = strdup(buf);
+        fds[i] = -1;
+    }
+}
+
+static int open_append(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if(fd < 0)
+        die("open", path);
+
+    return fd;
+}
+
+static void setup(const opt_t *opt)
+{
+    int i;
+
+    for(i = 0; i < ndirs; i++)
+    {
+        if(mkdir(dirs[i], 0755) < 0 && errno != EEXIST)
+            die("mkdir", dirs[i]);
+    }
+
+    for(i = 0; i < opt->files; i++)
+        close(open_append(paths[i]));
+}
+
+static void ready(const char *root, const char *readyfile)
+{
+    char path[PATH_LEN], line[64];
+    struct timespec ts = { 0, 10 * 1000000 };
+    int fd, len, i;
+
+    snprintf(path, sizeof(path), "%s/tagen.marker", root);
+    fd = open_append(path);
+
+    // give up after 120s
+    for(i = 0; i < 12000 && access(readyfile, F_OK) != 0; i++)
+    {
+        len = snprintf(line, sizeof(line), "TAGEN-READY %llu\n", (unsigned long long)now_ns());
+        if(write(fd, line, len) < 0)
+            die("write", path);
+        nanosleep(&ts, NULL);
+    }
+
+    close(fd);
+    unlink(path);
+
+    if(access(readyfile, F_OK) != 0)
+    {
+        fprintf(stderr, "tagen: tailall never became ready\n");
+        exit(1);
+    }
+}
+
+// create a new file, delete one, rotate one, or add/remove a directory
+static void churn(const opt_t *opt, unsigned long n)
+{
+    char buf[PATH_LEN], buf2[PATH_LEN];
+    int i = rand() % opt->files;
+
+    switch(n % 4)
+    {
+        case 0:
+            snprintf(buf, sizeof(buf), "%s.new%lu", paths[i], n);
+            close(open_append(buf));
+            unlink(buf);
+            break;
+        case 1:
+            // rotate, logrotate style
+            snprintf(buf, sizeof(buf), "%s.1", paths[i]);
+            if(fds[i] >= 0)
+                close(fds[i]);
+            rename(paths[i], buf);
+            unlink(buf);
+            fds[i] = open_append(paths[i]);
+            break;
+        case 2:
+            snprintf(buf, sizeof(buf), "%s/tmp%lu", dirs[rand() % ndirs], n);
+            mkdir(buf, 0755);
+            snprintf(buf2, sizeof(buf2), "%s/x.log", buf);
+            close(open_append(buf2));
+            unlink(buf2);
+            rmdir(buf);
+            break;
+        case 3:
+            if(fds[i] >= 0)
+                close(fds[i]);
+            unlink(paths[i]);
+            fds[i] = open_append(paths[i]);
+            break;
+    }
+}
+
+static void run(const opt_t *opt)
+{
+    struct timespec ts = { 0, 1000000 };
+    char *line = malloc(opt->size + 64);
+    uint64_t start = now_ns(), now, seq = 0, churned = 0;
+    uint64_t end = start + (uint64_t)(opt->seconds * 1e9);
+    int i, len, head;
+
+    for(i = 0; i < opt->files; i++)
+        fds[i] = open_append(paths[i]);
+
+    while((now = now_ns()) < end)
+    {
+        uint64_t due = (uint64_t)((now - start) / 1e9 * opt->rate);
+        uint64_t cdue = (uint64_t)((now - start) / 1e9 * opt->churn);
+
+        for(; seq < due; seq++)
+        {
+            i = rand() % opt->files;
+
+            head = snprintf(line, opt->size + 64, "TAGEN %llu %llu ", (unsigned long long)now_ns(), (unsigned long long)seq);
+            len = head < opt->size ? opt->size : head + 1;
+            memset(line + head, 'x', len - head - 1);
+            line[len - 1] = '\n';
+
+            if(write(fds[i], line, len) < 0)
+                die("write", paths[i]);
+        }
+
+        for(; churned < cdue; churned++)
+            churn(opt, churned);
+
+        nanosleep(&ts, NULL);
+    }
+
+    printf("\"gen_lines\":%llu,\"gen_seconds\":%.3f,\"gen_churn\":%llu\n",
+            (unsigned long long)seq, (now_ns() - start) / 1e9, (unsigned long long)churned);
+
+    for(i = 0; i < opt->files; i++)
+        close(fds[i]);
+
+    free(line);
+}
+
+int main(int argc, char **argv)
+{
+    opt_t opt = { NULL, 2, 4, 100, 10000, 120, 10, 0 };
+    struct rlimit rl;
+    const char *cmd;
+    int c;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: tagen setup|ready|run ROOT [READYFILE] [-d depth] [-f fanout] [-n files] [-r rate] [-s size] [-t seconds] [-c churn]\n");
+        return 1;
+    }
+
+    cmd = argv[1];
+    opt.root = argv[2];
+
+    if(strcmp(cmd, "ready") == 0)
+    {
+        if(argc < 4)
+            return 1;
+
+        ready(opt.root, argv[3]);
+        return 0;
+    }
+
+    optind = 3;
+    while((c = getopt(argc, argv, "d:f:n:r:s:t:c:")) != -1)
+    {
+        switch(c)
+        {
+            case 'd': opt.depth = atoi(optarg); break;
+            case 'f': opt.fanout = atoi(optarg); break;
+            case 'n': opt.files = atoi(optarg); break;
+            case 'r': opt.rate = atol(optarg); break;
+            case 's': opt.size = atoi(optarg); break;
+            case 't': opt.seconds = atof(optarg); break;
+            case 'c': opt.churn = atof(optarg); break;
+            default: return 1;
+        }
+    }
+
+    if(opt.files < 1 || opt.size < 1)
+        return 1;
+
+    // one fd per file during run
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)opt.files + 64)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    srand(1);
+    build_paths(&opt);
+
+    if(strcmp(cmd, "setup") == 0)
+        setup(&opt);
+    else if(strcmp(cmd, "run") == 0)
+        run(&opt);
+    else
+        return 1;
+
+    return 0;
+}
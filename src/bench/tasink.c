@@ -0,0 +1,139 @@
+/*
+ * Consumer side of the tailall benchmark, reads tailall's stdout.
+ *
+ *   tasink READYFILE
+ *
+ * Creates READYFILE once the first "TAGEN-READY" marker shows up, then
+ * measures the latency of every "TAGEN <ns> <seq>" line until EOF and
+ * prints the results as JSON fields on stdout.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUF_SIZE        (1024*1024)
+#define LAT_BUCKETS     64          // log2 ns
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t hist[LAT_BUCKETS * 4];  // 4 sub-buckets per power of two
+static uint64_t hist_count, lat_max;
+
+static void record(uint64_t ns)
+{
+    int b = 0, sub;
+
+    if(ns > 0)
+        b = 63 - __builtin_clzll(ns);
+
+    sub = b >= 2 ? (int)((ns >> (b - 2)) & 3) : 0;
+    hist[b * 4 + sub]++;
+    hist_count++;
+
+    if(ns > lat_max)
+        lat_max = ns;
+}
+
+// upper bound of the bucket holding the p-th percentile
+static double percentile(double p)
+{
+    uint64_t want = (uint64_t)(hist_count * p / 100.0), cum = 0;
+    int i;
+
+    for(i = 0; i < LAT_BUCKETS * 4; i++)
+    {
+        cum += hist[i];
+
+        if(cum > want)
+        {
+            int b = i / 4, sub = i % 4;
+            double lo = (double)(1ULL << b);
+
+            return (lo + lo * (sub + 1) / 4) / 1e6;
+        }
+    }
+
+    return lat_max / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    static char buf[BUF_SIZE];
+    uint64_t first = 0, last = 0, lines = 0, bytes = 0, ready_ns = 0;
+    size_t len = 0;
+    ssize_t ret;
+    char *p, *eol;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: tasink READYFILE\n");
+        return 1;
+    }
+
+    while((ret = read(STDIN_FILENO, buf + len, BUF_SIZE - len - 1)) > 0)
+    {
+        uint64_t now = now_ns();
+
+        bytes += ret;
+        len += ret;
+        buf[len] = '\0';
+        p = buf;
+
+        while((eol = memchr(p, '\n', len - (p - buf))) != NULL)
+        {
+            *eol = '\0';
+
+            // works for both '# path' headers and per-line prefixes
+            char *t = strstr(p, "TAGEN");
+
+            if(t != NULL && strncmp(t, "TAGEN ", 6) == 0)
+            {
+                uint64_t ts = strtoull(t + 6, NULL, 10);
+
+                if(first == 0)
+                    first = now;
+                last = now;
+                lines++;
+                record(now > ts ? now - ts : 0);
+            }else if(t != NULL && ready_ns == 0 && strncmp(t, "TAGEN-READY", 11) == 0)
+            {
+                int fd;
+
+                ready_ns = now;
+                fd = open(argv[1], O_WRONLY | O_CREAT, 0644);
+                if(fd >= 0)
+                    close(fd);
+            }
+
+            p = eol + 1;
+        }
+
+        len -= p - buf;
+        memmove(buf, p, len);
+
+        // a line longer than the buffer, drop it
+        if(len == BUF_SIZE - 1)
+            len = 0;
+    }
+
+    printf("\"ready_ns\":%llu,\"lines\":%llu,\"bytes\":%llu,\"seconds\":%.3f,\"lines_per_sec\":%.0f,"
+           "\"lat_p50_ms\":%.3f,\"lat_p90_ms\":%.3f,\"lat_p99_ms\":%.3f,\"lat_p999_ms\":%.3f,\"lat_max_ms\":%.3f\n",
+            (unsigned long long)ready_ns, (unsigned long long)lines, (unsigned long long)bytes,
+            (last - first) / 1e9,
+            last > first ? lines / ((last - first) / 1e9) : 0.0,
+            percentile(50), percentile(90), percentile(99), percentile(99.9), lat_max / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,373 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fnmatch.h>
+
+#include "budget.h"
+#include "pollfs.h"
+#include "metrics.h"
+
+static void budget_timer_cb(loop_t *loop, void *arg);
+
+static int budget_read_limit()
+{
+    FILE *fp;
+    int limit = 0;
+
+    fp = fopen(BUDGET_LIMIT_PATH, "r");
+
+    if(fp == NULL || fscanf(fp, "%d", &limit) != 1 || limit <= 0)
+    {
+        warnfn("Cannot read %s, assuming %d watches", BUDGET_LIMIT_PATH, BUDGET_DEFAULT_LIMIT);
+        limit = BUDGET_DEFAULT_LIMIT;
+    }
+
+    if(fp != NULL)
+        fclose(fp);
+
+    return limit;
+}
+
+budget_t* budget_init(tailall_t *ta, int limit)
+{
+    assert(ta != NULL);
+    assert(ta->pollfs != NULL);
+
+    budget_t *b;
+    int headroom;
+
+    b = calloc(sizeof(budget_t), 1);
+    assert(b != NULL);
+
+    b->ta = ta;
+    b->hard = budget_read_limit();
+
+    if(limit > 0)
+    {
+        b->limit = limit < b->hard ? limit : b->hard;
+    }else
+    {
+        headroom = b->hard * BUDGET_HEADROOM_PCT / 100;
+        if(headroom < BUDGET_HEADROOM_MIN)
+            headroom = BUDGET_HEADROOM_MIN;
+
+        b->limit = b->hard > headroom ? b->hard - headroom : 1;
+    }
+
+    debugf("Watch budget %d of %d\n", b->limit, b->hard);
+
+    b->timer = loop_add_timer(ta->loop, BUDGET_INTERVAL, budget_timer_cb, b);
+
+    return b;
+}
+
+void budget_free(budget_t *b)
+{
+    if(b == NULL)
+        return;
+
+    loop_del_timer(b->ta->loop, b->timer);
+
+    free(b->cand);
+    free(b->victim);
+    free(b);
+}
+
+int budget_priority(budget_t *b, const char *pattern)
+{
+    assert(b != NULL);
+    assert(pattern != NULL);
+
+    if(b->npriority == BUDGET_MAX_PRIORITY)
+    {
+        errfn("Too many priority patterns, %d at most", BUDGET_MAX_PRIORITY);
+        return -1;
+    }
+
+    b->priority[b->npriority++] = pattern;
+
+    return 0;
+}
+
+// return
+//   1 : a root, or its path relative to its root matches a -W pattern
+static int budget_match(budget_t *b, folder_t *folder)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    size_t len;
+    int i;
+
+    if(folder->parent == NULL)
+        return 1;
+
+    if(b->npriority == 0)
+        return 0;
+
+    len = snprintf(buf, sizeof(buf), "%s", folder_path2(folder, FOLDER_PATH_REL | FOLDER_PATH_LABEL));
+
+    while(len > 0 && buf[len - 1] == '/')
+        buf[--len] = '\0';
+
+    for(i = 0; i < b->npriority; i++)
+    {
+        if(fnmatch(b->priority[i], buf, 0) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void budget_key_set(tailall_t *ta, int wd, folder_t *folder)
+{
+    char *wdstr = intdup(wd);
+
+    folder_data_set(ta->folder_table, folder_data_init(wdstr, folder));
+    free(wdstr);
+}
+
+static void budget_key_del(tailall_t *ta, int wd)
+{
+    char *wdstr = intdup(wd);
+
+    folder_data_del(ta->folder_table, wdstr);
+    free(wdstr);
+}
+
+// ENOSPC, other programs hold more than the headroom
+static void budget_full(budget_t *b)
+{
+    b->hard = b->used;
+
+    if(b->limit > b->used)
+        b->limit = b->used;
+
+    if(!b->warned)
+    {
+        warnfn("Out of inotify watches at %d, polling the rest of the folders", b->used);
+        b->warned = 1;
+    }
+}
+
+int budget_add(budget_t *b, folder_t *folder, const char *path)
+{
+    assert(b != NULL);
+    assert(folder != NULL);
+
+    tailall_t *ta = b->ta;
+    int wd;
+
+    folder->priority = budget_match(b, folder);
+
+    // priority folders may take the headroom too
+    if(b->used < (folder->priority ? b->hard : b->limit))
+    {
+        metric_inc(M_SYS_INOTIFY_ADD_WATCH);
+        wd = inotify_add_watch(ta->inotify, path, FOLDER_WATCH_MASK);
+
+        if(wd >= 0)
+        {
+            b->used++;
+            return wd;
+        }
+
+        if(errno != ENOSPC)
+        {
+            warnfn("%s %s", strerror(errno), path);
+            return -1;
+        }
+
+        budget_full(b);
+    }else if(!b->warned)
+    {
+        warnfn("Watch budget of %d spent, polling the rest of the folders", b->limit);
+        b->warned = 1;
+    }
+
+    folder->demoted = 1;
+    b->demoted++;
+    metric_inc(M_BUDGET_DEMOTED);
+
+    return --ta->pseudo_wd;
+}
+
+void budget_del(budget_t *b, folder_t *folder)
+{
+    assert(b != NULL);
+    assert(folder != NULL);
+
+    if(folder->demoted)
+        b->demoted--;
+    else if(folder->wd > 0)
+        b->used--;
+
+    if(folder->old_wd != 0)
+    {
+        budget_key_del(b->ta, folder->old_wd);
+        folder->old_wd = 0;
+    }
+}
+
+static void budget_demote(budget_t *b, folder_t *folder)
+{
+    tailall_t *ta = b->ta;
+
+    if(folder->old_wd != 0)
+        budget_key_del(ta, folder->old_wd);
+
+    if(inotify_rm_watch(ta->inotify, folder->wd) < 0 && errno != EINVAL)
+        warnfn("inotify_rm_watch %s %d", strerror(errno), folder->wd);
+
+    // events already queued for the watch still find the folder
+    folder->old_wd = folder->wd;
+    folder->wd = --ta->pseudo_wd;
+    budget_key_set(ta, folder->wd, folder);
+
+    folder->demoted = 1;
+    b->used--;
+    b->demoted++;
+    metric_inc(M_BUDGET_DEMOTED);
+
+    pollfs_folder_add2(ta->pollfs, folder, 1);
+}
+
+// return
+//   1  : watched
+//   0  : skipped, the directory is watched under another path
+//  -1  : out of watches
+static int budget_promote(budget_t *b, folder_t *folder)
+{
+    tailall_t *ta = b->ta;
+    char *wdstr;
+    int wd;
+
+    metric_inc(M_SYS_INOTIFY_ADD_WATCH);
+    wd = inotify_add_watch(ta->inotify, folder_path(folder), FOLDER_WATCH_MASK);
+
+    if(wd < 0)
+    {
+        if(errno != ENOSPC)
+            return 0;
+
+        budget_full(b);
+        return -1;
+    }
+
+    wdstr = intdup(wd);
+
+    if(folder_data_get(ta->folder_table, wdstr) != NULL)
+    {
+        free(wdstr);
+        return 0;
+    }
+
+    free(wdstr);
+
+    budget_key_del(ta, folder->wd);
+    folder->wd = wd;
+    budget_key_set(ta, folder->wd, folder);
+
+    folder->demoted = 0;
+    b->demoted--;
+    b->used++;
+    metric_inc(M_BUDGET_PROMOTED);
+
+    pollfs_folder_del(ta->pollfs, folder);
+
+    return 1;
+}
+
+static void budget_push(budget_t *b, folder_t ***list, int *count, folder_t *folder)
+{
+    if(*count == b->size)
+    {
+        b->size = b->size == 0 ? 1024 : b->size * 2;
+        b->cand = realloc(b->cand, b->size * sizeof(folder_t *));
+        b->victim = realloc(b->victim, b->size * sizeof(folder_t *));
+        assert(b->cand != NULL && b->victim != NULL);
+    }
+
+    (*list)[(*count)++] = folder;
+}
+
+static void budget_collect(budget_t *b, folder_t *folder)
+{
+    for(; folder != NULL; folder = folder->next)
+    {
+        if(folder->demoted)
+        {
+            if(folder->activity > 0)
+                budget_push(b, &b->cand, &b->ncand, folder);
+        }else if(!folder->priority && folder->handle == NULL && folder->wd > 0)
+        {
+            budget_push(b, &b->victim, &b->nvictim, folder);
+        }
+
+        budget_collect(b, folder->child_first);
+    }
+}
+
+static void budget_decay(folder_t *folder)
+{
+    for(; folder != NULL; folder = folder->next)
+    {
+        folder->activity >>= 1;
+        budget_decay(folder->child_first);
+    }
+}
+
+// busiest first
+static int budget_cmp_cand(const void *a, const void *b)
+{
+    uint32_t x = (*(folder_t * const *)a)->activity, y = (*(folder_t * const *)b)->activity;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// idlest first
+static int budget_cmp_victim(const void *a, const void *b)
+{
+    return -budget_cmp_cand(a, b);
+}
+
+static void budget_timer_cb(loop_t *loop, void *arg)
+{
+    budget_t *b = arg;
+    tailall_t *ta = b->ta;
+    folder_t *folder;
+    int c, v = 0, i, res;
+
+    b->ncand = 0;
+    b->nvictim = 0;
+
+    for(i = 0; i < ta->nroots; i++)
+        budget_collect(b, ta->roots[i].folder);
+
+    if(b->ncand > 0)
+    {
+        qsort(b->cand, b->ncand, sizeof(folder_t *), budget_cmp_cand);
+        qsort(b->victim, b->nvictim, sizeof(folder_t *), budget_cmp_victim);
+    }
+
+    for(c = 0; c < b->ncand; c++)
+    {
+        folder = b->cand[c];
+
+        // a swap only for a folder clearly busier than the idlest watched
+        if(b->used >= b->limit)
+        {
+            if(v == b->nvictim || b->victim[v]->activity * 2 >= folder->activity)
+                break;
+
+            budget_demote(b, b->victim[v++]);
+        }
+
+        res = budget_promote(b, folder);
+        if(res < 0)
+            break;
+    }
+
+    for(i = 0; i < ta->nroots; i++)
+        budget_decay(ta->roots[i].folder);
+}
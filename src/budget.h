@@ -0,0 +1,63 @@
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <stdint.h>
+
+#include "tailall.h"
+
+#define BUDGET_LIMIT_PATH       "/proc/sys/fs/inotify/max_user_watches"
+#define BUDGET_DEFAULT_LIMIT    8192    // when the limit cannot be read
+#define BUDGET_HEADROOM_PCT     10      // of the limit left to other programs
+#define BUDGET_HEADROOM_MIN     64
+#define BUDGET_INTERVAL         5000    // ms, between rebalances
+#define BUDGET_MAX_PRIORITY     16      // -W patterns
+
+typedef struct _budget budget_t;
+
+struct _budget
+{
+    tailall_t           *ta;
+    int                 hard;       // watches the kernel lets us have
+    int                 limit;      // watches taken by folders of no priority
+    int                 used;       // inotify watches of folders held
+    int                 demoted;    // folders polled instead
+    int                 warned;
+    const char          *priority[BUDGET_MAX_PRIORITY];
+    int                 npriority;
+    folder_t            **cand;     // polled with activity, scratch of a rebalance
+    int                 ncand;
+    folder_t            **victim;   // watched without priority
+    int                 nvictim;
+    int                 size;
+    loop_timer_t        *timer;
+};
+
+// Keeps the inotify watches of the folders within max_user_watches, less
+// some headroom for other programs. A folder past the budget, or refused
+// with ENOSPC, is polled by pollfs instead of being lost. Every
+// BUDGET_INTERVAL the polled folders that saw activity take the watch of
+// the idlest watched ones, folders matching a -W pattern and the roots are
+// never polled. limit 0 reads the kernel limit.
+// Needs ta->pollfs.
+budget_t*       budget_init(tailall_t *ta, int limit);
+void            budget_free(budget_t *b);
+
+// Folders whose path relative to their root, after "<label>/" for a
+// labelled one, matches pattern (fnmatch) are watched first and may take
+// the headroom too.
+// return
+//   0  : Success
+//  -1  : Too many patterns
+int             budget_priority(budget_t *b, const char *pattern);
+
+// Watches folder or has it polled.
+// return
+//   > 0  : inotify watch desc
+//   < -1 : pseudo watch desc, folder->demoted is set
+//   -1   : Error
+int             budget_add(budget_t *b, folder_t *folder, const char *path);
+
+// Gives back what budget_add() took, the folder is being freed.
+void            budget_del(budget_t *b, folder_t *folder);
+
+#endif // _BUDGET_H_
@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "chashtable.h"
+
+#define chashtable_match(d, h, k, l) \
+    ((d)->hval == (h) && (d)->len == (l) && memcmp((d)->key, (k), (l)) == 0)
+
+#define chashtable_load(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define chashtable_store(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+chashtable_t* chashtable_init(int hash_power_size)
+{
+    chashtable_t *table;
+    int i;
+
+    if(posix_memalign((void **)&table, CHASHTABLE_CACHE_LINE, sizeof(chashtable_t)) != 0)
+        return NULL;
+
+    memset(table, 0, sizeof(chashtable_t));
+
+    table->idx = calloc(hashsize(hash_power_size), sizeof(void *));
+
+    if(table->idx == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+
+    table->power = hash_power_size;
+    table->epoch = 1;
+    table->reclaim_at = CHASHTABLE_RETIRE_BATCH;
+
+    for(i = 0; i < CHASHTABLE_LOCKS; i++)
+        pthread_mutex_init(&table->locks[i], NULL);
+
+    pthread_mutex_init(&table->retire_lock, NULL);
+
+    return table;
+}
+
+void chashtable_free(chashtable_t *table)
+{
+    if(table == NULL)
+        return;
+
+    unsigned long int i;
+    hashtable_data_t *data, *next;
+
+    for(i = 0; i < hashsize(table->power); i++)
+    {
+        for(data = table->idx[i]; data != NULL; data = next)
+        {
+            next = data->next;
+            hashtable_data_free(data);
+        }
+    }
+
+    for(i = 0; i < table->nretired; i++)
+        hashtable_data_free(table->retired[i].data);
+
+    for(i = 0; i < CHASHTABLE_LOCKS; i++)
+        pthread_mutex_destroy(&table->locks[i]);
+
+    pthread_mutex_destroy(&table->retire_lock);
+
+    free(table->retired);
+    free(table->idx);
+    free(table);
+}
+
+chashtable_reader_t* chashtable_reader_init(chashtable_t *table)
+{
+    int i, unused;
+
+    for(i = 0; i < CHASHTABLE_MAX_READERS; i++)
+    {
+        unused = 0;
+
+        if(__atomic_compare_exchange_n(&table->readers[i].used, &unused, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return &table->readers[i];
+    }
+
+    return NULL;
+}
+
+void chashtable_reader_free(chashtable_reader_t *reader)
+{
+    if(reader == NULL)
+        return;
+
+    assert(reader->epoch == 0);
+
+    chashtable_store(&reader->used, 0);
+}
+
+void chashtable_read_begin(chashtable_t *table, chashtable_reader_t *reader)
+{
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+
+    // the slot is seen by a reclaim or the unlink before it by the loads after
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void chashtable_read_end(chashtable_reader_t *reader)
+{
+    chashtable_store(&reader->epoch, 0);
+}
+
+hashtable_data_t* chashtable_get(chashtable_t *table, const char *key)
+{
+    if(table == NULL || key == NULL)
+        return NULL;
+
+    return chashtable_get2(table, key, strlen(key));
+}
+
+hashtable_data_t* chashtable_get2(chashtable_t *table, const char *key, const HASH_KEY_LEN len)
+{
+    if(table == NULL || key == NULL)
+        return NULL;
+
+    HASH_VAL hval = hash(key, (size_t)len, 0);
+    hashtable_data_t *data = chashtable_load(&table->idx[hval & hashmask(table->power)]);
+
+    while(data != NULL && !chashtable_match(data, hval, key, len))
+        data = chashtable_load(&data->next);
+
+    return data;
+}
+
+// Frees what no reader can reach any more, under retire_lock.
+static void chashtable_reclaim(chashtable_t *table)
+{
+    uint64_t oldest = UINT64_MAX, epoch;
+    size_t i, n = 0;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for(i = 0; i < CHASHTABLE_MAX_READERS; i++)
+    {
+        epoch = __atomic_load_n(&table->readers[i].epoch, __ATOMIC_SEQ_CST);
+
+        if(epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    // a reader that entered after the retire cannot have seen the node
+    for(i = 0; i < table->nretired; i++)
+    {
+        if(table->retired[i].epoch < oldest)
+            hashtable_data_free(table->retired[i].data);
+        else
+            table->retired[n++] = table->retired[i];
+    }
+
+    table->nretired = n;
+    table->reclaim_at = n + CHASHTABLE_RETIRE_BATCH;
+}
+
+// data is unlinked already, readers on it still follow its next
+static void chashtable_retire(chashtable_t *table, hashtable_data_t *data)
+{
+    pthread_mutex_lock(&table->retire_lock);
+
+    if(table->nretired == table->size)
+    {
+        table->size = table->size == 0 ? CHASHTABLE_RETIRE_BATCH * 2 : table->size * 2;
+        table->retired = realloc(table->retired, table->size * sizeof(chashtable_retired_t));
+        assert(table->retired != NULL);
+    }
+
+    table->retired[table->nretired].data = data;
+    table->retired[table->nretired++].epoch = __atomic_fetch_add(&table->epoch, 1, __ATOMIC_SEQ_CST);
+
+    if(table->nretired >= table->reclaim_at)
+        chashtable_reclaim(table);
+
+    pthread_mutex_unlock(&table->retire_lock);
+}
+
+static pthread_mutex_t* chashtable_lock(chashtable_t *table, HASH_VAL hval)
+{
+    pthread_mutex_t *lock = &table->locks[hval & hashmask(table->power) & (CHASHTABLE_LOCKS - 1)];
+
+    pthread_mutex_lock(lock);
+
+    return lock;
+}
+
+hashtable_data_t* chashtable_set(chashtable_t *table, hashtable_data_t *data)
+{
+    if(table == NULL || data == NULL)
+        return NULL;
+
+    HASH_VAL hval = data->hval;
+    hashtable_data_t **head = &table->idx[hval & hashmask(table->power)];
+    pthread_mutex_t *lock = chashtable_lock(table, hval);
+    hashtable_data_t *idx;
+
+    for(idx = *head; idx != NULL; idx = idx->next)
+    {
+        if(chashtable_match(idx, hval, data->key, data->len))
+        {
+            pthread_mutex_unlock(lock);
+            return NULL;
+        }
+    }
+
+    // complete before it is reachable
+    data->next = *head;
+    chashtable_store(head, data);
+
+    __atomic_add_fetch(&table->data_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(lock);
+
+    return data;
+}
+
+hashtable_data_t* chashtable_replace(chashtable_t *table, hashtable_data_t *new_data)
+{
+    if(table == NULL || new_data == NULL)
+        return NULL;
+
+    HASH_VAL hval = new_data->hval;
+    hashtable_data_t **link = &table->idx[hval & hashmask(table->power)];
+    pthread_mutex_t *lock = chashtable_lock(table, hval);
+    hashtable_data_t *idx;
+
+    for(; (idx = *link) != NULL; link = &idx->next)
+    {
+        if(chashtable_match(idx, hval, new_data->key, new_data->len))
+        {
+            new_data->next = idx->next;
+            chashtable_store(link, new_data);
+            pthread_mutex_unlock(lock);
+
+            chashtable_retire(table, idx);
+            return new_data;
+        }
+    }
+
+    new_data->next = NULL;
+    chashtable_store(link, new_data);
+
+    __atomic_add_fetch(&table->data_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(lock);
+
+    return new_data;
+}
+
+void chashtable_del(chashtable_t *table, const char *key)
+{
+    if(table == NULL || key == NULL)
+        return;
+
+    chashtable_del2(table, key, strlen(key));
+}
+
+void chashtable_del2(chashtable_t *table, const char *key, const HASH_KEY_LEN len)
+{
+    if(table == NULL || key == NULL)
+        return;
+
+    HASH_VAL hval = hash(key, (size_t)len, 0);
+    hashtable_data_t **link = &table->idx[hval & hashmask(table->power)];
+    pthread_mutex_t *lock = chashtable_lock(table, hval);
+    hashtable_data_t *idx;
+
+    for(; (idx = *link) != NULL; link = &idx->next)
+    {
+        if(chashtable_match(idx, hval, key, len))
+        {
+            chashtable_store(link, idx->next);
+            __atomic_sub_fetch(&table->data_count, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(lock);
+
+            chashtable_retire(table, idx);
+            return;
+        }
+    }
+
+    pthread_mutex_unlock(lock);
+}
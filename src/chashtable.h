@@ -0,0 +1,87 @@
+#ifndef _CHASHTABLE_H_
+#define _CHASHTABLE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hashtable.h"
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+#define CHASHTABLE_MAX_READERS  64
+#define CHASHTABLE_LOCKS        64      // writer stripes, by bucket
+#define CHASHTABLE_RETIRE_BATCH 64      // nodes retired between two reclaims
+#define CHASHTABLE_CACHE_LINE   64
+
+typedef struct _chashtable_reader chashtable_reader_t;
+typedef struct _chashtable_retired chashtable_retired_t;
+typedef struct _chashtable chashtable_t;
+
+// one cache line each, readers never write to a shared one
+struct _chashtable_reader
+{
+    uint64_t            epoch;      // table epoch at chashtable_read_begin(), 0 outside
+    int                 used;
+} __attribute__((aligned(CHASHTABLE_CACHE_LINE)));
+
+struct _chashtable_retired
+{
+    hashtable_data_t    *data;
+    uint64_t            epoch;      // table epoch it was unlinked in
+};
+
+// hashtable_t for many reader threads and few writes. Lookups take no lock
+// and write nothing shared: a reader publishes the epoch it entered in and
+// follows the chains with acquire loads. Writers are serialised per stripe
+// of buckets and publish with release stores. A node unlinked by del or
+// replace is retired, then freed, cb_free included, once every reader has
+// left the epochs it could still be seen in (epoch based reclamation).
+struct _chashtable
+{
+    chashtable_reader_t readers[CHASHTABLE_MAX_READERS];
+    int                 power;
+    hashtable_data_t    **idx;
+    uint64_t            data_count;
+    uint64_t            epoch;      // from 1, bumped by every retire
+    pthread_mutex_t     locks[CHASHTABLE_LOCKS];
+    pthread_mutex_t     retire_lock;
+    chashtable_retired_t *retired;
+    size_t              nretired;
+    size_t              size;
+    size_t              reclaim_at; // nretired the next reclaim runs at
+};
+
+chashtable_t*       chashtable_init(int hash_power_size);
+// No reader may be left. Frees every data with hashtable_data_free().
+void                chashtable_free(chashtable_t *table);
+
+// A slot for one reader thread, held until chashtable_reader_free().
+// return
+//   NULL : all CHASHTABLE_MAX_READERS taken
+chashtable_reader_t* chashtable_reader_init(chashtable_t *table);
+void                chashtable_reader_free(chashtable_reader_t *reader);
+
+// Data got in between stays valid until chashtable_read_end(), sections do
+// not nest. Keep them short, nothing retired meanwhile can be freed.
+void                chashtable_read_begin(chashtable_t *table, chashtable_reader_t *reader);
+void                chashtable_read_end(chashtable_reader_t *reader);
+
+// Within a read section
+hashtable_data_t*   chashtable_get(chashtable_t *table, const char *key);
+hashtable_data_t*   chashtable_get2(chashtable_t *table, const char *key, const HASH_KEY_LEN len);
+
+// Same as their hashtable_t versions, from any thread. A data replaced or
+// deleted is freed later, on the thread of a later retire.
+hashtable_data_t*   chashtable_set(chashtable_t *table, hashtable_data_t *data);
+hashtable_data_t*   chashtable_replace(chashtable_t *table, hashtable_data_t *data);
+void                chashtable_del(chashtable_t *table, const char *key);
+void                chashtable_del2(chashtable_t *table, const char *key, const HASH_KEY_LEN len);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _CHASHTABLE_H_
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "compress.h"
+#include "metrics.h"
+
+#define COMPRESS_SPARE_MAX  4
+
+static void compress_out(compress_t *z, size_t len)
+{
+    size_t off = 0;
+    ssize_t ret;
+
+    while(off < len)
+    {
+        ret = write(z->fd, z->out + off, len - off);
+        metric_inc(M_SYS_WRITE);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            // nobody to write to, keep draining so the writer never waits
+            return;
+        }
+
+        off += ret;
+        metric_add(M_BYTES_WRITTEN, ret);
+    }
+}
+
+static void compress_deflate(compress_t *z, const char *buf, size_t len, int flush)
+{
+    z->zs.next_in = (unsigned char *)buf;
+    z->zs.avail_in = len;
+
+    do
+    {
+        z->zs.next_out = z->out;
+        z->zs.avail_out = COMPRESS_OUT_SIZE;
+
+        deflate(&z->zs, flush);
+
+        compress_out(z, COMPRESS_OUT_SIZE - z->zs.avail_out);
+    } while(z->zs.avail_out == 0);
+}
+
+static void* compress_worker(void *arg)
+{
+    compress_t *z = arg;
+    compress_block_t *block;
+    int more;
+
+    pthread_mutex_lock(&z->lock);
+
+    while(1)
+    {
+        // caught up, take the partly filled block too
+        if(z->qhead == NULL && z->current != NULL && z->current->len > 0)
+        {
+            z->qhead = z->qtail = z->current;
+            z->current = NULL;
+            z->qcount++;
+        }
+
+        if(z->qhead == NULL)
+        {
+            if(z->done)
+                break;
+
+            pthread_cond_wait(&z->cond, &z->lock);
+            continue;
+        }
+
+        block = z->qhead;
+        z->qhead = block->next;
+        if(z->qhead == NULL)
+            z->qtail = NULL;
+        z->qcount--;
+        more = z->qhead != NULL;
+
+        pthread_cond_broadcast(&z->cond);
+        pthread_mutex_unlock(&z->lock);
+
+        // frame boundary only when there is nothing behind this block
+        compress_deflate(z, block->data, block->len, more ? Z_NO_FLUSH : Z_SYNC_FLUSH);
+
+        pthread_mutex_lock(&z->lock);
+
+        if(z->nspare < COMPRESS_SPARE_MAX)
+        {
+            block->next = z->spare;
+            z->spare = block;
+            z->nspare++;
+            block = NULL;
+        }
+
+        free(block);
+    }
+
+    pthread_mutex_unlock(&z->lock);
+
+    compress_deflate(z, NULL, 0, Z_FINISH);
+
+    return NULL;
+}
+
+compress_t* compress_init(int fd, int level)
+{
+    compress_t *z = calloc(sizeof(compress_t), 1);
+    sigset_t all, old;
+    int ret;
+
+    if(z == NULL)
+        return NULL;
+
+    z->fd = fd;
+    z->level = level;
+
+    // 15 + 16 : gzip wrapper, readable by zcat
+    if(deflateInit2(&z->zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(z);
+        return NULL;
+    }
+
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+
+    // signals are for the loop thread, SIGUSR1 to its signalfd
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    ret = pthread_create(&z->thread, NULL, compress_worker, z);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(ret != 0)
+    {
+        deflateEnd(&z->zs);
+        pthread_mutex_destroy(&z->lock);
+        pthread_cond_destroy(&z->cond);
+        free(z);
+        return NULL;
+    }
+
+    return z;
+}
+
+void compress_free(compress_t *z)
+{
+    compress_block_t *block;
+
+    if(z == NULL)
+        return;
+
+    pthread_mutex_lock(&z->lock);
+    z->done = 1;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+
+    pthread_join(z->thread, NULL);
+
+    deflateEnd(&z->zs);
+
+    while((block = z->spare) != NULL)
+    {
+        z->spare = block->next;
+        free(block);
+    }
+
+    free(z->current);
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->cond);
+    free(z);
+}
+
+// called with the lock held
+static compress_block_t* compress_block_get(compress_t *z)
+{
+    compress_block_t *block = z->spare;
+
+    if(block != NULL)
+    {
+        z->spare = block->next;
+        z->nspare--;
+    }else
+    {
+        block = malloc(sizeof(compress_block_t));
+        assert(block != NULL);
+    }
+
+    block->len = 0;
+    block->next = NULL;
+
+    return block;
+}
+
+int compress_writev(void *arg, const struct iovec *iov, int iovcnt)
+{
+    compress_t *z = arg;
+    const char *p;
+    size_t len, n;
+    int i;
+
+    pthread_mutex_lock(&z->lock);
+
+    for(i = 0; i < iovcnt; i++)
+    {
+        p = iov[i].iov_base;
+        len = iov[i].iov_len;
+
+        while(len > 0)
+        {
+            if(z->current == NULL)
+                z->current = compress_block_get(z);
+
+            n = COMPRESS_BLOCK_SIZE - z->current->len;
+            if(n > len)
+                n = len;
+
+            memcpy(z->current->data + z->current->len, p, n);
+            z->current->len += n;
+            p += n;
+            len -= n;
+
+            if(z->current->len == COMPRESS_BLOCK_SIZE)
+            {
+                // bounded memory, wait for the worker only when far behind
+                while(z->qcount >= COMPRESS_QUEUE_LIMIT)
+                    pthread_cond_wait(&z->cond, &z->lock);
+
+                if(z->qtail == NULL)
+                    z->qhead = z->qtail = z->current;
+                else
+                    z->qtail = z->qtail->next = z->current;
+
+                z->qcount++;
+                z->current = NULL;
+            }
+        }
+    }
+
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+
+    return 0;
+}
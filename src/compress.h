@@ -0,0 +1,64 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+#define COMPRESS_BLOCK_SIZE     (1024*256)
+#define COMPRESS_QUEUE_LIMIT    128         // blocks, the writer waits past this
+#define COMPRESS_OUT_SIZE       (1024*64)
+#define COMPRESS_LEVEL_FAST     1
+
+typedef struct _compress_block compress_block_t;
+typedef struct _compress compress_t;
+
+struct _compress_block
+{
+    size_t              len;
+    compress_block_t    *next;
+    char                data[COMPRESS_BLOCK_SIZE];
+};
+
+// gzip stream written by a worker thread. Blocks are deflated as they come
+// and the stream is Z_SYNC_FLUSHed whenever the worker catches up, so a
+// reader sees every flush without waiting for the stream to end.
+struct _compress
+{
+    int                 fd;
+    int                 level;
+    z_stream            zs;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;       // queue changed
+    compress_block_t    *current;   // being filled by the writer
+    compress_block_t    *qhead;
+    compress_block_t    *qtail;
+    compress_block_t    *spare;     // recycled blocks
+    int                 nspare;
+    int                 qcount;
+    int                 done;
+    unsigned char       out[COMPRESS_OUT_SIZE];
+};
+
+compress_t*     compress_init(int fd, int level);
+
+// Finish the stream and join the worker
+void            compress_free(compress_t *z);
+
+// output_t writer, copies the slices and hands full blocks to the worker
+// return
+//   0 : Success
+int             compress_writev(void *arg, const struct iovec *iov, int iovcnt);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _COMPRESS_H_
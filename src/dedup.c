@@ -0,0 +1,255 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "dedup.h"
+#include "metrics.h"
+
+static void dedup_timer_cb(loop_t *loop, void *arg);
+
+dedup_t* dedup_init(tailall_t *ta, int window)
+{
+    assert(ta != NULL);
+    assert(window > 0);
+
+    dedup_t *dd;
+
+    dd = calloc(sizeof(dedup_t), 1);
+    assert(dd != NULL);
+
+    dd->slots = calloc(sizeof(dedup_slot_t), hashsize(DEDUP_POWER));
+    assert(dd->slots != NULL);
+
+    dd->ta = ta;
+    dd->sink = ta->sink;
+    dd->window = window;
+    dd->timer = loop_add_timer(ta->loop, window, dedup_timer_cb, dd);
+
+    ta->sink = dedup_sink;
+    ta->dedup = dd;
+
+    return dd;
+}
+
+static void dedup_ref(dedup_slot_t *slot, file_t *file)
+{
+    if(slot->file == file)
+        return;
+
+    if(slot->file != NULL)
+        slot->file->dedup_refs--;
+
+    slot->file = file;
+
+    if(file != NULL)
+        file->dedup_refs++;
+}
+
+static void dedup_summary(dedup_t *dd, dedup_slot_t *slot)
+{
+    char buf[DEDUP_SAMPLE + 64];
+    int len;
+
+    if(slot->count == 0)
+        return;
+
+    len = snprintf(buf, sizeof(buf), "[repeated %u times] %.*s%s\n", slot->count,
+                    (int)(slot->len < DEDUP_SAMPLE ? slot->len : DEDUP_SAMPLE), slot->sample,
+                    slot->len > DEDUP_SAMPLE ? "..." : "");
+
+    slot->count = 0;
+
+    // best effort, a full sink loses it
+    dd->sink(dd->ta, slot->file, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+}
+
+static int dedup_same(dedup_slot_t *slot, HASH_VAL h, const char *p, size_t len)
+{
+    return slot->len == len && slot->hash == h &&
+            memcmp(slot->sample, p, len < DEDUP_SAMPLE ? len : DEDUP_SAMPLE) == 0;
+}
+
+// return
+//   1 : the line is written, 0 : dropped
+static int dedup_judge(dedup_t *dd, file_t *file, off_t offset, const char *p, size_t len, uint64_t now)
+{
+    int again = offset < file->dedup_seen;
+
+    dedup_slot_t *slot;
+    HASH_VAL h;
+    size_t n;
+
+    if(len < DEDUP_MIN_LINE)
+        return 1;
+
+    h = hash(p, len, 0);
+    slot = &dd->slots[h & hashmask(DEDUP_POWER) & ~(HASH_VAL)1];
+    n = len < DEDUP_SAMPLE ? len : DEDUP_SAMPLE;
+
+    // two ways, the one seen last stays against a stream of new lines
+    if(!dedup_same(slot, h, p, len) && (dedup_same(slot + 1, h, p, len) || slot[1].last < slot->last))
+        slot++;
+
+    if(dedup_same(slot, h, p, len))
+    {
+        // the one written, read again after a full sink
+        if(slot->first_id == file->id && slot->first_offset == offset)
+            return 1;
+
+        // dropped and counted already, read again
+        if(again)
+            return 0;
+
+        if(now - slot->last < (uint64_t)dd->window)
+        {
+            slot->last = now;
+            slot->count++;
+            dedup_ref(slot, file);
+
+            metric_inc(M_DEDUP_LINES);
+            metric_add(M_DEDUP_BYTES, len + 1);
+            return 0;
+        }
+    }
+
+    // a new line, or one quiet for a window, takes the slot
+    dedup_summary(dd, slot);
+
+    slot->hash = h;
+    slot->len = len;
+    slot->last = now;
+    slot->first_id = file->id;
+    slot->first_offset = offset;
+    memcpy(slot->sample, p, n);
+    dedup_ref(slot, file);
+
+    return 1;
+}
+
+int dedup_sink(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    dedup_t *dd = ta->dedup;
+    const char *p = buf, *end = buf + len, *eol;
+    uint64_t now = loop_now_ms();
+    size_t out = 0, judged = 0, n;
+    int nrun = 1, open = file->dedup_open, copied = 0, done, i;
+
+    dd->run_in[0] = 0;
+    dd->run_out[0] = 0;
+
+    // the rest of a line the read before split
+    if(open)
+    {
+        eol = memchr(p, '\n', len);
+        p = eol != NULL ? eol + 1 : end;
+        out = p - buf;
+    }
+
+    while(p < end)
+    {
+        eol = memchr(p, '\n', end - p);
+
+        // split by the read, passed as it is
+        if(eol == NULL)
+            n = end - p;
+        else
+            n = eol + 1 - p;
+
+        if(eol != NULL)
+            judged = p + n - buf;
+
+        if(eol == NULL || dedup_judge(dd, file, file->offset + (p - buf), p, n - 1, now))
+        {
+            if(copied)
+                memcpy(dd->buf + out, p, n);
+
+            out += n;
+            p += n;
+            continue;
+        }
+
+        // kept bytes are gathered in dd->buf from the first line dropped
+        if(!copied)
+        {
+            memcpy(dd->buf, buf, out);
+            copied = 1;
+        }
+
+        p += n;
+
+        // the run goes on after the dropped line
+        if(dd->run_out[nrun - 1] == out)
+        {
+            dd->run_in[nrun - 1] = p - buf;
+        }else
+        {
+            dd->run_in[nrun] = p - buf;
+            dd->run_out[nrun++] = out;
+        }
+    }
+
+    file->dedup_open = len > 0 && buf[len - 1] != '\n';
+
+    if(file->offset + (off_t)judged > file->dedup_seen)
+        file->dedup_seen = file->offset + judged;
+
+    if(out == 0)
+        return len;
+
+    done = dd->sink(ta, file, copied ? dd->buf : buf, out);
+
+    if(done < 0 || (size_t)done == out)
+        return done < 0 ? -1 : (int)len;
+
+    // a full sink, back to the offset in buf of the first byte left
+    for(i = nrun - 1; dd->run_out[i] > (uint32_t)done; i--)
+        ;
+
+    n = dd->run_in[i] + (done - dd->run_out[i]);
+    file->dedup_open = n > 0 ? buf[n - 1] != '\n' : open;
+
+    return n;
+}
+
+static void dedup_timer_cb(loop_t *loop, void *arg)
+{
+    dedup_t *dd = arg;
+    unsigned long i;
+
+    for(i = 0; i < hashsize(DEDUP_POWER); i++)
+        dedup_summary(dd, &dd->slots[i]);
+}
+
+void dedup_file_free(tailall_t *ta, file_t *file)
+{
+    dedup_t *dd = ta->dedup;
+    unsigned long i;
+
+    if(dd == NULL)
+        return;
+
+    for(i = 0; i < hashsize(DEDUP_POWER) && file->dedup_refs > 0; i++)
+    {
+        if(dd->slots[i].file != file)
+            continue;
+
+        dedup_summary(dd, &dd->slots[i]);
+        dedup_ref(&dd->slots[i], NULL);
+        dd->slots[i].len = 0;
+    }
+}
+
+void dedup_free(dedup_t *dd)
+{
+    if(dd == NULL)
+        return;
+
+    dedup_timer_cb(dd->ta->loop, dd);
+    loop_del_timer(dd->ta->loop, dd->timer);
+
+    dd->ta->sink = dd->sink;
+    dd->ta->dedup = NULL;
+    free(dd->slots);
+    free(dd);
+}
@@ -0,0 +1,58 @@
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdint.h>
+
+#include "tailall.h"
+#include "hash.h"
+
+#define DEDUP_POWER         13      // slots, lines remembered at most
+#define DEDUP_SAMPLE        112     // bytes of a line kept for its summary
+#define DEDUP_MIN_LINE      8       // shorter lines, blank ones too, always pass
+#define DEDUP_MAX_RUNS      (FILE_BUF_SIZE / DEDUP_MIN_LINE + 2)
+
+typedef struct _dedup_slot dedup_slot_t;
+typedef struct _dedup dedup_t;
+
+struct _dedup_slot
+{
+    HASH_VAL            hash;
+    uint32_t            len;        // of the line without '\n', 0 for a free slot
+    uint32_t            count;      // suppressed since the last summary
+    uint64_t            last;       // loop_now_ms() it was last seen
+    file_t              *file;      // last seen in, the summary goes there
+    uint64_t            first_id;   // file id and offset of the line written,
+    off_t               first_offset;   // read again after a full sink it passes
+    char                sample[DEDUP_SAMPLE];
+};
+
+struct _dedup
+{
+    tailall_t           *ta;
+    tailall_sink_t      sink;       // kept lines go on to
+    int                 window;     // ms
+    loop_timer_t        *timer;
+    dedup_slot_t        *slots;
+    uint32_t            run_in[DEDUP_MAX_RUNS];     // kept runs of a chunk, offsets in
+    uint32_t            run_out[DEDUP_MAX_RUNS];    // buf and in the kept bytes
+    char                buf[FILE_BUF_SIZE];
+};
+
+// Puts itself in front of ta->sink and drops a line seen in any file less
+// than window ms before, if still in one of the two slots of its set.
+// Every window ms the dropped lines are summed up, "[repeated N times]
+// <line>", in the file last seen in. A line costs one hash() and a look at
+// two slots whatever the number of distinct lines, one pushed out by newer
+// ones is written again. Lines split by a read are passed as they are.
+dedup_t*        dedup_init(tailall_t *ta, int window);
+
+// Writes the summaries due and gives ta->sink back.
+void            dedup_free(dedup_t *dd);
+
+// tailall_sink_t ta->sink is replaced with
+int             dedup_sink(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+// The file is being freed, summaries due there are written now.
+void            dedup_file_free(tailall_t *ta, file_t *file);
+
+#endif // _DEDUP_H_
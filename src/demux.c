@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "demux.h"
+#include "metrics.h"
+
+static void demux_timer_cb(loop_t *loop, void *arg)
+{
+    demux_flush((demux_t *)arg);
+}
+
+demux_t* demux_init(tailall_t *ta, const char *dir, const char *pattern)
+{
+    assert(ta != NULL);
+    assert(dir != NULL);
+
+    char root[PATH_MAX], out[PATH_MAX];
+    demux_t *demux;
+    int i;
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        errfn("%s %s", strerror(errno), dir);
+        return NULL;
+    }
+
+    // writing under a watched root would feed on itself
+    for(i = 0; i < ta->nroots; i++)
+    {
+        if(realpath(ta->roots[i].path, root) == NULL || realpath(dir, out) == NULL)
+            continue;
+
+        size_t len = strlen(root);
+
+        if(strncmp(root, out, len) == 0 && (out[len] == '/' || out[len] == '\0' || len == 1))
+        {
+            errfn("Output directory %s is under the watched directory %s", dir, ta->roots[i].path);
+            return NULL;
+        }
+    }
+
+    demux = calloc(sizeof(demux_t), 1);
+    assert(demux != NULL);
+
+    demux->ta = ta;
+    demux->dir = strdup(dir);
+    demux->pattern = strdup(pattern != NULL ? pattern : DEMUX_DEFAULT_PATTERN);
+    demux->table = hashtable_init(DEMUX_TABLE_POWER, NULL);
+    assert(demux->table != NULL);
+    demux->max = DEMUX_FD_MAX;
+    demux->timer = loop_add_timer(ta->loop, DEMUX_FLUSH_INTERVAL, demux_timer_cb, demux);
+
+    return demux;
+}
+
+static void demux_write(demux_fd_t *dfd, const char *buf, size_t len)
+{
+    size_t off = 0;
+    ssize_t ret;
+
+    while(off < len)
+    {
+        ret = write(dfd->fd, buf + off, len - off);
+        metric_inc(M_SYS_WRITE);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            warnfn("%s %s", strerror(errno), dfd->path);
+            break;
+        }
+
+        off += ret;
+        metric_add(M_BYTES_WRITTEN, ret);
+    }
+}
+
+static void demux_fd_flush(demux_fd_t *dfd)
+{
+    demux_write(dfd, dfd->buf, dfd->len);
+    dfd->len = 0;
+}
+
+static void demux_lru_unlink(demux_t *demux, demux_fd_t *dfd)
+{
+    if(dfd->prev != NULL)
+        dfd->prev->next = dfd->next;
+    else
+        demux->lru_first = dfd->next;
+
+    if(dfd->next != NULL)
+        dfd->next->prev = dfd->prev;
+    else
+        demux->lru_last = dfd->prev;
+
+    dfd->prev = dfd->next = NULL;
+}
+
+static void demux_lru_push(demux_t *demux, demux_fd_t *dfd)
+{
+    dfd->next = demux->lru_first;
+
+    if(demux->lru_first != NULL)
+        demux->lru_first->prev = dfd;
+    else
+        demux->lru_last = dfd;
+
+    demux->lru_first = dfd;
+}
+
+static void demux_fd_close(demux_t *demux, demux_fd_t *dfd)
+{
+    demux_fd_flush(dfd);
+    demux_lru_unlink(demux, dfd);
+    hashtable_del(demux->table, dfd->path);
+    demux->count--;
+
+    close(dfd->fd);
+    free(dfd->buf);
+    free(dfd->path);
+    free(dfd);
+}
+
+void demux_free(demux_t *demux)
+{
+    if(demux == NULL)
+        return;
+
+    while(demux->lru_first != NULL)
+        demux_fd_close(demux, demux->lru_first);
+
+    loop_del_timer(demux->ta->loop, demux->timer);
+    // empty by now, every descriptor took its entry with it
+    hashtable_free(demux->table);
+    free(demux->pattern);
+    free(demux->dir);
+    free(demux);
+}
+
+void demux_flush(demux_t *demux)
+{
+    demux_fd_t *dfd;
+
+    for(dfd = demux->lru_first; dfd != NULL; dfd = dfd->next)
+    {
+        if(dfd->len > 0)
+            demux_fd_flush(dfd);
+    }
+}
+
+// return
+//   length of the output path, -1 if it does not fit
+static int demux_path(demux_t *demux, file_t *file, char *buf, size_t size)
+{
+    // a labelled root is a directory of its own
+    const char *rel = folder_path2(file->folder, FOLDER_PATH_REL | FOLDER_PATH_LABEL);
+    const char *p;
+    size_t len;
+    int n;
+
+    n = snprintf(buf, size, "%s/", demux->dir);
+
+    for(p = demux->pattern; *p != '\0' && n < (int)size; p++)
+    {
+        if(*p != '%' || p[1] == '\0')
+        {
+            buf[n++] = *p;
+            continue;
+        }
+
+        switch(*++p)
+        {
+            case 'p':
+                n += snprintf(buf + n, size - n, "%s%s", rel, file->name);
+                break;
+            case 'd':
+                len = strlen(rel);
+                if(len == 0)
+                    n += snprintf(buf + n, size - n, ".");
+                else
+                    n += snprintf(buf + n, size - n, "%.*s", (int)len - 1, rel);
+                break;
+            case 'f':
+                n += snprintf(buf + n, size - n, "%s", file->name);
+                break;
+            default:
+                buf[n++] = *p;
+                break;
+        }
+    }
+
+    if(n >= (int)size)
+        return -1;
+
+    buf[n] = '\0';
+
+    return n;
+}
+
+static void mkdir_parents(char *path)
+{
+    char *p;
+
+    for(p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+static demux_fd_t* demux_fd_get(demux_t *demux, file_t *file)
+{
+    char path[PATH_MAX];
+    hashtable_data_t *hdata;
+    demux_fd_t *dfd;
+    int fd;
+
+    if(demux_path(demux, file, path, sizeof(path)) < 0)
+    {
+        warnfn("Output path too long for %s%s", folder_path(file->folder), file->name);
+        return NULL;
+    }
+
+    hdata = hashtable_get(demux->table, path);
+
+    if(hdata != NULL)
+    {
+        dfd = hdata->data;
+
+        if(demux->lru_first != dfd)
+        {
+            demux_lru_unlink(demux, dfd);
+            demux_lru_push(demux, dfd);
+        }
+
+        return dfd;
+    }
+
+    if(demux->count >= demux->max)
+        demux_fd_close(demux, demux->lru_last);
+
+    // no O_APPEND, copy_file_range() refuses it. We are the only writer.
+    fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0 && errno == ENOENT)
+    {
+        mkdir_parents(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    }
+
+    if(fd < 0)
+    {
+        warnfn("%s %s", strerror(errno), path);
+        return NULL;
+    }
+
+    lseek(fd, 0, SEEK_END);
+
+    dfd = calloc(sizeof(demux_fd_t), 1);
+    assert(dfd != NULL);
+
+    dfd->path = strdup(path);
+    dfd->fd = fd;
+
+    hdata = hashtable_data_init(dfd->path, dfd, NULL);
+    assert(hdata != NULL);
+    hashtable_set(demux->table, hdata);
+
+    demux_lru_push(demux, dfd);
+    demux->count++;
+
+    debugfn("demux open %s (%d/%d)", path, demux->count, demux->max);
+
+    return dfd;
+}
+
+// Buffered path, used when the bytes had to be read() anyway.
+int sink_demux(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    demux_t *demux = ta->sink_data;
+    demux_fd_t *dfd = demux_fd_get(demux, file);
+
+    if(dfd == NULL)
+        return -1;
+
+    if(dfd->len + len > DEMUX_BUF_SIZE)
+        demux_fd_flush(dfd);
+
+    if(len >= DEMUX_BUF_SIZE)
+    {
+        demux_write(dfd, buf, len);
+        return len;
+    }
+
+    if(dfd->buf == NULL)
+    {
+        dfd->buf = malloc(DEMUX_BUF_SIZE);
+        assert(dfd->buf != NULL);
+    }
+
+    memcpy(dfd->buf + dfd->len, buf, len);
+    dfd->len += len;
+
+    return len;
+}
+
+// Move the appended range in the kernel.
+// return
+//   bytes copied, -1 to fall back to read() and sink_demux()
+ssize_t splice_demux(tailall_t *ta, file_t *file)
+{
+    demux_t *demux = ta->sink_data;
+    demux_fd_t *dfd = demux_fd_get(demux, file);
+    ssize_t ret, total = 0;
+
+    if(dfd == NULL || dfd->nosplice)
+        return -1;
+
+    if(dfd->len > 0)
+        demux_fd_flush(dfd);
+
+    while((ret = copy_file_range(file->fd, NULL, dfd->fd, NULL, 1 << 30, 0)) > 0)
+    {
+        metric_inc(M_SYS_COPY_FILE_RANGE);
+        total += ret;
+    }
+
+    metric_inc(M_SYS_COPY_FILE_RANGE);
+    metric_add(M_BYTES_READ, total);
+    metric_add(M_BYTES_WRITTEN, total);
+
+    if(ret < 0)
+    {
+        if(errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)
+            warnfn("copy_file_range() %s %s", strerror(errno), dfd->path);
+
+        debugfn("demux %s falls back to read(), %s", dfd->path, strerror(errno));
+        dfd->nosplice = 1;
+
+        // the source offset moved with what was copied, file->offset has to
+        return total > 0 ? total : -1;
+    }
+
+    return total;
+}
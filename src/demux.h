@@ -0,0 +1,51 @@
+#ifndef _DEMUX_H_
+#define _DEMUX_H_
+
+#include "tailall.h"
+
+#define DEMUX_FD_MAX            256             // open output descriptors
+#define DEMUX_BUF_SIZE          (1024*64)       // per output, read() fallback only
+#define DEMUX_FLUSH_INTERVAL    200             // ms
+#define DEMUX_TABLE_POWER       12
+#define DEMUX_DEFAULT_PATTERN   "%p"
+
+typedef struct _demux_fd demux_fd_t;
+typedef struct _demux demux_t;
+
+struct _demux_fd
+{
+    char                *path;
+    int                 fd;
+    int                 nosplice;   // copy_file_range() not possible
+    size_t              len;
+    char                *buf;
+    demux_fd_t          *prev;      // LRU, more recently used
+    demux_fd_t          *next;
+};
+
+struct _demux
+{
+    tailall_t           *ta;
+    char                *dir;
+    char                *pattern;
+    hashtable_t         *table;     // output path -> demux_fd_t
+    demux_fd_t          *lru_first;
+    demux_fd_t          *lru_last;
+    int                 count;
+    int                 max;
+    loop_timer_t        *timer;
+};
+
+// pattern, relative to dir
+//   %p : path of the source relative to the root
+//   %d : directory of the source relative to the root, '.' for the root
+//   %f : file name of the source
+//   %% : '%'
+demux_t*        demux_init(tailall_t *ta, const char *dir, const char *pattern);
+void            demux_free(demux_t *demux);
+void            demux_flush(demux_t *demux);
+
+int             sink_demux(tailall_t *ta, file_t *file, const char *buf, size_t len);
+ssize_t         splice_demux(tailall_t *ta, file_t *file);
+
+#endif // _DEMUX_H_
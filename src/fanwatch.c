@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fanwatch.h"
+#include "metrics.h"
+#include "trace.h"
+
+static void fanwatch_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    fanwatch_read((fanwatch_t *)arg);
+}
+
+// "<fsid>.<type>.<handle>" in hex
+static void fanwatch_key(char *buf, const fsid_t *fsid, const struct file_handle *fh)
+{
+    const unsigned char *p = (const unsigned char *)fsid;
+    static const char hex[] = "0123456789abcdef";
+    unsigned int i;
+
+    for(i = 0; i < sizeof(fsid_t); i++)
+    {
+        *buf++ = hex[p[i] >> 4];
+        *buf++ = hex[p[i] & 15];
+    }
+
+    buf += sprintf(buf, ".%x.", fh->handle_type);
+
+    for(i = 0; i < fh->handle_bytes && i < MAX_HANDLE_SZ; i++)
+    {
+        *buf++ = hex[fh->f_handle[i] >> 4];
+        *buf++ = hex[fh->f_handle[i] & 15];
+    }
+
+    *buf = '\0';
+}
+
+// return
+//   1 : the filesystem of path carries our mark
+static int fanwatch_mark(fanwatch_t *fw, const char *path, fsid_t *fsid)
+{
+    struct statfs sfs;
+    int i;
+
+    if(statfs(path, &sfs) < 0)
+        return 0;
+
+    *fsid = sfs.f_fsid;
+
+    for(i = 0; i < fw->nfs; i++)
+    {
+        if(memcmp(&fw->fs[i].fsid, fsid, sizeof(fsid_t)) == 0)
+            return fw->fs[i].marked;
+    }
+
+    if(fw->nfs == FANWATCH_MAX_FS)
+        return 0;
+
+    fw->fs[fw->nfs].fsid = *fsid;
+    fw->fs[fw->nfs].marked = fanotify_mark(fw->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                                            FANWATCH_MASK, AT_FDCWD, path) == 0;
+
+    if(!fw->fs[fw->nfs].marked)
+        warnfn("%s, inotify watches for the filesystem of %s", strerror(errno), path);
+
+    return fw->fs[fw->nfs++].marked;
+}
+
+fanwatch_t* fanwatch_init(tailall_t *ta)
+{
+    assert(ta != NULL);
+
+    fanwatch_t *fw;
+    fsid_t fsid;
+    int fd;
+
+    fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY);
+    if(fd < 0)
+    {
+        warnfn("fanotify_init %s, using inotify", strerror(errno));
+        return NULL;
+    }
+
+    fw = calloc(sizeof(fanwatch_t), 1);
+    assert(fw != NULL);
+
+    fw->ta = ta;
+    fw->fd = fd;
+
+    // the filesystem of the root decides, one refusal there is all of it
+    if(!fanwatch_mark(fw, ta->path, &fsid))
+    {
+        close(fd);
+        free(fw);
+        return NULL;
+    }
+
+    fw->handles = hashtable_init(FANWATCH_TABLE_POWER, NULL);
+    assert(fw->handles != NULL);
+
+    loop_add_fd(ta->loop, fd, POLLIN, fanwatch_cb, fw);
+
+    return fw;
+}
+
+void fanwatch_free(fanwatch_t *fw)
+{
+    if(fw == NULL)
+        return;
+
+    loop_del_fd(fw->ta->loop, fw->fd);
+    close(fw->fd);
+
+    // keys are freed with their folders
+    hashtable_free(fw->handles);
+    free(fw);
+}
+
+int fanwatch_add(fanwatch_t *fw, folder_t *folder, const char *path)
+{
+    assert(fw != NULL);
+    assert(folder != NULL);
+
+    union
+    {
+        struct file_handle fh;
+        char buf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } h;
+    char key[FANWATCH_KEY_SIZE];
+    fsid_t fsid;
+    int mount_id;
+
+    if(!fanwatch_mark(fw, path, &fsid))
+        return 0;
+
+    h.fh.handle_bytes = MAX_HANDLE_SZ;
+
+    if(name_to_handle_at(AT_FDCWD, path, &h.fh, &mount_id, 0) < 0)
+    {
+        warnfn("name_to_handle_at %s %s", strerror(errno), path);
+        return 0;
+    }
+
+    fanwatch_key(key, &fsid, &h.fh);
+
+    // a second path to the same directory, e.g. a bind mount
+    if(hashtable_get(fw->handles, key) != NULL)
+    {
+        warnfn("Ignored, already watched %s", path);
+        return -1;
+    }
+
+    hashtable_set(fw->handles, hashtable_data_init_alloc(key, folder, NULL));
+    folder->handle = strdup(key);
+
+    return --fw->ta->pseudo_wd;
+}
+
+void fanwatch_del(fanwatch_t *fw, folder_t *folder)
+{
+    assert(fw != NULL);
+    assert(folder != NULL);
+
+    if(folder->handle == NULL)
+        return;
+
+    hashtable_del(fw->handles, folder->handle);
+    free(folder->handle);
+    folder->handle = NULL;
+}
+
+static void fanwatch_event(fanwatch_t *fw, folder_t *folder, uint32_t mask, uint32_t cookie, const char *name)
+{
+    struct inotify_event *event = &fw->ev.event;
+    size_t len = strlen(name);
+
+    if(len > NAME_MAX)
+        return;
+
+    event->wd = folder->wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = len + 1;
+    memcpy(event->name, name, len + 1);
+
+    if(fw->ta->trace != NULL)
+        trace_event(fw->ta->trace, event);
+
+    watching_event(fw->ta, event);
+}
+
+// return
+//   folder of the directory the event names, NULL if not ours
+static folder_t* fanwatch_folder(fanwatch_t *fw, struct fanotify_event_metadata *meta, const char **name)
+{
+    struct fanotify_event_info_fid *info = (struct fanotify_event_info_fid *)(meta + 1);
+    struct file_handle *fh;
+    hashtable_data_t *hdata;
+    char key[FANWATCH_KEY_SIZE];
+
+    if(meta->event_len < sizeof(*meta) + sizeof(*info) || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+        return NULL;
+
+    fh = (struct file_handle *)info->handle;
+    *name = (const char *)fh->f_handle + fh->handle_bytes;
+
+    // the mark covers the whole filesystem, most is not ours
+    fanwatch_key(key, (const fsid_t *)&info->fsid, fh);
+    hdata = hashtable_get(fw->handles, key);
+
+    return hdata != NULL ? hdata->data : NULL;
+}
+
+// The other half of a rename, the first unused one in the buffer. Both are
+// queued back to back but either may have been merged into an older event.
+static void fanwatch_move(fanwatch_t *fw, struct fanotify_event_metadata *meta, uint64_t want)
+{
+    struct fanotify_event_metadata *other;
+    ssize_t length = fw->length;
+    folder_t *folder;
+    const char *name;
+
+    for(other = (struct fanotify_event_metadata *)fw->buf; FAN_EVENT_OK(other, length); other = FAN_EVENT_NEXT(other, length))
+    {
+        if(other == meta || !(other->mask & want))
+            continue;
+
+        other->mask &= ~want;
+
+        if((folder = fanwatch_folder(fw, other, &name)) != NULL)
+            fanwatch_event(fw, folder, (want == FAN_MOVED_TO ? IN_MOVED_TO : IN_MOVED_FROM) |
+                            (other->mask & FAN_ONDIR ? IN_ISDIR : 0), fw->cookie, name);
+        return;
+    }
+}
+
+static void fanwatch_leave(fanwatch_t *fw, struct fanotify_event_metadata *meta, folder_t *folder,
+                            const char *name, uint32_t isdir)
+{
+    if(meta->mask & FAN_MOVED_FROM)
+    {
+        meta->mask &= ~FAN_MOVED_FROM;
+        fanwatch_event(fw, folder, IN_MOVED_FROM | isdir, ++fw->cookie, name);
+        fanwatch_move(fw, meta, FAN_MOVED_TO);
+    }
+
+    if(meta->mask & FAN_DELETE)
+        fanwatch_event(fw, folder, IN_DELETE | isdir, 0, name);
+}
+
+static void fanwatch_arrive(fanwatch_t *fw, struct fanotify_event_metadata *meta, folder_t *folder,
+                            const char *name, uint32_t isdir)
+{
+    if(meta->mask & FAN_MOVED_TO)
+    {
+        meta->mask &= ~FAN_MOVED_TO;
+        fw->cookie++;
+        fanwatch_move(fw, meta, FAN_MOVED_FROM);
+        fanwatch_event(fw, folder, IN_MOVED_TO | isdir, fw->cookie, name);
+    }
+
+    if(meta->mask & FAN_CREATE)
+        fanwatch_event(fw, folder, IN_CREATE | isdir, 0, name);
+}
+
+void fanwatch_read(fanwatch_t *fw)
+{
+    tailall_t *ta = fw->ta;
+    struct fanotify_event_metadata *meta;
+    char path[MAX_DIR_NAME_LENGTH];
+    const char *name;
+    folder_t *folder;
+    struct stat st;
+    uint32_t isdir, dirent;
+    uint64_t count = 0;
+    ssize_t length;
+    int exists, overflow = 0;
+
+    length = fw->length = read(fw->fd, fw->buf, sizeof(fw->buf));
+
+    metric_inc(M_SYS_FANOTIFY_READ);
+    ta->event_us = metrics_now_us();
+
+    for(meta = (struct fanotify_event_metadata *)fw->buf; FAN_EVENT_OK(meta, length); meta = FAN_EVENT_NEXT(meta, length))
+    {
+        count++;
+
+        if(meta->mask & FAN_Q_OVERFLOW)
+        {
+            metric_inc(M_EV_OVERFLOW);
+            overflow = 1;
+            continue;
+        }
+
+        folder = fanwatch_folder(fw, meta, &name);
+        if(folder == NULL)
+            continue;
+
+        isdir = meta->mask & FAN_ONDIR ? IN_ISDIR : 0;
+        dirent = meta->mask & (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO);
+
+        // Events of one name are merged and the order of their bits is
+        // lost. A name still there was left by the old entry before the new
+        // one arrived, a name gone arrived first and left again.
+        if(dirent & (dirent - 1))
+        {
+            snprintf(path, sizeof(path), "%s%s", folder_path(folder), name);
+            exists = lstat(path, &st) == 0;
+        }else
+        {
+            exists = !(dirent & (FAN_DELETE | FAN_MOVED_FROM));
+        }
+
+        // the old entry may have been written to before it left
+        if(exists && dirent && (meta->mask & FAN_MODIFY))
+            fanwatch_event(fw, folder, IN_MODIFY | isdir, 0, name);
+
+        if(exists)
+            fanwatch_leave(fw, meta, folder, name, isdir);
+
+        fanwatch_arrive(fw, meta, folder, name, isdir);
+
+        if(meta->mask & FAN_MODIFY)
+            fanwatch_event(fw, folder, IN_MODIFY | isdir, 0, name);
+        if(meta->mask & FAN_CLOSE_WRITE)
+            fanwatch_event(fw, folder, IN_CLOSE_WRITE | isdir, 0, name);
+
+        if(!exists)
+            fanwatch_leave(fw, meta, folder, name, isdir);
+    }
+
+    if(ta->move_folder != NULL || ta->move_file != NULL || ta->move_lazy != NULL)
+        move_flush(ta);
+
+    if(ta->dirty_first != NULL)
+        lazy_flush(ta);
+
+    if(overflow)
+        rescan_roots(ta);
+
+    metric_batch(count);
+    ta->event_us = 0;
+}
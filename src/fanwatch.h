@@ -0,0 +1,66 @@
+#ifndef _FANWATCH_H_
+#define _FANWATCH_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/vfs.h>
+#include <sys/fanotify.h>
+
+#include "tailall.h"
+
+#define FANWATCH_BUF_SIZE       (1024*64)
+#define FANWATCH_MAX_FS         64
+#define FANWATCH_TABLE_POWER    14
+#define FANWATCH_KEY_SIZE       320     // hex of fsid, type and a MAX_HANDLE_SZ handle
+
+#define FANWATCH_MASK           (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | \
+                                 FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR)
+
+typedef struct _fanwatch_fs fanwatch_fs_t;
+typedef struct _fanwatch fanwatch_t;
+
+struct _fanwatch_fs
+{
+    fsid_t              fsid;
+    int                 marked;     // 0, the mark was refused, inotify there
+};
+
+struct _fanwatch
+{
+    tailall_t           *ta;
+    int                 fd;
+    hashtable_t         *handles;   // directory handle key to folder_t
+    fanwatch_fs_t       fs[FANWATCH_MAX_FS];
+    int                 nfs;
+    uint32_t            cookie;     // pairs FAN_MOVED_FROM with FAN_MOVED_TO
+    union
+    {
+        struct inotify_event event;
+        char            buf[EVENT_SIZE + NAME_MAX + 1];
+    } ev;
+    ssize_t             length;     // of buf, FAN_EVENT_NEXT() eats its copy
+    char                buf[FANWATCH_BUF_SIZE];
+};
+
+// One fanotify mark per filesystem (FAN_MARK_FILESYSTEM) replaces the
+// inotify watch of every folder on it. Events carry the handle of the
+// directory and the name (FAN_REPORT_DFID_NAME), the handle is looked up
+// to its folder and the event is fed to watching_event() as the inotify
+// event it stands for. Needs CAP_SYS_ADMIN and Linux 5.9.
+// return
+//   NULL : not possible here, use inotify
+fanwatch_t*     fanwatch_init(tailall_t *ta);
+void            fanwatch_free(fanwatch_t *fw);
+
+// Gives folder a pseudo watch desc, negative, if its filesystem is marked.
+// return
+//   < -1 : pseudo watch desc
+//   -1   : the directory is already watched under another path
+//   0    : not covered, needs an inotify watch
+int             fanwatch_add(fanwatch_t *fw, folder_t *folder, const char *path);
+void            fanwatch_del(fanwatch_t *fw, folder_t *folder);
+
+// Drain one read() worth of fanotify events
+void            fanwatch_read(fanwatch_t *fw);
+
+#endif // _FANWATCH_H_
@@ -0,0 +1,190 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "follow.h"
+#include "metrics.h"
+
+static void inode_key(char *buf, size_t size, dev_t dev, ino_t ino)
+{
+    snprintf(buf, size, "%lx:%lx", (unsigned long)dev, (unsigned long)ino);
+}
+
+static void* inode_get(hashtable_t *index, dev_t dev, ino_t ino)
+{
+    hashtable_data_t *hdata;
+    char key[48];
+
+    inode_key(key, sizeof(key), dev, ino);
+    hdata = hashtable_get(index, key);
+
+    return hdata != NULL ? hdata->data : NULL;
+}
+
+static void inode_set(hashtable_t *index, dev_t dev, ino_t ino, void *data)
+{
+    char key[48];
+
+    inode_key(key, sizeof(key), dev, ino);
+    hashtable_set(index, hashtable_data_init_alloc(key, data, NULL));
+}
+
+static void inode_del(hashtable_t *index, dev_t dev, ino_t ino, void *data)
+{
+    char key[48];
+
+    // only if it still is the one indexed
+    if(inode_get(index, dev, ino) != data)
+        return;
+
+    inode_key(key, sizeof(key), dev, ino);
+    hashtable_del(index, key);
+}
+
+void follow_init(tailall_t *ta)
+{
+    assert(ta != NULL);
+
+    ta->follow = 1;
+    ta->dir_index = hashtable_init(FOLLOW_TABLE_POWER, NULL);
+    ta->file_index = hashtable_init(FOLLOW_TABLE_POWER, NULL);
+    ta->link_table = hashtable_init(FOLLOW_TABLE_POWER, NULL);
+    assert(ta->dir_index != NULL && ta->file_index != NULL && ta->link_table != NULL);
+}
+
+int is_link(const char *path)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    struct stat st;
+    size_t len;
+
+    len = snprintf(buf, sizeof(buf), "%s", path);
+
+    while(len > 1 && buf[len - 1] == '/')
+        buf[--len] = '\0';
+
+    return lstat(buf, &st) == 0 && S_ISLNK(st.st_mode);
+}
+
+int follow_folder_linked(folder_t *folder)
+{
+    for(; folder != NULL; folder = folder->parent)
+    {
+        if(folder->link)
+            return 1;
+    }
+
+    return 0;
+}
+
+folder_t* follow_folder_find(tailall_t *ta, const struct stat *st)
+{
+    return inode_get(ta->dir_index, st->st_dev, st->st_ino);
+}
+
+void follow_folder_add(folder_t *folder, const struct stat *st)
+{
+    folder->dev = st->st_dev;
+    folder->ino = st->st_ino;
+    inode_set(folder->ta->dir_index, folder->dev, folder->ino, folder);
+}
+
+void follow_folder_del(folder_t *folder)
+{
+    if(folder->ino != 0)
+        inode_del(folder->ta->dir_index, folder->dev, folder->ino, folder);
+}
+
+file_t* follow_file_find(tailall_t *ta, const struct stat *st)
+{
+    return inode_get(ta->file_index, st->st_dev, st->st_ino);
+}
+
+int follow_file_linked(file_t *file)
+{
+    return file->link_wd > 0 || follow_folder_linked(file->folder);
+}
+
+void follow_file_add(file_t *file, const struct stat *st, int link)
+{
+    tailall_t *ta = file->folder->ta;
+    char path[MAX_DIR_NAME_LENGTH], *wdstr;
+
+    file->dev = st->st_dev;
+    file->ino = st->st_ino;
+    inode_set(ta->file_index, file->dev, file->ino, file);
+
+    if(!link)
+        return;
+
+    // the target may live in a directory nobody watches
+    snprintf(path, sizeof(path), "%s%s", folder_path(file->folder), file->name);
+
+    metric_inc(M_SYS_INOTIFY_ADD_WATCH);
+    file->link_wd = inotify_add_watch(ta->inotify, path, IN_MODIFY | IN_CLOSE_WRITE);
+
+    if(file->link_wd < 0)
+    {
+        warnfn("%s %s", strerror(errno), path);
+        file->link_wd = 0;
+        return;
+    }
+
+    wdstr = intdup(file->link_wd);
+    hashtable_replace(ta->link_table, hashtable_data_init_alloc(wdstr, file, NULL));
+    free(wdstr);
+}
+
+void follow_file_del(file_t *file)
+{
+    tailall_t *ta = file->folder->ta;
+    char *wdstr;
+
+    if(file->ino != 0)
+        inode_del(ta->file_index, file->dev, file->ino, file);
+
+    if(file->link_wd > 0)
+    {
+        wdstr = intdup(file->link_wd);
+        hashtable_del(ta->link_table, wdstr);
+        free(wdstr);
+
+        inotify_rm_watch(ta->inotify, file->link_wd);
+        file->link_wd = 0;
+    }
+}
+
+int follow_event(tailall_t *ta, struct inotify_event *event)
+{
+    hashtable_data_t *hdata;
+    file_t *file;
+    char *wdstr;
+
+    wdstr = intdup(event->wd);
+    hdata = hashtable_get(ta->link_table, wdstr);
+
+    if(hdata == NULL)
+    {
+        free(wdstr);
+        return 0;
+    }
+
+    file = hdata->data;
+
+    // the target is gone, the link entry is left to its directory events
+    if(event->mask & IN_IGNORED)
+    {
+        hashtable_del(ta->link_table, wdstr);
+        file->link_wd = 0;
+    }else if(event->mask & (IN_MODIFY | IN_CLOSE_WRITE))
+    {
+        tailing(ta, file);
+    }
+
+    free(wdstr);
+
+    return 1;
+}
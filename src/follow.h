@@ -0,0 +1,40 @@
+#ifndef _FOLLOW_H_
+#define _FOLLOW_H_
+
+#include <sys/stat.h>
+
+#include "tailall.h"
+
+#define FOLLOW_TABLE_POWER      14
+
+// -L, symbolic links are followed. Every directory and file is indexed by
+// (dev, inode) so an object reached by several paths, a link cycle or a
+// bind mount, gets one watch and one descriptor. The first path reached
+// is kept, unless it goes through a link and a real path shows up later.
+void            follow_init(tailall_t *ta);
+
+// return
+//   1 : folder or one of its parents is a symbolic link
+int             follow_folder_linked(folder_t *folder);
+folder_t*       follow_folder_find(tailall_t *ta, const struct stat *st);
+void            follow_folder_add(folder_t *folder, const struct stat *st);
+void            follow_folder_del(folder_t *folder);
+
+// A file that is itself a link gets its own watch, its directory may not
+// be watched at all.
+file_t*         follow_file_find(tailall_t *ta, const struct stat *st);
+void            follow_file_add(file_t *file, const struct stat *st, int link);
+void            follow_file_del(file_t *file);
+int             follow_file_linked(file_t *file);
+
+// Events of the per file watches
+// return
+//   1 : handled
+//   0 : not a follow watch
+int             follow_event(tailall_t *ta, struct inotify_event *event);
+
+// return
+//   1 : path is a symbolic link, a trailing '/' is ignored
+int             is_link(const char *path);
+
+#endif // _FOLLOW_H_
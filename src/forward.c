@@ -0,0 +1,331 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "forward.h"
+#include "metrics.h"
+
+static void forward_connect(forward_t *fwd);
+static void forward_send(forward_t *fwd);
+
+static void forward_disconnect(forward_t *fwd)
+{
+    if(fwd->fd >= 0)
+    {
+        loop_del_fd(fwd->ta->loop, fwd->fd);
+        close(fwd->fd);
+    }
+
+    if(fwd->connected)
+        warnfn("forward %s:%s disconnected, %zu bytes pending", fwd->host, fwd->port, fwd->len - fwd->head);
+
+    fwd->fd = -1;
+    fwd->connected = 0;
+
+    // head is a frame boundary, a cut frame goes again from its start
+    fwd->sent = fwd->head;
+
+    fwd->retry_at = loop_now_ms() + fwd->backoff;
+    fwd->backoff *= 2;
+    if(fwd->backoff > FORWARD_BACKOFF_MAX)
+        fwd->backoff = FORWARD_BACKOFF_MAX;
+}
+
+static void forward_fd_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    forward_t *fwd = arg;
+    char buf[512];
+    socklen_t slen;
+    int err = 0;
+
+    if(!fwd->connected)
+    {
+        slen = sizeof(err);
+        if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &slen) < 0 || err != 0)
+        {
+            debugfn("forward connect %s:%s %s", fwd->host, fwd->port, strerror(err ? err : errno));
+            forward_disconnect(fwd);
+            return;
+        }
+
+        debugfn("forward connected %s:%s", fwd->host, fwd->port);
+        fwd->connected = 1;
+        fwd->backoff = FORWARD_BACKOFF_MIN;
+        loop_mod_fd(loop, fd, POLLIN);
+        forward_send(fwd);
+        return;
+    }
+
+    if(revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        // the collector has nothing to say, anything but data is a close
+        ssize_t ret = read(fd, buf, sizeof(buf));
+
+        if(ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            forward_disconnect(fwd);
+            return;
+        }
+    }
+
+    if(revents & POLLOUT)
+        forward_send(fwd);
+}
+
+static void forward_connect(forward_t *fwd)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    ret = getaddrinfo(fwd->host, fwd->port, &hints, &res);
+    if(ret != 0)
+    {
+        warnfn("forward %s:%s %s", fwd->host, fwd->port, gai_strerror(ret));
+        forward_disconnect(fwd);
+        return;
+    }
+
+    for(ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if(fd < 0)
+            continue;
+
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    if(fd < 0)
+    {
+        debugfn("forward connect %s:%s %s", fwd->host, fwd->port, strerror(errno));
+        forward_disconnect(fwd);
+        return;
+    }
+
+    fwd->fd = fd;
+    loop_add_fd(fwd->ta->loop, fd, POLLOUT, forward_fd_cb, fwd);
+}
+
+// Moves head past the frames completely written, only the new ones are
+// looked at. buf is reused from its start once all of it is written.
+static void forward_advance(forward_t *fwd)
+{
+    size_t flen;
+    uint32_t n;
+
+    while(fwd->head + 4 <= fwd->sent)
+    {
+        memcpy(&n, fwd->buf + fwd->head, 4);
+        flen = 4 + ntohl(n);
+
+        if(fwd->head + flen > fwd->sent)
+            break;
+
+        fwd->head += flen;
+    }
+
+    if(fwd->head == fwd->len)
+        fwd->head = fwd->len = fwd->sent = 0;
+}
+
+// The frames not written yet to the start of buf, only when the next frame
+// does not fit behind them.
+static void forward_compact(forward_t *fwd)
+{
+    if(fwd->head == 0)
+        return;
+
+    memmove(fwd->buf, fwd->buf + fwd->head, fwd->len - fwd->head);
+    fwd->len -= fwd->head;
+    fwd->sent -= fwd->head;
+    fwd->head = 0;
+}
+
+static void forward_send(forward_t *fwd)
+{
+    ssize_t ret;
+
+    if(!fwd->connected)
+        return;
+
+    while(fwd->sent < fwd->len)
+    {
+        ret = send(fwd->fd, fwd->buf + fwd->sent, fwd->len - fwd->sent, MSG_NOSIGNAL);
+        metric_inc(M_SYS_WRITE);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                loop_mod_fd(fwd->ta->loop, fwd->fd, POLLIN | POLLOUT);
+                break;
+            }
+
+            forward_advance(fwd);
+            forward_disconnect(fwd);
+            return;
+        }
+
+        fwd->sent += ret;
+        metric_add(M_BYTES_WRITTEN, ret);
+    }
+
+    forward_advance(fwd);
+
+    if(fwd->sent == fwd->len)
+        loop_mod_fd(fwd->ta->loop, fwd->fd, POLLIN);
+
+    // room again, pick up the files left behind at their offsets
+    if(fwd->ta->stall_first != NULL && fwd->len - fwd->head < fwd->limit / 2 && !fwd->resuming)
+    {
+        fwd->resuming = 1;
+        tailall_resume(fwd->ta);
+        fwd->resuming = 0;
+    }
+}
+
+static void forward_timer_cb(loop_t *loop, void *arg)
+{
+    forward_t *fwd = arg;
+
+    if(fwd->fd < 0)
+    {
+        if(loop_now_ms() >= fwd->retry_at)
+            forward_connect(fwd);
+        return;
+    }
+
+    forward_send(fwd);
+}
+
+forward_t* forward_init(tailall_t *ta, const char *target)
+{
+    assert(ta != NULL);
+    assert(target != NULL);
+
+    forward_t *fwd;
+    char *host, *port;
+
+    host = strdup(target);
+    port = strrchr(host, ':');
+
+    if(port == NULL || port[1] == '\0')
+    {
+        errfn("Forward target must be HOST:PORT, %s", target);
+        free(host);
+        return NULL;
+    }
+
+    *port++ = '\0';
+
+    // [::1]:port
+    if(host[0] == '[' && host[strlen(host) - 1] == ']')
+    {
+        host[strlen(host) - 1] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    fwd = calloc(sizeof(forward_t), 1);
+    assert(fwd != NULL);
+
+    fwd->ta = ta;
+    fwd->host = host;
+    fwd->port = strdup(port);
+    fwd->fd = -1;
+    fwd->limit = FORWARD_BUF_LIMIT;
+    fwd->buf = malloc(fwd->limit);
+    assert(fwd->buf != NULL);
+    fwd->backoff = FORWARD_BACKOFF_MIN;
+    fwd->timer = loop_add_timer(ta->loop, FORWARD_FLUSH_INTERVAL, forward_timer_cb, fwd);
+
+    forward_connect(fwd);
+
+    return fwd;
+}
+
+void forward_free(forward_t *fwd)
+{
+    if(fwd == NULL)
+        return;
+
+    if(fwd->fd >= 0)
+    {
+        loop_del_fd(fwd->ta->loop, fwd->fd);
+        close(fwd->fd);
+    }
+
+    loop_del_timer(fwd->ta->loop, fwd->timer);
+    free(fwd->buf);
+    free(fwd->host);
+    free(fwd->port);
+    free(fwd);
+}
+
+// Frame as much of buf as the retry buffer takes, the rest stays in the
+// file and is read again once the collector catches up.
+int sink_forward(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    forward_t *fwd = ta->sink_data;
+    size_t plen, space, take;
+    uint64_t off;
+    uint32_t n32;
+    uint16_t n16;
+    char *p;
+
+    file_prefix(file);
+    plen = file->prefix_len - 2;
+
+    if(fwd->len + FORWARD_FRAME_HEADER + plen + len > fwd->limit)
+        forward_compact(fwd);
+
+    if(fwd->len + FORWARD_FRAME_HEADER + plen >= fwd->limit)
+        return 0;
+
+    space = fwd->limit - fwd->len - FORWARD_FRAME_HEADER - plen;
+    take = len < space ? len : space;
+
+    p = fwd->buf + fwd->len;
+
+    n32 = htonl(FORWARD_FRAME_HEADER - 4 + plen + take);
+    memcpy(p, &n32, 4);
+    p[4] = FORWARD_FRAME_DATA;
+    p[5] = 0;
+    n16 = htons(plen);
+    memcpy(p + 6, &n16, 2);
+
+    off = (uint64_t)file->offset;
+    n32 = htonl((uint32_t)(off >> 32));
+    memcpy(p + 8, &n32, 4);
+    n32 = htonl((uint32_t)off);
+    memcpy(p + 12, &n32, 4);
+
+    memcpy(p + FORWARD_FRAME_HEADER, file->prefix, plen);
+    memcpy(p + FORWARD_FRAME_HEADER + plen, buf, take);
+
+    fwd->len += FORWARD_FRAME_HEADER + plen + take;
+
+    if(fwd->len - fwd->sent >= FORWARD_BATCH_SIZE)
+        forward_send(fwd);
+
+    return take;
+}
@@ -0,0 +1,57 @@
+#ifndef _FORWARD_H_
+#define _FORWARD_H_
+
+#include <stdint.h>
+
+#include "tailall.h"
+
+#define FORWARD_BUF_LIMIT           (16*1024*1024)  // retry buffer
+#define FORWARD_BATCH_SIZE          (256*1024)      // send early past this
+#define FORWARD_FLUSH_INTERVAL      50              // ms
+#define FORWARD_BACKOFF_MIN         100             // ms
+#define FORWARD_BACKOFF_MAX         30000           // ms
+
+// Frame on the wire, all integers in network byte order
+//
+//   uint32  length of everything after this field
+//   uint8   FORWARD_FRAME_DATA
+//   uint8   reserved, 0
+//   uint16  path length
+//   uint64  offset of the first data byte in the source file
+//   char    path[path length]      source path, no '\0': the root as given
+//                                  on the command line, or LABEL/ in its
+//                                  place when labelled, then the rest
+//   char    data[]                 the rest of the frame
+//
+// A frame cut by a disconnect is sent again from its start on the next
+// connection, so a collector drops incomplete frames and may dedupe on
+// (path, offset).
+#define FORWARD_FRAME_DATA          1
+#define FORWARD_FRAME_HEADER        16
+
+typedef struct _forward forward_t;
+
+struct _forward
+{
+    tailall_t           *ta;
+    char                *host;
+    char                *port;
+    int                 fd;
+    int                 connected;
+    char                *buf;
+    size_t              head;       // first frame of buf not completely written
+    size_t              len;        // bytes framed in buf
+    size_t              sent;       // bytes of buf written on this connection
+    size_t              limit;
+    int                 resuming;
+    int                 backoff;    // ms
+    uint64_t            retry_at;   // loop_now_ms() based
+    loop_timer_t        *timer;
+};
+
+// target is HOST:PORT
+forward_t*      forward_init(tailall_t *ta, const char *target);
+void            forward_free(forward_t *fwd);
+int             sink_forward(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+#endif // _FORWARD_H_
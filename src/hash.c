@@ -2,7 +2,7 @@
 /*
  * Hash table
  *
- * The hash function used here is by Bob Jenkins, 1996:
+ * The default hash function used here is by Bob Jenkins, 1996:
  *    <http://burtleburtle.net/bob/hash/doobs.html>
  *       "By Bob Jenkins, 1996.  bob_jenkins@burtleburtle.net.
  *       You may use this code any way you wish, private, educational,
@@ -12,6 +12,11 @@
 
 #include "hash.h"
 
+/*
+ * -DHASH_WYHASH swaps it for wyhash, a 64bit multiply-mix hash that is
+ * several times faster on the path and URL sized keys tailall uses.
+ */
+
 
 /*
  * Since the hash function does bit manipulation, it needs to know
@@ -123,7 +128,124 @@ and these came close:
   c ^= b; c -= rot(b,24); \
 }
 
-#if HASH_LITTLE_ENDIAN == 1
+#if defined(HASH_WYHASH)
+/*
+-------------------------------------------------------------------------------
+wyhash -- by Wang Yi, released into the public domain (The Unlicense).
+    <https://github.com/wangyi-fudan/wyhash>
+
+Keys up to 16 bytes are read with at most four overlapping loads and no
+loop. Longer keys are consumed 48 bytes at a time in three independent
+64x64->128 multiply lanes, which keeps the multipliers busy in parallel,
+and are folded together at the end.
+-------------------------------------------------------------------------------
+*/
+#include <string.h>
+
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+static inline void wymum(uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = *a;
+
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+#if HASH_BIG_ENDIAN == 1
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+#if HASH_BIG_ENDIAN == 1
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+HASH_VAL hash(const void *key, size_t length, const uint32_t initval)
+{
+    const uint8_t *p = key;
+    uint64_t seed = initval, a, b;
+
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+
+    if(__builtin_expect(length <= 16, 1))
+    {
+        if(__builtin_expect(length >= 4, 1))
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((length >> 3) << 2));
+            b = (wyr4(p + length - 4) << 32) | wyr4(p + length - 4 - ((length >> 3) << 2));
+        }else if(length > 0)
+        {
+            a = wyr3(p, length);
+            b = 0;
+        }else
+        {
+            a = b = 0;
+        }
+    }else
+    {
+        size_t i = length;
+
+        if(i >= 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+
+            do
+            {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i >= 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while(i > 16)
+        {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a, &b);
+
+    return wymix(a ^ wyp[0] ^ length, b ^ wyp[1]);
+}
+
+#elif HASH_LITTLE_ENDIAN == 1
 uint32_t hash(
   const void *key,       /* the key to hash */
   size_t      length,    /* length of the key */
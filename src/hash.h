@@ -8,14 +8,20 @@
 extern "C" {
 #endif
 
+// Build with -DHASH_WYHASH (make HASH=wyhash) for the 64bit wyhash,
+// otherwise Bob Jenkins' lookup3 is used.
+#ifdef HASH_WYHASH
+typedef uint64_t    HASH_VAL;
+#else
 typedef uint32_t    HASH_VAL;
+#endif
 typedef uint16_t    HASH_KEY_LEN;
 #define HASH_KEY_MAX_LEN    UINT16_MAX
 
 #define hashsize(n) ((unsigned long int)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
-uint32_t hash(const void *key, size_t length, const uint32_t initval);
+HASH_VAL hash(const void *key, size_t length, const uint32_t initval);
 
 #ifdef    __cplusplus
 }
@@ -4,6 +4,11 @@
 
 #include "hashtable.h"
 
+// chains keep the full hash, so nearly every mismatch is rejected
+// without reading the key
+#define hashtable_match(d, h, k, l) \
+    ((d)->hval == (h) && (d)->len == (l) && memcmp((d)->key, (k), (l)) == 0)
+
 hashtable_t* hashtable_init(int hash_power_size, pthread_mutex_t *lock)
 {
     hashtable_t *table = calloc(sizeof(hashtable_t), 1);
@@ -23,6 +28,27 @@ hashtable_t* hashtable_init(int hash_power_size, pthread_mutex_t *lock)
     return table;
 }
 
+void hashtable_free(hashtable_t *table)
+{
+    if(table == NULL)
+        return;
+
+    unsigned long int i;
+    hashtable_data_t *data, *next;
+
+    for(i = 0; i < hashsize(table->power); i++)
+    {
+        for(data = table->idx[i]; data != NULL; data = next)
+        {
+            next = data->next;
+            hashtable_data_free(data);
+        }
+    }
+
+    free(table->idx);
+    free(table);
+}
+
 hashtable_data_t* _hashtable_data_init(HASHTABLE_DATA_KEY key_type, char *key, void *data, void (*cb_data_free)(void *))
 {
     if(key == NULL || data == NULL)
@@ -39,6 +65,7 @@ hashtable_data_t* _hashtable_data_init(HASHTABLE_DATA_KEY key_type, char *key, v
         return NULL;
 
     hdata->len = len;
+    hdata->hval = hash(key, len, 0);
     hdata->data = data;
     hdata->key_type = key_type;
     hdata->cb_free = cb_data_free;
@@ -110,7 +137,7 @@ hashtable_data_t* hashtable_get2(hashtable_t *table, const char *key, const HASH
 
     while(data != NULL)
     {
-        if(strncmp(data->key, key, (size_t)len) == 0)
+        if(hashtable_match(data, hval, key, len))
         {
             break;
         }
@@ -135,13 +162,13 @@ hashtable_data_t* hashtable_set(hashtable_t *table, hashtable_data_t *data)
         pthread_mutex_lock(table->lock);
     }
 
-    HASH_VAL hval = hash(data->key, data->len, 0);
+    HASH_VAL hval = data->hval;
     hashtable_data_t *idx = table->idx[hval & hashmask(table->power)];
     hashtable_data_t *prev = NULL;
 
     while(idx != NULL)
     {
-        if(strncmp(idx->key, data->key, data->len) == 0)
+        if(hashtable_match(idx, hval, data->key, data->len))
         {
             if(table->lock != NULL)
             {
@@ -183,13 +210,13 @@ hashtable_data_t* hashtable_replace(hashtable_t *table, hashtable_data_t *new_da
         pthread_mutex_lock(table->lock);
     }
 
-    HASH_VAL hval = hash(new_data->key, new_data->len, 0);
+    HASH_VAL hval = new_data->hval;
     hashtable_data_t *idx = table->idx[hval & hashmask(table->power)];
     hashtable_data_t *prev = NULL;
 
     while(idx != NULL)
     {
-        if(strncmp(idx->key, new_data->key, new_data->len) == 0)
+        if(hashtable_match(idx, hval, new_data->key, new_data->len))
         {
             new_data->next = idx->next;
 
@@ -256,7 +283,7 @@ void hashtable_del2(hashtable_t *table, const char *key, const HASH_KEY_LEN len)
 
     while(idx != NULL)
     {
-        if(strncmp(idx->key, key, (size_t)len) == 0)
+        if(hashtable_match(idx, hval, key, len))
         {
             // first item.
             if(prev == NULL)
@@ -291,3 +318,30 @@ void hashtable_del2(hashtable_t *table, const char *key, const HASH_KEY_LEN len)
     return;
 }
 
+
+void hashtable_foreach(hashtable_t *table, void (*cb)(hashtable_data_t *, void *), void *arg)
+{
+    if(table == NULL || cb == NULL)
+        return;
+
+    if(table->lock != NULL)
+    {
+        pthread_mutex_lock(table->lock);
+    }
+
+    unsigned long int i;
+    hashtable_data_t *data;
+
+    for(i = 0; i < hashsize(table->power); i++)
+    {
+        for(data = table->idx[i]; data != NULL; data = data->next)
+        {
+            cb(data, arg);
+        }
+    }
+
+    if(table->lock != NULL)
+    {
+        pthread_mutex_unlock(table->lock);
+    }
+}
@@ -18,6 +18,7 @@ struct _hashtable_data
     char                *key;
     HASHTABLE_DATA_KEY  key_type;    // if 1, need to free during clean up
     HASH_KEY_LEN        len;
+    HASH_VAL            hval;        // full hash of key, checked before the key bytes
     void                *data;
     hashtable_data_t    *next;
     void                (*cb_free)(void *);
@@ -35,7 +36,12 @@ hashtable_data_t*   hashtable_data_init(char *key, void *data, void (*cb_data_fr
 hashtable_data_t*   hashtable_data_init_alloc(char *key, void *data, void (*cb_data_free)(void *));
 void                hashtable_data_free(hashtable_data_t *hdata);
 
+// lock, if any, is held for each call only: data got may be freed by a del
+// or replace on another thread right after. Tables read from several
+// threads are chashtable_t.
 hashtable_t*        hashtable_init(int hash_power_size, pthread_mutex_t *lock);
+// Frees every data left with hashtable_data_free(), then the table.
+void                hashtable_free(hashtable_t *table);
 hashtable_data_t*   hashtable_get(hashtable_t *table, const char *key);
 hashtable_data_t*   hashtable_get2(hashtable_t *table, const char *key, const HASH_KEY_LEN len);
 hashtable_data_t*   hashtable_set(hashtable_t *table, hashtable_data_t *data);
@@ -46,6 +52,9 @@ hashtable_data_t*   hashtable_replace(hashtable_t *table, hashtable_data_t *data
 void                hashtable_del(hashtable_t *table, const char *key);
 void                hashtable_del2(hashtable_t *table, const char *key, const HASH_KEY_LEN len);
 
+// Calls cb for every data, cb must not change the table.
+void                hashtable_foreach(hashtable_t *table, void (*cb)(hashtable_data_t *, void *), void *arg);
+
 #ifdef    __cplusplus
 }
 #endif
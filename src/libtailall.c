@@ -0,0 +1,236 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "libtailall.h"
+#include "follow.h"
+#include "pollfs.h"
+#include "fanwatch.h"
+#include "budget.h"
+#include "multiline.h"
+#include "dedup.h"
+
+typedef struct _tailall_cb tailall_cb_t;
+
+// ta->sink_data of tailall_open()
+struct _tailall_cb
+{
+    tailall_data_cb     cb;
+    void                *arg;
+    char                path[MAX_DIR_NAME_LENGTH];
+};
+
+static int tailall_cb_sink(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    tailall_cb_t *tcb = ta->sink_data;
+
+    snprintf(tcb->path, sizeof(tcb->path), "%s%s", folder_path(file->folder), file->name);
+
+    return tcb->cb(tcb->arg, file, tcb->path, file->offset, buf, len);
+}
+
+tailall_t* tailall_open(tailall_data_cb cb, void *arg)
+{
+    assert(cb != NULL);
+
+    tailall_t *ta;
+    tailall_cb_t *tcb;
+
+    ta = tailall_init(NULL, tailall_cb_sink);
+    if(ta == NULL)
+        return NULL;
+
+    tcb = calloc(sizeof(tailall_cb_t), 1);
+    assert(tcb != NULL);
+
+    tcb->cb = cb;
+    tcb->arg = arg;
+
+    ta->sink_data = tcb;
+    ta->sink_free = free;
+
+    return ta;
+}
+
+static void tailall_wake_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    uint64_t n;
+
+    while(read(fd, &n, sizeof(n)) == sizeof(n))
+        ;
+}
+
+int tailall_start(tailall_t *ta, const tailall_options_t *opts)
+{
+    assert(ta != NULL);
+    assert(opts != NULL);
+
+    int i;
+
+    if(ta->nroots == 0)
+    {
+        errfn("No directory to watch");
+        return -1;
+    }
+
+    ta->lazy = opts->lazy;
+    ta->skip_binary = !opts->tail_binary;
+
+    if(opts->follow)
+        follow_init(ta);
+
+    ta->pollfs = pollfs_init(ta, !opts->no_poll_detect);
+
+    for(i = 0; i < opts->poll_count; i++)
+    {
+        if(pollfs_force(ta->pollfs, opts->poll_paths[i]) < 0)
+            return -1;
+    }
+
+    if(opts->fanotify)
+        ta->fanwatch = fanwatch_init(ta);
+
+    ta->budget = budget_init(ta, opts->watch_limit);
+
+    for(i = 0; i < opts->priority_count; i++)
+    {
+        if(budget_priority(ta->budget, opts->priority[i]) < 0)
+            return -1;
+    }
+
+    for(i = 0; i < ta->nroots; i++)
+    {
+        if(scan_dir(ta, NULL, ta->roots[i].path) < 0)
+            return -1;
+    }
+
+    watching(ta);
+
+    ta->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(ta->wake < 0)
+    {
+        warnfn("eventfd() %s, tailall_stop() waits for the next event", strerror(errno));
+    }else
+    {
+        loop_add_fd(ta->loop, ta->wake, POLLIN, tailall_wake_cb, ta);
+    }
+
+    return 0;
+}
+
+int tailall_run_once(tailall_t *ta, int timeout)
+{
+    assert(ta != NULL);
+
+    return loop_run_once(ta->loop, timeout);
+}
+
+void tailall_run(tailall_t *ta)
+{
+    assert(ta != NULL);
+
+    loop_run(ta->loop);
+}
+
+static void* tailall_thread(void *arg)
+{
+    tailall_run((tailall_t *)arg);
+
+    return NULL;
+}
+
+int tailall_run_thread(tailall_t *ta)
+{
+    assert(ta != NULL);
+    assert(!ta->threaded);
+
+    sigset_t all, old;
+    int res;
+
+    // the caller's thread keeps the signals, SIGUSR1 and stats_init() too
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    res = pthread_create(&ta->thread, NULL, tailall_thread, ta);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(res != 0)
+    {
+        errfn("pthread_create() %s", strerror(res));
+        return -1;
+    }
+
+    ta->threaded = 1;
+
+    return 0;
+}
+
+void tailall_stop(tailall_t *ta)
+{
+    uint64_t one = 1;
+
+    loop_stop(ta->loop);
+
+    // poll() may sleep until the next timer otherwise, a full counter has
+    // a wake up pending anyway
+    if(ta->wake >= 0 && write(ta->wake, &one, sizeof(one)) < 0)
+        return;
+}
+
+void tailall_close(tailall_t *ta)
+{
+    int i;
+
+    if(ta == NULL)
+        return;
+
+    if(ta->threaded)
+    {
+        tailall_stop(ta);
+        pthread_join(ta->thread, NULL);
+        ta->threaded = 0;
+    }
+
+    multiline_free(ta->multiline);
+    dedup_free(ta->dedup);
+
+    // every watch goes with the instance, none is removed one by one
+    close(ta->inotify);
+    ta->inotify = -1;
+
+    for(i = 0; i < ta->nroots; i++)
+    {
+        if(ta->roots[i].folder != NULL)
+            folder_free(ta->roots[i].folder);
+
+        free(ta->roots[i].path);
+        free(ta->roots[i].label);
+        free(ta->roots[i].filter);
+    }
+
+    fanwatch_free(ta->fanwatch);
+    budget_free(ta->budget);
+    pollfs_free(ta->pollfs);
+
+    if(ta->sink_free != NULL)
+        ta->sink_free(ta->sink_data);
+
+    if(ta->wake >= 0)
+        close(ta->wake);
+
+    hashtable_free(ta->dir_index);
+    hashtable_free(ta->file_index);
+    hashtable_free(ta->link_table);
+    hashtable_free(ta->lazy_table);
+    hashtable_free(ta->folder_table);
+
+    output_flush(ta->out);
+    output_free(ta->out);
+    loop_free(ta->loop);
+    free(ta);
+}
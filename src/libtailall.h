@@ -0,0 +1,76 @@
+#ifndef _LIBTAILALL_H_
+#define _LIBTAILALL_H_
+
+#include "tailall.h"
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct _tailall_options tailall_options_t;
+
+// All zero is what the command line does without options.
+struct _tailall_options
+{
+    int             lazy;           // -l
+    int             follow;         // -L
+    int             fanotify;       // -f
+    int             tail_binary;    // -b
+    int             no_poll_detect; // -Q off
+    char            **poll_paths;   // -Q PATH
+    int             poll_count;
+    int             watch_limit;    // -w, 0 for max_user_watches less headroom
+    char            **priority;     // -W
+    int             priority_count;
+};
+
+// The bytes appended to file at offset. buf is borrowed from the read
+// buffer and path is valid for the call only, nothing is copied. file is
+// the same handle for as long as the file is tailed, renames included.
+// return, as tailall_sink_t
+//   len      : consumed
+//   0 .. len : called again with the rest after tailall_resume()
+//  -1        : Error, the bytes are lost
+typedef int (*tailall_data_cb)(void *arg, file_t *file, const char *path, off_t offset,
+                                const char *buf, size_t len);
+
+// A tailall with no output of its own, every byte goes to cb. Roots are
+// added with tailall_add_root() before tailall_start().
+tailall_t*      tailall_open(tailall_data_cb cb, void *arg);
+
+// Sets the options, starts the pollers and the watch budget, scans every
+// root and registers the watches with the loop. Files found are tailed
+// from their end.
+// return
+//   0  : Success
+//  -1  : Error
+int             tailall_start(tailall_t *ta, const tailall_options_t *opts);
+
+// The loop driven by the caller, waits at most timeout ms, -1 until the
+// next timer or event.
+// return
+//   number of fds dispatched, -1 on error
+int             tailall_run_once(tailall_t *ta, int timeout);
+
+// The loop until tailall_stop()
+void            tailall_run(tailall_t *ta);
+
+// The loop on a thread of its own, the callbacks are called there.
+// return
+//   0  : Success
+//  -1  : Error
+int             tailall_run_thread(tailall_t *ta);
+
+// Makes tailall_run() and the thread return, safe from a signal handler
+// and from another thread.
+void            tailall_stop(tailall_t *ta);
+
+// Joins the thread if any and frees everything, the sink included.
+void            tailall_close(tailall_t *ta);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _LIBTAILALL_H_
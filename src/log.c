@@ -0,0 +1,387 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "log.h"
+
+#define LOG_OUT_SIZE    (64 * 1024)
+
+typedef struct _log_record log_record_t;
+typedef struct _log_ring log_ring_t;
+
+struct _log_record
+{
+    uint8_t             level;
+    uint8_t             newline;
+    uint16_t            len;
+    uint32_t            suppressed;
+    char                msg[LOG_MSG_MAX];
+};
+
+// one producer, its thread, and one consumer, the writer thread
+struct _log_ring
+{
+    uint64_t            head;       // written by the producer
+    uint64_t            tail __attribute__((aligned(64)));  // by the writer
+    uint32_t            dropped;    // full ring
+    int                 closed;     // the thread is gone, freed once empty
+    log_ring_t          *next;
+    log_record_t        records[LOG_RING_SIZE];
+};
+
+#ifdef DEBUG
+int log_level = LOG_DEBUG;
+#else
+int log_level = LOG_INFO;
+#endif
+
+static const char *log_prefix[] = {"ERR  - ", "WARN - ", "INFO - ", "DBUG - "};
+
+static int log_running;
+static int log_stopping;
+static pthread_t log_thread;
+static pthread_key_t log_key;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;   // rings and cond
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static log_ring_t *log_rings;
+static log_site_t *log_sites;       // suppressed once, pushed without lock
+static __thread log_ring_t *log_ring;
+static char log_out[LOG_OUT_SIZE];
+static size_t log_out_len;
+
+static uint64_t log_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void log_flush()
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while(off < log_out_len)
+    {
+        n = write(STDERR_FILENO, log_out + off, log_out_len - off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        off += n;
+    }
+
+    log_out_len = 0;
+}
+
+static void log_append(const char *buf, size_t len)
+{
+    if(log_out_len + len > LOG_OUT_SIZE)
+        log_flush();
+
+    memcpy(log_out + log_out_len, buf, len);
+    log_out_len += len;
+}
+
+// the writer thread, or the caller before log_init()
+static size_t log_format(char *line, size_t size, const log_record_t *rec)
+{
+    int len = rec->len, cut = rec->len == LOG_MSG_MAX - 1, newline = rec->newline || cut;
+    char more[48] = "";
+
+    // the '\n' of an errf() goes after the suppressed count
+    if(!rec->newline && len > 0 && rec->msg[len - 1] == '\n')
+    {
+        len--;
+        newline = 1;
+    }
+
+    if(rec->suppressed > 0)
+        snprintf(more, sizeof(more), " [%u more suppressed]", rec->suppressed);
+
+    return snprintf(line, size, "%s%.*s%s%s%s", log_prefix[rec->level], len, rec->msg,
+                    cut ? "..." : "", more, newline ? "\n" : "");
+}
+
+// under log_lock
+static void log_drain(log_ring_t *ring)
+{
+    char line[LOG_MSG_MAX + 64];
+    uint64_t tail = ring->tail, head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t dropped;
+
+    for(; tail != head; tail++)
+        log_append(line, log_format(line, sizeof(line), &ring->records[tail & (LOG_RING_SIZE - 1)]));
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if(dropped > 0)
+    {
+        log_append(line, snprintf(line, sizeof(line), "%s%u log records dropped, ring full\n",
+                                  log_prefix[LOG_WARN], dropped));
+    }
+}
+
+// under log_lock, the counts of the sites quiet since their last second
+static void log_drain_sites(int all)
+{
+    char line[LOG_MSG_MAX + 64];
+    uint64_t now = log_now_ms();
+    log_site_t *site;
+    uint32_t suppressed;
+
+    for(site = __atomic_load_n(&log_sites, __ATOMIC_ACQUIRE); site != NULL; site = site->next)
+    {
+        if(!all && now - __atomic_load_n(&site->start, __ATOMIC_RELAXED) < LOG_RATE_MS)
+            continue;
+
+        suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        if(suppressed > 0)
+        {
+            log_append(line, snprintf(line, sizeof(line), "%s%u more suppressed, \"%.*s\"\n",
+                                      log_prefix[site->level], suppressed,
+                                      (int)strcspn(site->fmt, "\n"), site->fmt));
+        }
+    }
+}
+
+// under log_lock, frees the rings of the threads gone
+static void log_drain_all(int all)
+{
+    log_ring_t **link = &log_rings, *ring;
+
+    while((ring = *link) != NULL)
+    {
+        log_drain(ring);
+
+        if(__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)
+            && ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+
+        link = &ring->next;
+    }
+
+    log_drain_sites(all);
+    log_flush();
+}
+
+static void* log_writer(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&log_lock);
+
+    while(!log_stopping)
+    {
+        log_drain_all(0);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&log_cond, &log_lock, &ts);
+    }
+
+    log_drain_all(1);
+    pthread_mutex_unlock(&log_lock);
+
+    return NULL;
+}
+
+// pthread key destructor, the thread exits
+static void log_ring_close(void *arg)
+{
+    log_ring_t *ring = arg;
+
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static log_ring_t* log_ring_get()
+{
+    log_ring_t *ring = log_ring;
+
+    if(ring != NULL)
+        return ring;
+
+    ring = calloc(1, sizeof(log_ring_t));
+    if(ring == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&log_lock);
+    ring->next = log_rings;
+    log_rings = ring;
+    pthread_mutex_unlock(&log_lock);
+
+    pthread_setspecific(log_key, ring);
+
+    return log_ring = ring;
+}
+
+int log_init()
+{
+    sigset_t all, old;
+    int ret;
+
+    if(__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+        return 0;
+
+    if(pthread_key_create(&log_key, log_ring_close) != 0)
+        return -1;
+
+    log_stopping = 0;
+
+    // signals are for the threads of the caller, the writer takes none
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    ret = pthread_create(&log_thread, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(ret != 0)
+    {
+        pthread_key_delete(log_key);
+        return -1;
+    }
+
+    __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+    atexit(log_free);
+
+    return 0;
+}
+
+void log_free()
+{
+    if(!__atomic_exchange_n(&log_running, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    pthread_mutex_lock(&log_lock);
+    log_stopping = 1;
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+
+    pthread_join(log_thread, NULL);
+
+    // rings of threads still running are kept, they write at once from now
+}
+
+int log_parse_level(const char *name)
+{
+    static const char *names[] = {"err", "warn", "info", "debug"};
+    int i;
+
+    for(i = 0; i <= LOG_DEBUG; i++)
+    {
+        if(strcmp(name, names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// 1 if the site may write now, *suppressed set to what it did not write
+static int log_rate(log_site_t *site, int level, const char *fmt, uint32_t *suppressed)
+{
+    uint64_t now = log_now_ms(), start = __atomic_load_n(&site->start, __ATOMIC_RELAXED);
+
+    *suppressed = 0;
+
+    if(now - start >= LOG_RATE_MS
+        && __atomic_compare_exchange_n(&site->start, &start, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&site->count, 1, __ATOMIC_RELAXED);
+        *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    if(__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) < LOG_RATE_BURST)
+        return 1;
+
+    __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+
+    if(!__atomic_exchange_n(&site->listed, 1, __ATOMIC_RELAXED))
+    {
+        site->level = level;
+        site->fmt = fmt;
+        site->next = __atomic_load_n(&log_sites, __ATOMIC_RELAXED);
+
+        while(!__atomic_compare_exchange_n(&log_sites, &site->next, site, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    return 0;
+}
+
+void log_write(log_site_t *site, int level, int newline, const char *fmt, ...)
+{
+    log_record_t *rec, one;
+    log_ring_t *ring = NULL;
+    uint32_t suppressed = 0;
+    uint64_t head;
+    va_list ap;
+    int len;
+
+    if(level > log_level)
+        return;
+
+    if(site != NULL && !log_rate(site, level, fmt, &suppressed))
+        return;
+
+    if(__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+        ring = log_ring_get();
+
+    rec = &one;
+
+    if(ring != NULL)
+    {
+        head = ring->head;
+
+        if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&ring->dropped, 1 + suppressed, __ATOMIC_RELAXED);
+            return;
+        }
+
+        rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+    }
+
+    va_start(ap, fmt);
+    len = vsnprintf(rec->msg, LOG_MSG_MAX, fmt, ap);
+    va_end(ap);
+
+    rec->level = level;
+    rec->newline = newline;
+    rec->len = len < 0 ? 0 : len >= LOG_MSG_MAX ? LOG_MSG_MAX - 1 : len;
+    rec->suppressed = suppressed;
+
+    if(ring != NULL)
+    {
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+        // an error may come right before exit() or abort()
+        if(level == LOG_ERR)
+            pthread_cond_signal(&log_cond);
+
+        return;
+    }
+
+    char line[LOG_MSG_MAX + 64];
+
+    fwrite(line, 1, log_format(line, sizeof(line), rec), stderr);
+    fflush(stderr);
+}
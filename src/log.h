@@ -0,0 +1,82 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+#define LOG_RING_SIZE   256     // records per thread, a power of 2
+#define LOG_MSG_MAX     480     // bytes of a message, longer ones are cut
+#define LOG_FLUSH_MS    20      // the writer thread wakes up at least this often
+#define LOG_RATE_BURST  20      // warnings and errors a call site writes a second,
+#define LOG_RATE_MS     1000    // the others are counted
+
+typedef enum {LOG_ERR, LOG_WARN, LOG_INFO, LOG_DEBUG} LOG_LEVEL;
+
+typedef struct _log_site log_site_t;
+
+// state of one errf/warnf call site
+struct _log_site
+{
+    uint64_t            start;      // ms the current second started
+    uint32_t            count;      // written in it
+    uint32_t            suppressed; // not written since the last one that was
+    int                 level;
+    int                 listed;     // on the writer's list, suppressed once
+    const char          *fmt;       // the summary shows it
+    log_site_t          *next;
+};
+
+// records above it are dropped before formatting, may be set at any time
+extern int log_level;
+
+// Starts the writer thread, every thread gets a ring of its own on its first
+// record. Until then and after log_free() records are written to stderr at
+// once, libtailall does not start it.
+// return
+//   0  : Success
+//  -1  : Error, records are still written at once
+int             log_init();
+
+// Stops the writer thread once every ring is written out, atexit() too.
+void            log_free();
+
+// LOG_LEVEL of "err", "warn", "info" or "debug", -1 if none
+int             log_parse_level(const char *name);
+
+// The message is formatted into the ring of the calling thread, prefixed and
+// written to stderr by the writer thread. A full ring drops the record and
+// the count is written later. site, if any, limits the rate, the records
+// suppressed are counted on the next one written or, once the second is
+// over, by the writer thread with the format of the call.
+void            log_write(log_site_t *site, int level, int newline, const char *fmt, ...)
+                    __attribute__((format(printf, 4, 5)));
+
+#define log_site_write(level, newline, ...) \
+    { static log_site_t log_site_; log_write(&log_site_, level, newline, __VA_ARGS__); }
+
+#ifdef DEBUG
+#define debugf(...) { if(LOG_DEBUG <= log_level) log_write(NULL, LOG_DEBUG, 0, __VA_ARGS__); }
+#define debugfn(...) { if(LOG_DEBUG <= log_level) log_write(NULL, LOG_DEBUG, 1, __VA_ARGS__); }
+#else
+#define debugf(...)
+#define debugfn(...)
+#endif
+
+#define errf(...) log_site_write(LOG_ERR, 0, __VA_ARGS__)
+#define errfn(...) log_site_write(LOG_ERR, 1, __VA_ARGS__)
+
+#define warnf(...) log_site_write(LOG_WARN, 0, __VA_ARGS__)
+#define warnfn(...) log_site_write(LOG_WARN, 1, __VA_ARGS__)
+
+#define infof(...) { if(LOG_INFO <= log_level) log_write(NULL, LOG_INFO, 0, __VA_ARGS__); }
+#define infofn(...) { if(LOG_INFO <= log_level) log_write(NULL, LOG_INFO, 1, __VA_ARGS__); }
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _LOG_H_
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+
+#include "loop.h"
+
+#define LOOP_DEFAULT_SIZE   16
+
+uint64_t loop_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+loop_t* loop_init()
+{
+    loop_t *loop = calloc(sizeof(loop_t), 1);
+
+    if(loop == NULL)
+        return NULL;
+
+    loop->size = LOOP_DEFAULT_SIZE;
+    loop->pfds = calloc(loop->size, sizeof(struct pollfd));
+    loop->fds = calloc(loop->size, sizeof(loop_fd_t));
+
+    if(loop->pfds == NULL || loop->fds == NULL)
+    {
+        free(loop->pfds);
+        free(loop->fds);
+        free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+void loop_free(loop_t *loop)
+{
+    loop_timer_t *timer, *next;
+
+    if(loop == NULL)
+        return;
+
+    for(timer = loop->timers; timer != NULL; timer = next)
+    {
+        next = timer->next;
+        free(timer);
+    }
+
+    free(loop->pfds);
+    free(loop->fds);
+    free(loop);
+}
+
+int loop_add_fd(loop_t *loop, int fd, short events, loop_fd_cb cb, void *arg)
+{
+    assert(loop != NULL);
+    assert(cb != NULL);
+
+    if(loop->count == loop->size)
+    {
+        int size = loop->size * 2;
+        struct pollfd *pfds = realloc(loop->pfds, size * sizeof(struct pollfd));
+
+        if(pfds == NULL)
+            return -1;
+
+        loop->pfds = pfds;
+
+        loop_fd_t *fds = realloc(loop->fds, size * sizeof(loop_fd_t));
+
+        if(fds == NULL)
+            return -1;
+
+        loop->fds = fds;
+        loop->size = size;
+    }
+
+    loop->pfds[loop->count].fd = fd;
+    loop->pfds[loop->count].events = events;
+    loop->pfds[loop->count].revents = 0;
+    loop->fds[loop->count].fd = fd;
+    loop->fds[loop->count].cb = cb;
+    loop->fds[loop->count].arg = arg;
+    loop->count++;
+
+    return 0;
+}
+
+void loop_mod_fd(loop_t *loop, int fd, short events)
+{
+    int i;
+
+    for(i = 0; i < loop->count; i++)
+    {
+        if(loop->fds[i].fd == fd)
+        {
+            loop->pfds[i].events = events;
+            return;
+        }
+    }
+}
+
+void loop_del_fd(loop_t *loop, int fd)
+{
+    int i;
+
+    for(i = 0; i < loop->count; i++)
+    {
+        if(loop->fds[i].fd == fd)
+        {
+            loop->fds[i].fd = -1;
+            loop->pfds[i].fd = -1;
+            loop->dirty = 1;
+            return;
+        }
+    }
+}
+
+loop_timer_t* loop_add_timer(loop_t *loop, int interval, loop_timer_cb cb, void *arg)
+{
+    assert(loop != NULL);
+    assert(cb != NULL);
+
+    loop_timer_t *timer = calloc(sizeof(loop_timer_t), 1);
+
+    if(timer == NULL)
+        return NULL;
+
+    timer->interval = interval;
+    timer->due = loop_now_ms() + interval;
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->next = loop->timers;
+    loop->timers = timer;
+
+    return timer;
+}
+
+void loop_del_timer(loop_t *loop, loop_timer_t *timer)
+{
+    if(timer == NULL)
+        return;
+
+    timer->cb = NULL;
+    loop->dirty = 1;
+}
+
+static void loop_sweep(loop_t *loop)
+{
+    loop_timer_t **tp = &loop->timers, *timer;
+    int i, j;
+
+    while((timer = *tp) != NULL)
+    {
+        if(timer->cb == NULL)
+        {
+            *tp = timer->next;
+            free(timer);
+        }else
+        {
+            tp = &timer->next;
+        }
+    }
+
+    for(i = 0, j = 0; i < loop->count; i++)
+    {
+        if(loop->fds[i].fd < 0)
+            continue;
+
+        if(i != j)
+        {
+            loop->fds[j] = loop->fds[i];
+            loop->pfds[j] = loop->pfds[i];
+        }
+        j++;
+    }
+
+    loop->count = j;
+    loop->dirty = 0;
+}
+
+int loop_run_once(loop_t *loop, int timeout)
+{
+    assert(loop != NULL);
+
+    loop_timer_t *timer;
+    uint64_t now = loop_now_ms();
+    int ret, i, n, dispatched = 0;
+
+    for(timer = loop->timers; timer != NULL; timer = timer->next)
+    {
+        int wait;
+
+        if(timer->cb == NULL)
+            continue;
+
+        wait = timer->due > now ? (int)(timer->due - now) : 0;
+
+        if(timeout < 0 || wait < timeout)
+            timeout = wait;
+    }
+
+    n = loop->count;
+    ret = poll(loop->pfds, n, timeout);
+
+    if(ret < 0 && errno != EINTR)
+        return -1;
+
+    for(i = 0; ret > 0 && i < n; i++)
+    {
+        short revents = loop->pfds[i].revents;
+
+        if(revents == 0 || loop->fds[i].fd < 0)
+            continue;
+
+        loop->pfds[i].revents = 0;
+        loop->fds[i].cb(loop, loop->fds[i].fd, revents, loop->fds[i].arg);
+        dispatched++;
+    }
+
+    now = loop_now_ms();
+
+    for(timer = loop->timers; timer != NULL; timer = timer->next)
+    {
+        if(timer->cb == NULL || timer->due > now)
+            continue;
+
+        timer->due = now + timer->interval;
+        timer->cb(loop, timer->arg);
+    }
+
+    if(loop->dirty)
+        loop_sweep(loop);
+
+    return dispatched;
+}
+
+void loop_run(loop_t *loop)
+{
+    while(!loop->stop)
+    {
+        if(loop_run_once(loop, -1) < 0)
+            break;
+    }
+}
+
+void loop_stop(loop_t *loop)
+{
+    loop->stop = 1;
+}
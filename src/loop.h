@@ -0,0 +1,72 @@
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct _loop loop_t;
+typedef struct _loop_fd loop_fd_t;
+typedef struct _loop_timer loop_timer_t;
+
+typedef void (*loop_fd_cb)(loop_t *loop, int fd, short revents, void *arg);
+typedef void (*loop_timer_cb)(loop_t *loop, void *arg);
+
+struct _loop_fd
+{
+    int                 fd;         // -1 once deleted, compacted after dispatch
+    loop_fd_cb          cb;
+    void                *arg;
+};
+
+struct _loop_timer
+{
+    int                 interval;   // ms
+    uint64_t            due;        // loop_now_ms() based
+    loop_timer_cb       cb;         // NULL once deleted, freed after dispatch
+    void                *arg;
+    loop_timer_t        *next;
+};
+
+struct _loop
+{
+    struct pollfd       *pfds;
+    loop_fd_t           *fds;
+    int                 count;
+    int                 size;
+    loop_timer_t        *timers;
+    int                 dirty;
+    volatile sig_atomic_t stop;
+};
+
+loop_t*         loop_init();
+void            loop_free(loop_t *loop);
+
+int             loop_add_fd(loop_t *loop, int fd, short events, loop_fd_cb cb, void *arg);
+void            loop_mod_fd(loop_t *loop, int fd, short events);
+void            loop_del_fd(loop_t *loop, int fd);
+
+loop_timer_t*   loop_add_timer(loop_t *loop, int interval, loop_timer_cb cb, void *arg);
+void            loop_del_timer(loop_t *loop, loop_timer_t *timer);
+
+// Wait at most timeout ms (-1 : until the next timer or fd event)
+// return
+//   number of fds dispatched, -1 on error
+int             loop_run_once(loop_t *loop, int timeout);
+void            loop_run(loop_t *loop);
+
+// Makes loop_run() return, safe from a signal handler
+void            loop_stop(loop_t *loop);
+
+uint64_t        loop_now_ms();
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _LOOP_H_
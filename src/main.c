@@ -0,0 +1,537 @@
+/*
+ * Author   : Jinoos Lee (jinoos@gmail.com)
+ * Date     : 2013/10/07
+ * Version  : 0.1
+ * URL      : https://github.com/jinoos/tailall
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "libtailall.h"
+#include "server.h"
+#include "demux.h"
+#include "forward.h"
+#include "compress.h"
+#include "stats.h"
+#include "top.h"
+#include "trace.h"
+#include "follow.h"
+#include "pollfs.h"
+#include "budget.h"
+#include "multiline.h"
+#include "dedup.h"
+
+static tailall_t *stop_ta;
+
+static void help();
+
+// [LABEL=]DIRECTORY[:GLOB], an existing directory is taken as it is
+static void root_spec(char *arg, char **path, char **label, char **filter)
+{
+    struct stat st;
+    char *p;
+
+    *path = arg;
+    *label = NULL;
+    *filter = NULL;
+
+    if(stat(arg, &st) == 0)
+        return;
+
+    p = strchr(arg, '=');
+    if(p != NULL && memchr(arg, '/', p - arg) == NULL)
+    {
+        *p = '\0';
+        *label = arg;
+        *path = arg = p + 1;
+    }
+
+    p = strchr(arg, ':');
+    if(p != NULL)
+    {
+        *p = '\0';
+        *filter = p + 1;
+    }
+}
+
+static void stop_handler(int sig)
+{
+    if(stop_ta != NULL)
+        tailall_stop(stop_ta);
+}
+
+int main( int argc, char **argv )
+{
+    char dir[MAX_DIR_NAME_LENGTH]; /* monitoring directory name */
+    int ret;
+    char *path, *label = NULL, *filter = NULL;
+    struct stat stat;
+    tailall_t *ta;
+    tailall_sink_t sink = sink_header;
+    int outputs = 0, prefix = 0;
+    char *server_path = NULL, *demux_dir = NULL, *demux_pattern = NULL;
+    char *forward_target = NULL, *stats_path = NULL;
+    char *record_path = NULL, *replay_path = NULL;
+    int record_bytes = 0, i;
+    char *poll_paths[POLLFS_MAX_MOUNTS];
+    char *priority[BUDGET_MAX_PRIORITY];
+    tailall_options_t opts;
+    char *record_rules[MULTILINE_MAX_RULES];
+    int record_rule_count = 0;
+    multiline_t *multiline = NULL;
+    int dedup_window = 0;
+    dedup_t *dedup = NULL;
+    double replay_speed = 0;
+    stats_t *stats;
+    int opt, zlevel = -1, top_interval = 0, top_k = TOP_DEFAULT_K;
+    compress_t *z = NULL;
+    struct sigaction sa;
+
+    sigset_t usr1;
+
+    // stats_init() reads it from a signalfd, any thread created before
+    // with it unblocked would take the default action and end tailall
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+
+    // diagnostics leave the hot path, stderr only
+    log_init();
+
+    memset(&opts, 0, sizeof(opts));
+    opts.poll_paths = poll_paths;
+    opts.priority = priority;
+
+    while((opt = getopt(argc, argv, "plLQ:fw:W:bM:u:s:c:D:G:F:z:m:t:K:R:BP:S:v:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p':
+                sink = sink_prefix;
+                prefix = 1;
+                break;
+            case 'l':
+                opts.lazy = 1;
+                break;
+            case 'L':
+                opts.follow = 1;
+                break;
+            case 'f':
+                opts.fanotify = 1;
+                break;
+            case 'Q':
+                if(strcmp(optarg, "off") == 0)
+                    opts.no_poll_detect = 1;
+                else if(opts.poll_count < POLLFS_MAX_MOUNTS)
+                    poll_paths[opts.poll_count++] = optarg;
+                break;
+            case 'b':
+                opts.tail_binary = 1;
+                break;
+            case 'M':
+                if(record_rule_count < MULTILINE_MAX_RULES)
+                    record_rules[record_rule_count++] = optarg;
+                break;
+            case 'u':
+                dedup_window = atof(optarg) * 1000;
+                if(dedup_window <= 0)
+                {
+                    errfn("Repeat window must be positive, %s", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'w':
+                opts.watch_limit = atoi(optarg);
+                if(opts.watch_limit <= 0)
+                {
+                    errfn("Watch budget must be positive, %s", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'W':
+                if(opts.priority_count < BUDGET_MAX_PRIORITY)
+                    priority[opts.priority_count++] = optarg;
+                break;
+            case 's':
+                sink = sink_server;
+                outputs++;
+                server_path = optarg;
+                break;
+            case 'D':
+                sink = sink_demux;
+                outputs++;
+                demux_dir = optarg;
+                break;
+            case 'G':
+                demux_pattern = optarg;
+                break;
+            case 'F':
+                sink = sink_forward;
+                outputs++;
+                forward_target = optarg;
+                break;
+            case 't':
+                sink = sink_top;
+                outputs++;
+                top_interval = atof(optarg) * 1000;
+                if(top_interval <= 0)
+                {
+                    errfn("Top interval must be positive, %s", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'K':
+                top_k = atoi(optarg);
+                break;
+            case 'm':
+                stats_path = optarg;
+                break;
+            case 'R':
+                record_path = optarg;
+                break;
+            case 'B':
+                record_bytes = 1;
+                break;
+            case 'P':
+                replay_path = optarg;
+                break;
+            case 'S':
+                replay_speed = atof(optarg);
+                break;
+            case 'z':
+                zlevel = strcmp(optarg, "fast") == 0 ? COMPRESS_LEVEL_FAST : atoi(optarg);
+                if(zlevel < 1 || zlevel > 9)
+                {
+                    errfn("Compression level must be 1-9 or fast, %s", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'v':
+                log_level = log_parse_level(optarg);
+                if(log_level < 0)
+                {
+                    log_level = LOG_ERR;
+                    errfn("Log level must be err, warn, info or debug, %s", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'c':
+                exit(client_run(optarg, argc - optind, argv + optind) == 0 ? 0 : -1);
+            case 'h':
+                help();
+                exit(0);
+            default:
+                help();
+                exit(-1);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // one sink_data, each of them sets its own
+    if(outputs > 1)
+    {
+        errfn("Only one of -s, -D, -F and -t can be used");
+        exit(-1);
+    }
+
+    // those replace the sink, the prefix would be dropped
+    if(outputs > 0 && prefix)
+    {
+        errfn("-p cannot be used with -s, -D, -F or -t");
+        exit(-1);
+    }
+
+    // compresses stdout only, they write elsewhere
+    if(outputs > 0 && zlevel > 0)
+    {
+        errfn("-z cannot be used with -s, -D, -F or -t");
+        exit(-1);
+    }
+
+    // lines of a record would be dropped one by one
+    if(record_rule_count > 0 && dedup_window > 0)
+    {
+        errfn("-M and -u cannot be used together");
+        exit(-1);
+    }
+
+    // traces are relative to a single root
+    if(argc > 2 && (replay_path != NULL || record_path != NULL))
+    {
+        errfn("-R and -P take one DIRECTORY");
+        exit(-1);
+    }
+
+    if(argc < 2 && replay_path != NULL)
+    {
+        // scratch tree for the replay
+        strcpy(dir, "/tmp/tailall-replay-XXXXXX");
+        if(mkdtemp(dir) == NULL)
+        {
+            errfn("%s %s", strerror(errno), dir);
+            exit(-1);
+        }
+    }else if(argc < 2)
+    {
+        debugfn("Watching under current directory");
+        strcpy (dir, "./");
+    }else
+    {
+        root_spec(argv[1], &path, &label, &filter);
+        debugfn("Watching '%s' directory", path);
+        snprintf(dir, sizeof(dir) - 1, "%s", path);
+
+        if(replay_path != NULL)
+            mkdir(dir, 0755);
+    }
+
+    ret = lstat(dir, &stat);
+    if(ret < 0)
+    {
+        errfn("%s %s", strerror(errno), dir);
+        exit(-1);
+    }
+
+    if(S_ISDIR(stat.st_mode))
+    {
+        if(dir[(strlen(dir)-1)] != '/')
+        {
+            strcat(dir, "/");
+        }
+
+        ta = tailall_init(NULL, sink);
+        if(ta == NULL || tailall_add_root(ta, dir, label, filter) == NULL)
+            exit(-1);
+
+        // the others, one inotify instance and one output for all
+        for(i = 2; i < argc; i++)
+        {
+            root_spec(argv[i], &path, &label, &filter);
+            debugfn("Watching '%s' directory", path);
+
+            if(lstat(path, &stat) < 0 || !S_ISDIR(stat.st_mode))
+            {
+                errfn("Not a directory %s", path);
+                exit(-1);
+            }
+
+            tailall_add_root(ta, path, label, filter);
+        }
+
+        if(server_path != NULL)
+        {
+            signal(SIGPIPE, SIG_IGN);
+
+            ta->sink_data = server_init(ta, server_path);
+            if(ta->sink_data == NULL)
+                exit(-1);
+
+            ta->sink_free = (void (*)(void *))server_free;
+        }
+
+        if(demux_dir != NULL)
+        {
+            ta->sink_data = demux_init(ta, demux_dir, demux_pattern);
+            if(ta->sink_data == NULL)
+                exit(-1);
+
+            ta->splice = splice_demux;
+            ta->sink_free = (void (*)(void *))demux_free;
+        }
+
+        if(forward_target != NULL)
+        {
+            ta->sink_data = forward_init(ta, forward_target);
+            if(ta->sink_data == NULL)
+                exit(-1);
+
+            ta->sink_free = (void (*)(void *))forward_free;
+        }
+
+        if(top_interval > 0)
+        {
+            ta->sink_data = top_init(ta, top_interval, top_k);
+            ta->sink_free = (void (*)(void *))top_free;
+            ta->sink_file_free = free;
+        }
+
+        // in front of whichever sink was picked
+        if(record_rule_count > 0)
+        {
+            multiline = multiline_init(ta);
+
+            for(i = 0; i < record_rule_count; i++)
+            {
+                if(multiline_rule(multiline, record_rules[i]) < 0)
+                    exit(-1);
+            }
+        }
+
+        if(dedup_window > 0)
+            dedup = dedup_init(ta, dedup_window);
+
+        if(zlevel > 0)
+        {
+            z = compress_init(STDOUT_FILENO, zlevel);
+            if(z == NULL)
+            {
+                errfn("Cannot start the compressor");
+                exit(-1);
+            }
+
+            output_set_writer(ta->out, compress_writev, z);
+        }
+
+        stats = stats_init(ta, stats_path);
+
+        // no SA_RESTART, poll() has to return
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stop_handler;
+        stop_ta = ta;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        if(replay_path != NULL)
+        {
+            // the trace stands in for the watches, nothing is started
+            ta->lazy = opts.lazy;
+            ta->skip_binary = !opts.tail_binary;
+
+            if(opts.follow)
+                follow_init(ta);
+
+            ret = trace_replay(ta, replay_path, replay_speed);
+        }else
+        {
+            if(tailall_start(ta, &opts) < 0)
+                exit(-1);
+
+            if(record_path != NULL)
+            {
+                ta->trace = trace_open(ta, record_path, record_bytes);
+                if(ta->trace == NULL)
+                    exit(-1);
+
+                // the recorded bytes have to pass through tailall
+                if(record_bytes)
+                    ta->splice = NULL;
+            }
+
+            tailall_run(ta);
+            trace_close(ta->trace);
+            ta->trace = NULL;
+        }
+
+        // held records and repeat summaries go out before the metrics
+        multiline_free(multiline);
+        dedup_free(dedup);
+        stats_free(stats);
+        tailall_close(ta);
+
+        if(z != NULL)
+            compress_free(z);
+
+        exit(0);
+    }else if(S_ISREG(stat.st_mode))
+    {
+        errfn("Not allow to tail just a file. %s", dir);
+        help();
+        exit(-1);
+    }else
+    {
+        help();
+        exit(-1);
+    }
+
+    return 0;
+}
+
+static void help()
+{
+    outf("\n");
+    outf("Usage: [OPTIONS] [[LABEL=]DIRECTORY[:GLOB]]...\n");
+    outf("\n");
+    outf("Example: ./tailall \n");
+    outf("\n");
+    outf("Options:\n");
+    outf("  -p         Prefix every line with its source path instead of '# path' headers\n");
+    outf("  -l         Open created files on their first write only, files created and\n");
+    outf("             deleted without being written to never cost a descriptor\n");
+    outf("  -L         Follow symbolic links. A directory or file reached by several\n");
+    outf("             paths is watched and read once, under the first path found or\n");
+    outf("             a real path once one shows up, link cycles are cut\n");
+    outf("  -f         One fanotify mark per filesystem instead of an inotify watch per\n");
+    outf("             directory, needs CAP_SYS_ADMIN and Linux 5.9, inotify otherwise\n");
+    outf("  -Q PATH    Poll the mount PATH is on instead of trusting inotify, NFS, CIFS,\n");
+    outf("             FUSE and other network mounts are polled anyway unless -Q off\n");
+    outf("  -w N       Inotify watches to use at most, the rest of the directories is\n");
+    outf("             polled (default max_user_watches less %d%%)\n", BUDGET_HEADROOM_PCT);
+    outf("  -W GLOB    Directories matching GLOB, relative to DIRECTORY (LABEL/ first if\n");
+    outf("             labelled), are watched first and never polled for lack of watches,\n");
+    outf("             may be repeated\n");
+    outf("  -b         Tail binary content too, by default a file whose append looks\n");
+    outf("             binary (NUL and control bytes) is skipped for %ds\n", BINARY_RECHECK_MS / 1000);
+    outf("  -M [GLOB=]RULE\n");
+    outf("             Keep multi-line records such as stack traces together, a record\n");
+    outf("             is written at once when the next one starts or after %ds. RULE\n", MULTILINE_IDLE_MS / 1000);
+    outf("             indent: lines starting with whitespace, 'at ', 'Caused by:', '...'\n");
+    outf("             or 'Traceback (' continue a record, ^PATTERN: only lines starting\n");
+    outf("             with PATTERN start one, '#' matches a digit and '?' any byte. Only\n");
+    outf("             files whose path relative to DIRECTORY matches GLOB if given, may\n");
+    outf("             be repeated, the first rule matching a file is used\n");
+    outf("  -u SECONDS Drop a line seen in any file less than SECONDS before, how often\n");
+    outf("             it was is written every SECONDS as '[repeated N times] <line>'.\n");
+    outf("             Lines shorter than %d bytes always pass, not with -M\n", DEDUP_MIN_LINE);
+    outf("  -s SOCKET  Serve the tree to clients over a Unix socket, nothing on stdout\n");
+    outf("  -D DIR     Append the new bytes of every file to a mirror file under DIR\n");
+    outf("  -G PATTERN Output file under DIR for -D, %%p path, %%d directory, %%f name\n");
+    outf("             relative to the watched directory (default %%p)\n");
+    outf("  -F HOST:PORT\n");
+    outf("             Forward length-prefixed frames to a TCP collector, nothing on stdout\n");
+    outf("  -z LEVEL   gzip the output on a separate thread, LEVEL 1-9 or fast\n");
+    outf("  -t SECONDS Print the busiest files and directories every SECONDS instead of\n");
+    outf("             their content, rates over the last interval, 10s and 60s\n");
+    outf("  -K N       Number of files and directories shown by -t (default %d)\n", TOP_DEFAULT_K);
+    outf("  -m FILE    Write Prometheus text metrics to FILE every second. SIGUSR1\n");
+    outf("             writes them at once, to stderr if no FILE\n");
+    outf("  -R FILE    Record the inotify events to a binary trace FILE\n");
+    outf("  -B         With -R, record the tailed bytes too, otherwise only their size\n");
+    outf("  -P FILE    Replay a trace into DIRECTORY (a new /tmp directory if none),\n");
+    outf("             bypassing inotify, and print the event rate to stderr\n");
+    outf("  -S SPEED   Replay speed for -P, 1 real time, 0 as fast as possible (default)\n");
+    outf("  -c SOCKET [PREFIX|GLOB]...\n");
+    outf("             Connect to a server and print the subscribed files, all if none\n");
+    outf("  -v LEVEL   Diagnostics written to stderr, err, warn, info or debug (default\n");
+#ifdef DEBUG
+    outf("             debug), a warning or error repeated from one place more than %d\n", LOG_RATE_BURST);
+#else
+    outf("             info), a warning or error repeated from one place more than %d\n", LOG_RATE_BURST);
+#endif
+    outf("             times a second is counted instead\n");
+    outf("  -h         Show this help\n");
+    outf("\n");
+    outf("Tailing all files(only normal file) under a directory such as UNIX tail command,\n");
+    outf("even in sub-directories recursively.\n");
+    outf("\n");
+    outf("Symbolic link (without -L), FIFO and block device will be ignored. Network\n");
+    outf("and FUSE mounts are polled, inotify does not see changes made elsewhere.\n");
+    outf("Past the watch budget the least busy directories are polled, and get a\n");
+    outf("watch back when they turn busier than the idlest watched ones.\n");
+    outf("\n");
+    outf("DIRECTORY is the target to be watched. It watchs current directory (./), if\n");
+    outf("no DIRECTORY. Several of them share one inotify instance and one output, a\n");
+    outf("DIRECTORY inside another one is left to its own settings. LABEL is shown\n");
+    outf("instead of the DIRECTORY path, only files whose path relative to DIRECTORY\n");
+    outf("matches GLOB are tailed, '*' matches '/' too.\n");
+    outf("\n");
+}
+
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "metrics.h"
+
+__thread metrics_t *metrics_self;
+
+static metrics_t *metrics_list;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// First use on a thread, the only time a lock is taken.
+metrics_t* metrics_thread()
+{
+    metrics_t *m;
+
+    if(metrics_self != NULL)
+        return metrics_self;
+
+    m = calloc(sizeof(metrics_t), 1);
+    assert(m != NULL);
+
+    pthread_mutex_lock(&metrics_lock);
+    m->next = metrics_list;
+    __atomic_store_n(&metrics_list, m, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&metrics_lock);
+
+    metrics_self = m;
+
+    return m;
+}
+
+uint64_t metrics_now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int log2_bucket(uint64_t v, int max)
+{
+    int b = 0;
+
+    if(v > 1)
+        b = 64 - __builtin_clzll(v - 1);
+
+    return b < max ? b : max - 1;
+}
+
+void metric_batch(uint64_t events)
+{
+    metrics_t *m = metrics_thread();
+
+    metric_slot_add(m->batch[log2_bucket(events, METRIC_BATCH_BUCKETS)], 1);
+    metric_slot_add(m->batch_sum, events);
+}
+
+void metric_latency(uint64_t us)
+{
+    metrics_t *m = metrics_thread();
+
+    metric_slot_add(m->latency[log2_bucket(us, METRIC_LATENCY_BUCKETS)], 1);
+    metric_slot_add(m->latency_sum, us);
+}
+
+void metrics_collect(metrics_t *sum)
+{
+    metrics_t *m;
+    int i;
+
+    memset(sum, 0, sizeof(metrics_t));
+
+    for(m = __atomic_load_n(&metrics_list, __ATOMIC_ACQUIRE); m != NULL; m = m->next)
+    {
+        for(i = 0; i < M_COUNTER_MAX; i++)
+            sum->counter[i] += __atomic_load_n(&m->counter[i], __ATOMIC_RELAXED);
+
+        for(i = 0; i < METRIC_BATCH_BUCKETS; i++)
+            sum->batch[i] += __atomic_load_n(&m->batch[i], __ATOMIC_RELAXED);
+
+        for(i = 0; i < METRIC_LATENCY_BUCKETS; i++)
+            sum->latency[i] += __atomic_load_n(&m->latency[i], __ATOMIC_RELAXED);
+
+        sum->batch_sum += __atomic_load_n(&m->batch_sum, __ATOMIC_RELAXED);
+        sum->latency_sum += __atomic_load_n(&m->latency_sum, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+    M_EV_CREATE = 0,
+    M_EV_DELETE,
+    M_EV_DELETE_SELF,
+    M_EV_MODIFY,
+    M_EV_CLOSE_WRITE,
+    M_EV_MOVED_FROM,
+    M_EV_MOVED_TO,
+    M_EV_MOVE_SELF,
+    M_EV_OVERFLOW,
+    M_EV_OTHER,
+    M_EV_UNKNOWN_WD,
+    M_BYTES_READ,
+    M_BYTES_WRITTEN,
+    M_SYS_READ,
+    M_SYS_WRITE,
+    M_SYS_OPEN,
+    M_SYS_LSEEK,
+    M_SYS_COPY_FILE_RANGE,
+    M_SYS_INOTIFY_READ,
+    M_SYS_INOTIFY_ADD_WATCH,
+    M_SYS_FANOTIFY_READ,
+    M_TAILING,
+    M_STALLS,
+    M_LAZY_DROPPED,
+    M_POLL_CHECKS,
+    M_BUDGET_PROMOTED,
+    M_BUDGET_DEMOTED,
+    M_BINARY_FILES,
+    M_BINARY_BYTES,
+    M_ZERO_BYTES,
+    M_MULTILINE_IDLE,
+    M_MULTILINE_FULL,
+    M_DEDUP_LINES,
+    M_DEDUP_BYTES,
+    M_COUNTER_MAX
+} METRIC_COUNTER;
+
+#define METRIC_BATCH_BUCKETS    12      // 1, 2, 4 .. 2048+ events per read()
+#define METRIC_LATENCY_BUCKETS  26      // 1us, 2us .. 2^24us, +Inf
+
+typedef struct _metrics metrics_t;
+
+// One per thread, written only by its own thread, read by anybody.
+struct _metrics
+{
+    uint64_t            counter[M_COUNTER_MAX];
+    uint64_t            batch[METRIC_BATCH_BUCKETS];
+    uint64_t            batch_sum;
+    uint64_t            latency[METRIC_LATENCY_BUCKETS];
+    uint64_t            latency_sum;    // us
+    metrics_t           *next;
+};
+
+extern __thread metrics_t *metrics_self;
+
+metrics_t*      metrics_thread();
+
+// Single writer, so a relaxed load and store is enough, no lock prefix.
+#define metric_slot_add(slot, n) \
+    __atomic_store_n(&(slot), __atomic_load_n(&(slot), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+#define metric_add(id, n) \
+    metric_slot_add((metrics_self != NULL ? metrics_self : metrics_thread())->counter[(id)], (n))
+
+#define metric_inc(id)  metric_add(id, 1)
+
+void            metric_batch(uint64_t events);
+void            metric_latency(uint64_t us);
+uint64_t        metrics_now_us();
+
+// Sum of every thread
+void            metrics_collect(metrics_t *sum);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _METRICS_H_
@@ -0,0 +1,399 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fnmatch.h>
+
+#include "multiline.h"
+#include "metrics.h"
+
+// "indent", besides a leading space or tab
+static const char *multiline_cont[] = { "at ", "Caused by:", "...", "Traceback (", NULL };
+
+static void multiline_timer_cb(loop_t *loop, void *arg);
+
+multiline_t* multiline_init(tailall_t *ta)
+{
+    assert(ta != NULL);
+
+    multiline_t *ml;
+
+    ml = calloc(sizeof(multiline_t), 1);
+    assert(ml != NULL);
+
+    ml->ta = ta;
+    ml->sink = ta->sink;
+    ml->timer = loop_add_timer(ta->loop, MULTILINE_TICK, multiline_timer_cb, ml);
+
+    ta->sink = multiline_sink;
+    ta->multiline = ml;
+
+    return ml;
+}
+
+int multiline_rule(multiline_t *ml, const char *spec)
+{
+    assert(ml != NULL);
+    assert(spec != NULL);
+
+    multiline_rule_t *rule;
+    const char *p;
+    size_t i, len;
+
+    if(ml->nrules == MULTILINE_MAX_RULES)
+    {
+        errfn("Too many record rules, %d at most", MULTILINE_MAX_RULES);
+        return -1;
+    }
+
+    rule = &ml->rules[ml->nrules];
+    rule->glob = NULL;
+    p = strchr(spec, '=');
+
+    // a pattern may hold '=' itself
+    if(spec[0] != '^' && strcmp(spec, "indent") != 0 && p != NULL)
+    {
+        len = p - spec;
+        rule->glob = strndup(spec, len);
+        assert(rule->glob != NULL);
+        p++;
+    }else
+    {
+        p = spec;
+    }
+
+    if(strcmp(p, "indent") == 0)
+    {
+        rule->type = MULTILINE_INDENT;
+
+        for(i = 0, rule->len = 1; multiline_cont[i] != NULL; i++)
+        {
+            if(strlen(multiline_cont[i]) > rule->len)
+                rule->len = strlen(multiline_cont[i]);
+        }
+    }else if(p[0] == '^' && p[1] != '\0' && strlen(p + 1) < MULTILINE_PATTERN_MAX)
+    {
+        rule->type = MULTILINE_START;
+        rule->len = strlen(p + 1);
+        memcpy(rule->pattern, p + 1, rule->len + 1);
+    }else
+    {
+        errfn("Bad record rule %s, indent or ^PATTERN", spec);
+        free((char *)rule->glob);
+        rule->glob = NULL;
+        return -1;
+    }
+
+    ml->nrules++;
+
+    return 0;
+}
+
+static void multiline_list(multiline_t *ml, multiline_file_t *mf)
+{
+    mf->prev = NULL;
+    mf->next = ml->pending_first;
+
+    if(ml->pending_first != NULL)
+        ml->pending_first->prev = mf;
+
+    ml->pending_first = mf;
+}
+
+static void multiline_unlist(multiline_t *ml, multiline_file_t *mf)
+{
+    if(mf->prev != NULL)
+        mf->prev->next = mf->next;
+    else
+        ml->pending_first = mf->next;
+
+    if(mf->next != NULL)
+        mf->next->prev = mf->prev;
+
+    mf->next = mf->prev = NULL;
+}
+
+static multiline_file_t* multiline_file_init(multiline_t *ml, file_t *file)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    multiline_file_t *mf;
+    int i;
+
+    mf = calloc(sizeof(multiline_file_t), 1);
+    assert(mf != NULL);
+
+    mf->file = file;
+    snprintf(buf, sizeof(buf), "%s%s", folder_path2(file->folder, FOLDER_PATH_REL | FOLDER_PATH_LABEL), file->name);
+
+    for(i = 0; i < ml->nrules && mf->rule == NULL; i++)
+    {
+        if(ml->rules[i].glob == NULL || fnmatch(ml->rules[i].glob, buf, 0) == 0)
+            mf->rule = &ml->rules[i];
+    }
+
+    file->multiline = mf;
+
+    return mf;
+}
+
+// return
+//   1  : the line starts a record
+//   0  : the line continues the record before
+//  -1  : not enough of the line yet
+static int multiline_starts(multiline_rule_t *rule, const char *p, size_t avail)
+{
+    const char *eol;
+    size_t n, m, i;
+
+    // as much of the line as the rule looks at
+    eol = memchr(p, '\n', avail < rule->len ? avail : rule->len);
+    n = eol != NULL ? (size_t)(eol - p) : avail;
+
+    if(rule->type == MULTILINE_START)
+    {
+        for(i = 0; i < rule->len; i++)
+        {
+            if(i == n)
+                return eol != NULL ? 0 : -1;
+
+            if(rule->pattern[i] == '#' ? !isdigit((unsigned char)p[i]) :
+               rule->pattern[i] != '?' && rule->pattern[i] != p[i])
+                return 0;
+        }
+
+        return 1;
+    }
+
+    if(n > 0 && (p[0] == ' ' || p[0] == '\t'))
+        return 0;
+
+    for(i = 0; multiline_cont[i] != NULL; i++)
+    {
+        m = strlen(multiline_cont[i]);
+
+        if(memcmp(p, multiline_cont[i], n < m ? n : m) != 0)
+            continue;
+
+        if(n >= m)
+            return 0;
+
+        if(eol == NULL)
+            return -1;
+    }
+
+    return 1;
+}
+
+// Judges the lines of buf from *scan on, *scan is left at the first line
+// not seen whole.
+// return
+//   start of the last record past 0, 0 for none: buf[0, return) is whole records
+static size_t multiline_scan(multiline_rule_t *rule, const char *buf, size_t len, size_t *scan)
+{
+    const char *eol;
+    size_t pos = *scan, cut = 0;
+    int res;
+
+    while(pos < len)
+    {
+        res = multiline_starts(rule, buf + pos, len - pos);
+        if(res < 0)
+            break;
+
+        if(res > 0 && pos > 0)
+            cut = pos;
+
+        eol = memchr(buf + pos, '\n', len - pos);
+        if(eol == NULL)
+            break;
+
+        pos = eol + 1 - buf;
+    }
+
+    *scan = pos;
+
+    return cut;
+}
+
+static void multiline_hold(multiline_t *ml, multiline_file_t *mf, const char *buf, size_t len)
+{
+    if(mf->len + len > mf->size)
+    {
+        if(mf->size == 0)
+            mf->size = 4096;
+
+        while(mf->size < mf->len + len)
+            mf->size *= 2;
+
+        mf->buf = realloc(mf->buf, mf->size);
+        assert(mf->buf != NULL);
+    }
+
+    if(mf->len == 0)
+        multiline_list(ml, mf);
+
+    memcpy(mf->buf + mf->len, buf, len);
+    mf->len += len;
+    mf->last = loop_now_ms();
+}
+
+// Hands buf[0, cut) to the sink.
+// return
+//   0  : Success, a full sink may have left some
+//  -1  : Error, the records are lost
+static int multiline_push(multiline_t *ml, multiline_file_t *mf)
+{
+    int done, ret = 0;
+
+    if(mf->cut == 0)
+        return 0;
+
+    done = ml->sink(ml->ta, mf->file, mf->buf, mf->cut);
+    if(done < 0)
+    {
+        done = mf->cut;
+        ret = -1;
+    }
+
+    memmove(mf->buf, mf->buf + done, mf->len - done);
+    mf->len -= done;
+    mf->cut -= done;
+    mf->scan = mf->scan > (size_t)done ? mf->scan - done : 0;
+
+    if(mf->len == 0)
+        multiline_unlist(ml, mf);
+
+    return ret;
+}
+
+int multiline_sink(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    multiline_t *ml = ta->multiline;
+    multiline_file_t *mf = file->multiline;
+    size_t cut, scan = 0;
+    int done = 0;
+
+    if(mf == NULL)
+        mf = multiline_file_init(ml, file);
+
+    if(mf->rule == NULL)
+        return ml->sink(ta, file, buf, len);
+
+    // records a full sink left go first, nothing is taken until they did
+    if(multiline_push(ml, mf) < 0)
+        return -1;
+
+    if(mf->cut > 0)
+        return 0;
+
+    // a record longer than the buffer goes out as it is
+    if(mf->len > 0 && mf->len + len > MULTILINE_BUF_MAX)
+    {
+        metric_inc(M_MULTILINE_FULL);
+        mf->cut = mf->len;
+
+        if(multiline_push(ml, mf) < 0)
+            return -1;
+
+        if(mf->cut > 0)
+            return 0;
+    }
+
+    if(mf->len > 0)
+    {
+        multiline_hold(ml, mf, buf, len);
+        mf->cut = multiline_scan(mf->rule, mf->buf, mf->len, &mf->scan);
+
+        return multiline_push(ml, mf) < 0 ? -1 : (int)len;
+    }
+
+    // nothing held, whole records go on straight from buf
+    cut = multiline_scan(mf->rule, buf, len, &scan);
+
+    if(cut > 0 && (done = ml->sink(ta, file, buf, cut)) < 0)
+        return -1;
+
+    multiline_hold(ml, mf, buf + done, len - done);
+    mf->cut = cut - done;
+    mf->scan = scan - done;
+
+    return len;
+}
+
+static void multiline_timer_cb(loop_t *loop, void *arg)
+{
+    multiline_t *ml = arg;
+    multiline_file_t *mf, *next;
+    uint64_t now = loop_now_ms();
+
+    for(mf = ml->pending_first; mf != NULL; mf = next)
+    {
+        next = mf->next;
+
+        // no next line has come to close the record
+        if(mf->cut == 0 && now - mf->last >= MULTILINE_IDLE_MS)
+        {
+            metric_inc(M_MULTILINE_IDLE);
+            mf->cut = mf->len;
+        }
+
+        multiline_push(ml, mf);
+
+        // idle files give their buffer back
+        if(mf->len == 0)
+        {
+            free(mf->buf);
+            mf->buf = NULL;
+            mf->size = 0;
+        }
+    }
+}
+
+void multiline_file_free(tailall_t *ta, file_t *file)
+{
+    multiline_file_t *mf = file->multiline;
+    multiline_t *ml = ta->multiline;
+
+    if(mf == NULL)
+        return;
+
+    if(ml != NULL && mf->len > 0)
+    {
+        mf->cut = mf->len;
+        multiline_push(ml, mf);
+
+        // the sink is full, it is lost with the file
+        if(mf->len > 0)
+            multiline_unlist(ml, mf);
+    }
+
+    free(mf->buf);
+    free(mf);
+    file->multiline = NULL;
+}
+
+void multiline_free(multiline_t *ml)
+{
+    multiline_file_t *mf, *next;
+    int i;
+
+    if(ml == NULL)
+        return;
+
+    for(mf = ml->pending_first; mf != NULL; mf = next)
+    {
+        next = mf->next;
+        mf->cut = mf->len;
+        multiline_push(ml, mf);
+    }
+
+    loop_del_timer(ml->ta->loop, ml->timer);
+
+    for(i = 0; i < ml->nrules; i++)
+        free((char *)ml->rules[i].glob);
+
+    ml->ta->sink = ml->sink;
+    ml->ta->multiline = NULL;
+    free(ml);
+}
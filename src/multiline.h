@@ -0,0 +1,81 @@
+#ifndef _MULTILINE_H_
+#define _MULTILINE_H_
+
+#include <stdint.h>
+
+#include "tailall.h"
+
+#define MULTILINE_MAX_RULES     16      // -M
+#define MULTILINE_PATTERN_MAX   64
+#define MULTILINE_BUF_MAX       (1024*256)  // per file, a longer record is cut there
+#define MULTILINE_IDLE_MS       1000    // a record no line was added to since is whole
+#define MULTILINE_TICK          100     // ms, between idle checks
+
+#define MULTILINE_INDENT        1       // "indent", continuation lines are indented
+#define MULTILINE_START         2       // "^PATTERN", records start with PATTERN
+
+typedef struct _multiline_rule multiline_rule_t;
+typedef struct _multiline_file multiline_file_t;
+typedef struct _multiline multiline_t;
+
+struct _multiline_rule
+{
+    const char          *glob;      // NULL for every file
+    int                 type;
+    char                pattern[MULTILINE_PATTERN_MAX];     // '#' a digit, '?' any byte
+    size_t              len;        // first bytes of a line the rule looks at
+};
+
+// hung on file->multiline
+struct _multiline_file
+{
+    file_t              *file;
+    multiline_rule_t    *rule;      // NULL, no rule for the file, passed through
+    char                *buf;       // the record being assembled
+    size_t              len;
+    size_t              size;
+    size_t              cut;        // buf[0, cut) is whole records a full sink left
+    size_t              scan;       // line start the next look begins at
+    uint64_t            last;       // loop_now_ms() of the last append
+    multiline_file_t    *next;      // pending list, buf holds bytes
+    multiline_file_t    *prev;
+};
+
+struct _multiline
+{
+    tailall_t           *ta;
+    tailall_sink_t      sink;       // records go on to
+    multiline_rule_t    rules[MULTILINE_MAX_RULES];
+    int                 nrules;
+    multiline_file_t    *pending_first;
+    loop_timer_t        *timer;
+};
+
+// Puts itself in front of ta->sink and hands it whole records, one call
+// each, so lines of other files never land inside a stack trace. A record
+// is a line starting one and the lines continuing it, it is complete once
+// the next one starts or after MULTILINE_IDLE_MS without a new line.
+// Lines are judged on their first bytes only.
+multiline_t*    multiline_init(tailall_t *ta);
+
+// Flushes every record held and gives ta->sink back.
+void            multiline_free(multiline_t *ml);
+
+// spec is [GLOB=]RULE, RULE one of
+//   indent     lines starting with a space, a tab, "at ", "Caused by:",
+//              "..." or "Traceback (" continue the record before
+//   ^PATTERN   only lines starting with PATTERN start a record
+// GLOB matches the path of the file relative to its root, after "<label>/"
+// for a labelled one. The first rule matching a file is its rule.
+// return
+//   0  : Success
+//  -1  : Bad spec or too many rules
+int             multiline_rule(multiline_t *ml, const char *spec);
+
+// tailall_sink_t ta->sink is replaced with
+int             multiline_sink(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+// The file is being freed, its record goes out as it is.
+void            multiline_file_free(tailall_t *ta, file_t *file);
+
+#endif // _MULTILINE_H_
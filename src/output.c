@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "metrics.h"
+
+output_t* output_init(int fd)
+{
+    output_t *out = calloc(sizeof(output_t), 1);
+
+    if(out == NULL)
+        return NULL;
+
+    out->fd = fd;
+
+    return out;
+}
+
+void output_free(output_t *out)
+{
+    if(out == NULL)
+        return;
+
+    output_flush(out);
+    free(out);
+}
+
+void output_set_writer(output_t *out, output_writer_t writer, void *arg)
+{
+    output_flush(out);
+    out->writer = writer;
+    out->writer_arg = arg;
+}
+
+int output_add(output_t *out, const void *buf, size_t len)
+{
+    assert(out != NULL);
+
+    if(len == 0)
+        return 0;
+
+    if(out->iovcnt == OUTPUT_IOV_MAX)
+    {
+        if(output_flush(out) < 0)
+            return -1;
+    }
+
+    out->iov[out->iovcnt].iov_base = (void *)buf;
+    out->iov[out->iovcnt].iov_len = len;
+    out->iovcnt++;
+    out->bytes += len;
+
+    return 0;
+}
+
+int output_flush(output_t *out)
+{
+    assert(out != NULL);
+
+    struct iovec *iov = out->iov;
+    int iovcnt = out->iovcnt;
+    ssize_t ret;
+
+    if(out->writer != NULL && iovcnt > 0)
+    {
+        ret = out->writer(out->writer_arg, iov, iovcnt);
+        out->iovcnt = 0;
+        out->bytes = 0;
+        return ret < 0 ? -1 : 0;
+    }
+
+    while(iovcnt > 0)
+    {
+        ret = writev(out->fd, iov, iovcnt);
+        metric_inc(M_SYS_WRITE);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            out->iovcnt = 0;
+            out->bytes = 0;
+            return -1;
+        }
+
+        metric_add(M_BYTES_WRITTEN, ret);
+
+        // partial write, skip what has been written and retry the rest
+        while(iovcnt > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    out->iovcnt = 0;
+    out->bytes = 0;
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+// Keep well under IOV_MAX(1024), one writev() per batch.
+#define OUTPUT_IOV_MAX      512
+
+typedef struct _output output_t;
+
+// Replaces writev(fd) when set, e.g. compress_writev()
+typedef int (*output_writer_t)(void *arg, const struct iovec *iov, int iovcnt);
+
+struct _output
+{
+    int                 fd;
+    output_writer_t     writer;
+    void                *writer_arg;
+    int                 iovcnt;
+    size_t              bytes;      // pending bytes in iov
+    struct iovec        iov[OUTPUT_IOV_MAX];
+};
+
+output_t*   output_init(int fd);
+void        output_free(output_t *out);
+void        output_set_writer(output_t *out, output_writer_t writer, void *arg);
+
+// Queue a slice, no copy. Caller must keep the memory valid until
+// output_flush(), flushes by itself when the iovec array is full.
+int         output_add(output_t *out, const void *buf, size_t len);
+
+// return
+//   0 : Success
+//  -1 : Error, errno is set
+int         output_flush(output_t *out);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _OUTPUT_H_
@@ -0,0 +1,793 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "pollfs.h"
+#include "metrics.h"
+#include "trace.h"
+
+typedef struct _pollfs_name pollfs_name_t;
+typedef struct _pollfs_gone pollfs_gone_t;
+
+// one readdir() entry of a folder check
+struct _pollfs_name
+{
+    char                *name;
+    ino_t               ino;
+    unsigned char       type;       // DT_*
+    int                 used;       // an entry already tracked
+};
+
+// a tracked entry no longer found under its name
+struct _pollfs_gone
+{
+    file_t              *file;
+    folder_t            *folder;
+    pollfs_name_t       *to;        // same inode under a new name
+};
+
+static void pollfs_timer_cb(loop_t *loop, void *arg);
+
+// return
+//   1 : changes by other hosts or a user space daemon are invisible to inotify
+static int fs_is_remote(uint32_t type)
+{
+    switch(type)
+    {
+        case 0x6969:            // NFS
+        case 0x517b:            // SMB
+        case 0xff534d42:        // CIFS
+        case 0xfe534d42:        // SMB2
+        case 0x65735546:        // FUSE
+        case 0x01021997:        // 9P
+        case 0x00c36400:        // Ceph
+        case 0x47504653:        // GPFS
+        case 0x0bd00bd0:        // Lustre
+            return 1;
+    }
+
+    return 0;
+}
+
+pollfs_t* pollfs_init(tailall_t *ta, int detect)
+{
+    assert(ta != NULL);
+
+    pollfs_t *pollfs = calloc(sizeof(pollfs_t), 1);
+    assert(pollfs != NULL);
+
+    pollfs->ta = ta;
+    pollfs->detect = detect;
+
+    return pollfs;
+}
+
+void pollfs_free(pollfs_t *pollfs)
+{
+    if(pollfs == NULL)
+        return;
+
+    if(pollfs->timer != NULL)
+        loop_del_timer(pollfs->ta->loop, pollfs->timer);
+
+    // entries are owned by their files and folders
+    free(pollfs->heap);
+    free(pollfs);
+}
+
+static pollfs_mount_t* pollfs_mount_find(pollfs_t *pollfs, dev_t dev)
+{
+    int i;
+
+    for(i = 0; i < pollfs->nmounts; i++)
+    {
+        if(pollfs->mounts[i].dev == dev)
+            return &pollfs->mounts[i];
+    }
+
+    return NULL;
+}
+
+static pollfs_mount_t* pollfs_mount_add(pollfs_t *pollfs, dev_t dev, int poll)
+{
+    pollfs_mount_t *mount;
+
+    if(pollfs->nmounts == POLLFS_MAX_MOUNTS)
+    {
+        warnfn("Too many mounts, %d at most", POLLFS_MAX_MOUNTS);
+        return NULL;
+    }
+
+    mount = &pollfs->mounts[pollfs->nmounts++];
+    mount->dev = dev;
+    mount->poll = poll;
+
+    return mount;
+}
+
+int pollfs_force(pollfs_t *pollfs, const char *path)
+{
+    assert(pollfs != NULL);
+    assert(path != NULL);
+
+    pollfs_mount_t *mount;
+    struct stat st;
+
+    if(stat(path, &st) < 0)
+    {
+        errfn("%s %s", strerror(errno), path);
+        return -1;
+    }
+
+    mount = pollfs_mount_find(pollfs, st.st_dev);
+    if(mount == NULL)
+        mount = pollfs_mount_add(pollfs, st.st_dev, 1);
+
+    if(mount == NULL)
+        return -1;
+
+    mount->poll = 1;
+
+    return 0;
+}
+
+// return
+//   1 : folders on dev are polled, decided once per mount
+static int pollfs_mount_poll(pollfs_t *pollfs, const char *path, dev_t dev)
+{
+    pollfs_mount_t *mount;
+    struct statfs sfs;
+    int poll = 0;
+
+    mount = pollfs_mount_find(pollfs, dev);
+    if(mount != NULL)
+        return mount->poll;
+
+    if(pollfs->detect && statfs(path, &sfs) == 0 && fs_is_remote((uint32_t)sfs.f_type))
+    {
+        debugf("Polling the mount of %s, type 0x%x\n", path, (uint32_t)sfs.f_type);
+        poll = 1;
+    }
+
+    pollfs_mount_add(pollfs, dev, poll);
+
+    return poll;
+}
+
+static void heap_swap(pollfs_t *pollfs, int a, int b)
+{
+    pollfs_ent_t *tmp = pollfs->heap[a];
+
+    pollfs->heap[a] = pollfs->heap[b];
+    pollfs->heap[b] = tmp;
+    pollfs->heap[a]->idx = a;
+    pollfs->heap[b]->idx = b;
+}
+
+static void heap_up(pollfs_t *pollfs, int i)
+{
+    int p;
+
+    while(i > 0 && pollfs->heap[p = (i - 1) / 2]->due > pollfs->heap[i]->due)
+    {
+        heap_swap(pollfs, i, p);
+        i = p;
+    }
+}
+
+static void heap_down(pollfs_t *pollfs, int i)
+{
+    int l, r, m;
+
+    while(1)
+    {
+        l = 2 * i + 1;
+        r = l + 1;
+        m = i;
+
+        if(l < pollfs->count && pollfs->heap[l]->due < pollfs->heap[m]->due)
+            m = l;
+        if(r < pollfs->count && pollfs->heap[r]->due < pollfs->heap[m]->due)
+            m = r;
+        if(m == i)
+            break;
+
+        heap_swap(pollfs, i, m);
+        i = m;
+    }
+}
+
+static pollfs_ent_t* pollfs_ent_add(pollfs_t *pollfs, file_t *file, folder_t *folder)
+{
+    pollfs_ent_t *ent;
+
+    if(pollfs->count == pollfs->size)
+    {
+        pollfs->size = pollfs->size == 0 ? 1024 : pollfs->size * 2;
+        pollfs->heap = realloc(pollfs->heap, pollfs->size * sizeof(pollfs_ent_t *));
+        assert(pollfs->heap != NULL);
+    }
+
+    ent = calloc(sizeof(pollfs_ent_t), 1);
+    assert(ent != NULL);
+
+    ent->file = file;
+    ent->folder = folder;
+    ent->interval = POLLFS_MIN_INTERVAL;
+
+    // a scan registers thousands at once, spread their first checks
+    ent->due = loop_now_ms() + rand() % POLLFS_MIN_INTERVAL;
+
+    ent->idx = pollfs->count++;
+    pollfs->heap[ent->idx] = ent;
+    heap_up(pollfs, ent->idx);
+
+    if(pollfs->timer == NULL)
+        pollfs->timer = loop_add_timer(pollfs->ta->loop, POLLFS_TICK, pollfs_timer_cb, pollfs);
+
+    return ent;
+}
+
+// Entries of a folder and its files are checked once more right away and
+// dropped after, or kept on
+static void pollfs_retire(pollfs_t *pollfs, folder_t *folder, int retire)
+{
+    pollfs_ent_t *ent = folder->poll;
+    file_t *file;
+
+    while(ent != NULL)
+    {
+        ent->retire = retire;
+
+        if(retire)
+        {
+            ent->due = loop_now_ms();
+            heap_up(pollfs, ent->idx);
+        }
+
+        file = ent->file != NULL ? ent->file->next : folder->file_first;
+
+        while(file != NULL && file->poll == NULL)
+            file = file->next;
+
+        ent = file != NULL ? file->poll : NULL;
+    }
+}
+
+void pollfs_folder_add(pollfs_t *pollfs, folder_t *folder)
+{
+    pollfs_folder_add2(pollfs, folder, 0);
+}
+
+void pollfs_folder_add2(pollfs_t *pollfs, folder_t *folder, int force)
+{
+    assert(pollfs != NULL);
+    assert(folder != NULL);
+
+    const char *path = folder_path(folder);
+    pollfs_ent_t *ent;
+    struct stat st;
+    file_t *file;
+
+    if(folder->poll != NULL)
+    {
+        // demoted again before its last check
+        pollfs_retire(pollfs, folder, 0);
+    }else
+    {
+        if(stat(path, &st) < 0)
+            return;
+
+        if(!pollfs_mount_poll(pollfs, path, st.st_dev) && !force)
+            return;
+
+        if(folder->ino == 0)
+        {
+            folder->dev = st.st_dev;
+            folder->ino = st.st_ino;
+        }
+
+        ent = pollfs_ent_add(pollfs, NULL, folder);
+        ent->mtime = st.st_mtim;
+        folder->poll = ent;
+    }
+
+    // a folder the watch budget gave up already has files
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        if(file->poll == NULL)
+            pollfs_file_add(pollfs, file);
+    }
+}
+
+// Everything found differs from what was last seen, the next check diffs
+// the directory and reads the files, once for a folder not polled anyway
+void pollfs_rescan(pollfs_t *pollfs, folder_t *folder)
+{
+    assert(pollfs != NULL);
+    assert(folder != NULL);
+
+    pollfs_ent_t *ent;
+    folder_t *child;
+    file_t *file;
+    int polled = folder->poll != NULL;
+
+    if(!polled)
+        pollfs_folder_add2(pollfs, folder, 1);
+
+    ent = folder->poll;
+    if(ent != NULL)
+    {
+        memset(&ent->mtime, 0, sizeof(ent->mtime));
+        ent->due = loop_now_ms();
+        heap_up(pollfs, ent->idx);
+    }
+
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        ent = file->poll;
+        if(ent == NULL)
+            continue;
+
+        ent->size = 0;
+        memset(&ent->mtime, 0, sizeof(ent->mtime));
+        ent->due = loop_now_ms();
+        heap_up(pollfs, ent->idx);
+    }
+
+    if(!polled && folder->poll != NULL)
+        pollfs_folder_del(pollfs, folder);
+
+    for(child = folder->child_first; child != NULL; child = child->next)
+        pollfs_rescan(pollfs, child);
+}
+
+void pollfs_file_add(pollfs_t *pollfs, file_t *file)
+{
+    assert(pollfs != NULL);
+    assert(file != NULL);
+
+    pollfs_ent_t *ent;
+    struct stat st;
+
+    // files of a polled folder only
+    if(file->folder->poll == NULL || ((pollfs_ent_t *)file->folder->poll)->retire ||
+            fstat(file->fd, &st) < 0)
+        return;
+
+    if(file->ino == 0)
+    {
+        file->dev = st.st_dev;
+        file->ino = st.st_ino;
+    }
+
+    ent = pollfs_ent_add(pollfs, file, NULL);
+    ent->size = st.st_size;
+    ent->mtime = st.st_mtim;
+    file->poll = ent;
+}
+
+void pollfs_del(pollfs_t *pollfs, pollfs_ent_t *ent)
+{
+    assert(pollfs != NULL);
+    assert(ent != NULL);
+
+    pollfs_ent_t *last = pollfs->heap[--pollfs->count];
+
+    if(last != ent)
+    {
+        pollfs->heap[ent->idx] = last;
+        last->idx = ent->idx;
+        heap_up(pollfs, last->idx);
+        heap_down(pollfs, last->idx);
+    }
+
+    if(ent->file != NULL)
+        ent->file->poll = NULL;
+    else
+        ent->folder->poll = NULL;
+
+    free(ent);
+}
+
+// Feeds what inotify would have said about name in folder
+static void pollfs_event(pollfs_t *pollfs, folder_t *folder, uint32_t mask, uint32_t cookie, const char *name)
+{
+    struct inotify_event *event = &pollfs->ev.event;
+    size_t len = strlen(name);
+
+    if(len > NAME_MAX)
+        return;
+
+    event->wd = folder->wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = len + 1;
+    memcpy(event->name, name, len + 1);
+
+    if(pollfs->ta->trace != NULL)
+        trace_event(pollfs->ta->trace, event);
+
+    watching_event(pollfs->ta, event);
+    pollfs->events++;
+}
+
+// return
+//   1 : grew
+static int pollfs_check_file(pollfs_t *pollfs, pollfs_ent_t *ent)
+{
+    file_t *file = ent->file;
+    struct stat st;
+
+    // a file truncated ahead stays past its offset, only a write counts
+    if(fstat(file->fd, &st) < 0 || st.st_size <= file->offset ||
+            (st.st_size == ent->size && st.st_mtim.tv_sec == ent->mtime.tv_sec &&
+             st.st_mtim.tv_nsec == ent->mtime.tv_nsec))
+        return 0;
+
+    ent->size = st.st_size;
+    ent->mtime = st.st_mtim;
+
+    pollfs_event(pollfs, file->folder, IN_MODIFY, 0, file->name);
+
+    return 1;
+}
+
+// Lazy files have no descriptor, stat()ed by name with their folder
+static int pollfs_check_lazy(pollfs_t *pollfs, folder_t *folder)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    lazy_t *lazy, *next;
+    struct stat st;
+    int changed = 0;
+
+    for(lazy = folder->lazy_first; lazy != NULL; lazy = next)
+    {
+        next = lazy->next;
+
+        snprintf(buf, sizeof(buf), "%s%s", folder_path(folder), lazy->name);
+
+        if(stat(buf, &st) < 0)
+        {
+            pollfs_event(pollfs, folder, IN_DELETE, 0, lazy->name);
+            changed = 1;
+        }else if(st.st_size > 0 && !lazy->dirty)
+        {
+            pollfs_event(pollfs, folder, IN_MODIFY, 0, lazy->name);
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+static unsigned char pollfs_type(const char *dir, struct dirent *ent)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    struct stat st;
+
+    if(ent->d_type != DT_UNKNOWN)
+        return ent->d_type;
+
+    snprintf(buf, sizeof(buf), "%s%s", dir, ent->d_name);
+
+    if(lstat(buf, &st) < 0)
+        return DT_UNKNOWN;
+
+    if(S_ISDIR(st.st_mode))
+        return DT_DIR;
+    if(S_ISREG(st.st_mode))
+        return DT_REG;
+    if(S_ISLNK(st.st_mode))
+        return DT_LNK;
+
+    return DT_UNKNOWN;
+}
+
+// return
+//   1 : name is a tracked entry that is still the same inode, ino 0 for
+//       any inode
+static int pollfs_same(hashtable_t *names, const char *name, ino_t ino)
+{
+    hashtable_data_t *hdata = hashtable_get(names, name);
+    pollfs_name_t *n;
+
+    if(hdata == NULL)
+        return 0;
+
+    n = hdata->data;
+
+    // d_ino of a link is the link's own
+    if(ino != 0 && n->type != DT_LNK && n->ino != ino)
+        return 0;
+
+    n->used = 1;
+
+    return 1;
+}
+
+// Diffs the directory against the tree when its mtime moved. Renames are
+// paired by inode so a rotated file keeps its descriptor and offset.
+// return
+//   1 : changed
+static int pollfs_check_folder(pollfs_t *pollfs, pollfs_ent_t *ent)
+{
+    folder_t *folder = ent->folder, *child;
+    tailall_t *ta = pollfs->ta;
+    char path[MAX_DIR_NAME_LENGTH];
+    pollfs_name_t *names = NULL, *n;
+    pollfs_gone_t *gone = NULL, *g;
+    int nnames = 0, ngone = 0, size = 0, i, j, progress, changed;
+    hashtable_t *table;
+    struct dirent *dent;
+    struct stat st;
+    file_t *file;
+    DIR *dir;
+
+    changed = folder->lazy_first != NULL ? pollfs_check_lazy(pollfs, folder) : 0;
+
+    snprintf(path, sizeof(path), "%s", folder_path(folder));
+
+    if(stat(path, &st) < 0 ||
+            (st.st_mtim.tv_sec == ent->mtime.tv_sec && st.st_mtim.tv_nsec == ent->mtime.tv_nsec))
+        return changed;
+
+    ent->mtime = st.st_mtim;
+
+    dir = opendir(path);
+    if(dir == NULL)
+        return changed;
+
+    while((dent = readdir(dir)) != NULL)
+    {
+        if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        if(nnames == size)
+        {
+            size = size == 0 ? 64 : size * 2;
+            names = realloc(names, size * sizeof(pollfs_name_t));
+            assert(names != NULL);
+        }
+
+        n = &names[nnames++];
+        n->name = strdup(dent->d_name);
+        n->ino = dent->d_ino;
+        n->type = pollfs_type(path, dent);
+        n->used = 0;
+    }
+
+    closedir(dir);
+
+    // the array does not move any more
+    for(j = 4; hashsize(j) < nnames; j++);
+    table = hashtable_init(j, NULL);
+
+    for(i = 0; i < nnames; i++)
+        hashtable_set(table, hashtable_data_init(names[i].name, &names[i], NULL));
+
+    size = 0;
+
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        if(pollfs_same(table, file->name, file->ino))
+            continue;
+
+        if(ngone == size)
+        {
+            size = size == 0 ? 16 : size * 2;
+            gone = realloc(gone, size * sizeof(pollfs_gone_t));
+            assert(gone != NULL);
+        }
+
+        gone[ngone].file = file;
+        gone[ngone].folder = NULL;
+        gone[ngone++].to = NULL;
+    }
+
+    for(child = folder->child_first; child != NULL; child = child->next)
+    {
+        // a mount point shows the inode below the mount
+        if(pollfs_same(table, child->name, child->dev == folder->dev ? child->ino : 0))
+            continue;
+
+        if(ngone == size)
+        {
+            size = size == 0 ? 16 : size * 2;
+            gone = realloc(gone, size * sizeof(pollfs_gone_t));
+            assert(gone != NULL);
+        }
+
+        gone[ngone].file = NULL;
+        gone[ngone].folder = child;
+        gone[ngone++].to = NULL;
+    }
+
+    for(i = 0; i < nnames; i++)
+    {
+        if(!names[i].used && lazy_find(folder, names[i].name) != NULL)
+            names[i].used = 1;
+    }
+
+    // renamed, the same inode under a name nobody tracks
+    for(i = 0; i < ngone; i++)
+    {
+        g = &gone[i];
+
+        for(j = 0; j < nnames && g->to == NULL; j++)
+        {
+            n = &names[j];
+
+            if(!n->used && n->ino == (g->file != NULL ? g->file->ino : g->folder->ino) &&
+                    n->type == (g->file != NULL ? DT_REG : DT_DIR))
+            {
+                n->used = 1;
+                g->to = n;
+            }
+        }
+    }
+
+    // deleted first, their names may be taken by the renames
+    for(i = 0; i < ngone; i++)
+    {
+        g = &gone[i];
+
+        if(g->to != NULL)
+            continue;
+
+        if(g->file != NULL)
+            pollfs_event(pollfs, folder, IN_DELETE, 0, g->file->name);
+        else
+            pollfs_event(pollfs, folder, IN_DELETE | IN_ISDIR, 0, g->folder->name);
+
+        g->file = NULL;
+        g->folder = NULL;
+    }
+
+    // a rotation chain goes from its far end, log.1 to log.2 before log to log.1
+    do
+    {
+        progress = 0;
+
+        for(i = 0; i < ngone; i++)
+        {
+            g = &gone[i];
+
+            if(g->to == NULL || folder_find_file(folder, g->to->name) != NULL ||
+                    folder_find_child(folder, g->to->name) != NULL)
+                continue;
+
+            pollfs->cookie++;
+
+            if(g->file != NULL)
+            {
+                pollfs_event(pollfs, folder, IN_MOVED_FROM, pollfs->cookie, g->file->name);
+                pollfs_event(pollfs, folder, IN_MOVED_TO, pollfs->cookie, g->to->name);
+            }else
+            {
+                pollfs_event(pollfs, folder, IN_MOVED_FROM | IN_ISDIR, pollfs->cookie, g->folder->name);
+                pollfs_event(pollfs, folder, IN_MOVED_TO | IN_ISDIR, pollfs->cookie, g->to->name);
+            }
+
+            g->to = NULL;
+            progress = 1;
+        }
+    }while(progress);
+
+    // swapped names, read again from scratch
+    for(i = 0; i < ngone; i++)
+    {
+        g = &gone[i];
+
+        if(g->to == NULL)
+            continue;
+
+        g->to->used = 0;
+
+        if(g->file != NULL)
+            pollfs_event(pollfs, folder, IN_DELETE, 0, g->file->name);
+        else
+            pollfs_event(pollfs, folder, IN_DELETE | IN_ISDIR, 0, g->folder->name);
+    }
+
+    for(i = 0; i < nnames; i++)
+    {
+        n = &names[i];
+
+        if(n->used)
+            continue;
+
+        if(n->type == DT_DIR && is_valid_dirname(n->name))
+            pollfs_event(pollfs, folder, IN_CREATE | IN_ISDIR, 0, n->name);
+        else if(n->type == DT_REG || (n->type == DT_LNK && ta->follow))
+            pollfs_event(pollfs, folder, IN_CREATE, 0, n->name);
+    }
+
+    for(i = 0; i < nnames; i++)
+        free(names[i].name);
+
+    hashtable_free(table);
+    free(names);
+    free(gone);
+
+    return 1;
+}
+
+void pollfs_folder_del(pollfs_t *pollfs, folder_t *folder)
+{
+    assert(pollfs != NULL);
+    assert(folder != NULL);
+
+    pollfs_mount_t *mount;
+
+    if(folder->poll == NULL)
+        return;
+
+    // polled for its mount anyway
+    mount = pollfs_mount_find(pollfs, folder->dev);
+    if(mount != NULL && mount->poll)
+        return;
+
+    // what changed before the watch came is found by the last check, the
+    // watch sees the rest, twice does no harm
+    pollfs_retire(pollfs, folder, 1);
+}
+
+static void pollfs_timer_cb(loop_t *loop, void *arg)
+{
+    pollfs_t *pollfs = arg;
+    tailall_t *ta = pollfs->ta;
+    uint64_t now = loop_now_ms();
+    int budget = POLLFS_TICK_BUDGET, changed;
+    pollfs_ent_t *ent;
+
+    pollfs->events = 0;
+    ta->event_us = metrics_now_us();
+
+    // overdue entries beyond the budget wait for the next tick
+    while(pollfs->count > 0 && budget-- > 0)
+    {
+        ent = pollfs->heap[0];
+
+        if(ent->due > now)
+            break;
+
+        metric_inc(M_POLL_CHECKS);
+
+        if(ent->file != NULL)
+            changed = pollfs_check_file(pollfs, ent);
+        else
+            changed = pollfs_check_folder(pollfs, ent);
+
+        if(ent->retire)
+        {
+            pollfs_del(pollfs, ent);
+            continue;
+        }
+
+        if(changed)
+            ent->interval = POLLFS_MIN_INTERVAL;
+        else if(ent->interval < POLLFS_MAX_INTERVAL)
+            ent->interval = ent->interval * 2 < POLLFS_MAX_INTERVAL ? ent->interval * 2 : POLLFS_MAX_INTERVAL;
+
+        ent->due = now + ent->interval;
+        heap_down(pollfs, ent->idx);
+    }
+
+    if(ta->move_folder != NULL || ta->move_file != NULL || ta->move_lazy != NULL)
+        move_flush(ta);
+
+    if(ta->dirty_first != NULL)
+        lazy_flush(ta);
+
+    if(pollfs->events > 0)
+        metric_batch(pollfs->events);
+
+    ta->event_us = 0;
+}
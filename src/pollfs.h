@@ -0,0 +1,86 @@
+#ifndef _POLLFS_H_
+#define _POLLFS_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "tailall.h"
+
+#define POLLFS_TICK             20      // ms, timer period
+#define POLLFS_MIN_INTERVAL     100     // ms, an entry that just changed
+#define POLLFS_MAX_INTERVAL     5000    // ms, idle entries back off up to
+#define POLLFS_TICK_BUDGET      256     // checks per tick at most, the rest waits
+#define POLLFS_MAX_MOUNTS       64
+
+typedef struct _pollfs_ent pollfs_ent_t;
+typedef struct _pollfs_mount pollfs_mount_t;
+typedef struct _pollfs pollfs_t;
+
+// Hung on file->poll or folder->poll, one of file and folder is set.
+struct _pollfs_ent
+{
+    file_t              *file;
+    folder_t            *folder;
+    uint64_t            due;        // loop_now_ms()
+    int                 interval;   // ms, doubled while nothing changes
+    int                 idx;        // position in the heap
+    struct timespec     mtime;      // last seen
+    off_t               size;       // file, last seen
+    int                 retire;     // dropped after the next check, watched now
+};
+
+struct _pollfs_mount
+{
+    dev_t               dev;
+    int                 poll;       // 1 polled, 0 inotify only
+};
+
+struct _pollfs
+{
+    tailall_t           *ta;
+    int                 detect;     // poll network and FUSE mounts by itself
+    pollfs_ent_t        **heap;     // min-heap on due
+    int                 count;
+    int                 size;
+    pollfs_mount_t      mounts[POLLFS_MAX_MOUNTS];
+    int                 nmounts;
+    loop_timer_t        *timer;     // added with the first entry
+    uint64_t            events;     // synthesized in the current tick
+    uint32_t            cookie;
+    union
+    {
+        struct inotify_event event;
+        char            buf[EVENT_SIZE + NAME_MAX + 1];
+    } ev;
+};
+
+// inotify never fires for changes made by other hosts on NFS, CIFS or by
+// a FUSE daemon. Folders and files on such mounts are stat()ed instead and
+// every change found is turned into the inotify event it would have been,
+// fed to watching_event(), so the rest is the same. Each entry is checked
+// again after an interval which is reset on a change and doubled while
+// idle, at most POLLFS_TICK_BUDGET per tick.
+pollfs_t*       pollfs_init(tailall_t *ta, int detect);
+void            pollfs_free(pollfs_t *pollfs);
+
+// Polls the mount path lives on whatever its type
+// return
+//   0  : Success
+//  -1  : Error
+int             pollfs_force(pollfs_t *pollfs, const char *path);
+
+void            pollfs_folder_add(pollfs_t *pollfs, folder_t *folder);
+// force, polled whatever its mount, with the files it has
+void            pollfs_folder_add2(pollfs_t *pollfs, folder_t *folder, int force);
+// Drops a forced folder and its files after a last check, unless their
+// mount is polled anyway
+void            pollfs_folder_del(pollfs_t *pollfs, folder_t *folder);
+void            pollfs_file_add(pollfs_t *pollfs, file_t *file);
+// After lost events, folder and the tree below it are diffed and their
+// files read on the next ticks, folders polled for this only dropped after
+void            pollfs_rescan(pollfs_t *pollfs, folder_t *folder);
+void            pollfs_del(pollfs_t *pollfs, pollfs_ent_t *ent);
+
+#endif // _POLLFS_H_
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+size_t scan_count(const char *buf, size_t len, char c)
+{
+    size_t n = 0, i = 0;
+
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi8(c);
+
+    for(; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        n += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(c);
+
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        n += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+#endif
+
+    for(; i < len; i++)
+    {
+        if(buf[i] == c)
+            n++;
+    }
+
+    return n;
+}
+
+size_t scan_binary(const char *buf, size_t len)
+{
+    size_t n = 0, i = 0;
+    unsigned char b;
+
+#if defined(__AVX2__)
+    const __m256i c1f = _mm256_set1_epi8(0x1f), c09 = _mm256_set1_epi8(0x09);
+    const __m256i c04 = _mm256_set1_epi8(0x04), esc = _mm256_set1_epi8(0x1b);
+
+    for(; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i t = _mm256_sub_epi8(v, c09);
+
+        // v <= 0x1f unsigned, less 0x09 .. 0x0d and ESC
+        __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, c1f), v);
+        __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, c04), t), _mm256_cmpeq_epi8(v, esc));
+
+        n += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_andnot_si256(ok, ctrl)));
+    }
+#elif defined(__SSE2__)
+    const __m128i c1f = _mm_set1_epi8(0x1f), c09 = _mm_set1_epi8(0x09);
+    const __m128i c04 = _mm_set1_epi8(0x04), esc = _mm_set1_epi8(0x1b);
+
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i t = _mm_sub_epi8(v, c09);
+
+        // v <= 0x1f unsigned, less 0x09 .. 0x0d and ESC
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, c1f), v);
+        __m128i ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, c04), t), _mm_cmpeq_epi8(v, esc));
+
+        n += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_andnot_si128(ok, ctrl)));
+    }
+#endif
+
+    for(; i < len; i++)
+    {
+        b = (unsigned char)buf[i];
+
+        if(b < 0x20 && (b < 0x09 || b > 0x0d) && b != 0x1b)
+            n++;
+    }
+
+    return n;
+}
+
+size_t scan_zero_lead(const char *buf, size_t len)
+{
+    size_t i = 0;
+    uint64_t w;
+
+    for(; i + 8 <= len; i += 8)
+    {
+        memcpy(&w, buf + i, 8);
+        if(w != 0)
+            break;
+    }
+
+    for(; i < len && buf[i] == '\0'; i++);
+
+    return i;
+}
+
+size_t scan_zero_tail(const char *buf, size_t len)
+{
+    size_t i = len;
+    uint64_t w;
+
+    for(; i >= 8; i -= 8)
+    {
+        memcpy(&w, buf + i - 8, 8);
+        if(w != 0)
+            break;
+    }
+
+    for(; i > 0 && buf[i - 1] == '\0'; i--);
+
+    return len - i;
+}
@@ -0,0 +1,26 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
+
+// Number of bytes equal to c, vectorised on x86_64.
+size_t          scan_count(const char *buf, size_t len, char c);
+
+// Number of bytes text does not have: NUL and the other C0 controls but
+// \t \n \v \f \r and ESC (colours). UTF-8 passes. Vectorised on x86_64.
+size_t          scan_binary(const char *buf, size_t len);
+
+// Number of NUL bytes buf starts / ends with, a word at a time.
+size_t          scan_zero_lead(const char *buf, size_t len);
+size_t          scan_zero_tail(const char *buf, size_t len);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif // _SCAN_H_
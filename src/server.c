@@ -0,0 +1,548 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "stats.h"
+
+static void server_client_cb(loop_t *loop, int fd, short revents, void *arg);
+
+chunk_t* chunk_init(const char *buf, size_t len)
+{
+    chunk_t *chunk = malloc(sizeof(chunk_t) + len);
+
+    if(chunk == NULL)
+        return NULL;
+
+    chunk->refcnt = 1;
+    chunk->len = len;
+    memcpy(chunk->data, buf, len);
+
+    return chunk;
+}
+
+void chunk_ref(chunk_t *chunk)
+{
+    chunk->refcnt++;
+}
+
+void chunk_unref(chunk_t *chunk)
+{
+    if(--chunk->refcnt == 0)
+        free(chunk);
+}
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if(flags < 0)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void server_client_free(server_client_t *client)
+{
+    server_t *server = client->server;
+    server_sub_t *sub, *sub2;
+    server_qent_t *qent, *qent2;
+
+    debugfn("server client %d closed", client->fd);
+
+    loop_del_fd(server->ta->loop, client->fd);
+    close(client->fd);
+
+    for(sub = client->subs; sub != NULL; sub = sub2)
+    {
+        sub2 = sub->next;
+        free(sub->pattern);
+        free(sub);
+    }
+
+    for(qent = client->qhead; qent != NULL; qent = qent2)
+    {
+        qent2 = qent->next;
+        chunk_unref(qent->chunk);
+        free(qent);
+    }
+
+    if(client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        server->clients = client->next;
+
+    if(client->next != NULL)
+        client->next->prev = client->prev;
+
+    server->client_count--;
+
+    free(client);
+}
+
+static void server_client_push(server_client_t *client, chunk_t *chunk)
+{
+    server_qent_t *qent = malloc(sizeof(server_qent_t));
+    assert(qent != NULL);
+
+    chunk_ref(chunk);
+    qent->chunk = chunk;
+    qent->off = 0;
+    qent->next = NULL;
+
+    if(client->qtail == NULL)
+        client->qhead = client->qtail = qent;
+    else
+        client->qtail = client->qtail->next = qent;
+
+    client->queued += chunk->len;
+}
+
+// return
+//   0 : Success (possibly with data still queued)
+//  -1 : client is gone and has been freed
+static int server_client_flush(server_client_t *client)
+{
+    struct iovec iov[SERVER_CLIENT_IOV];
+    server_qent_t *qent;
+    ssize_t ret;
+    int cnt;
+
+    while(client->qhead != NULL)
+    {
+        for(cnt = 0, qent = client->qhead; qent != NULL && cnt < SERVER_CLIENT_IOV; qent = qent->next, cnt++)
+        {
+            iov[cnt].iov_base = qent->chunk->data + qent->off;
+            iov[cnt].iov_len = qent->chunk->len - qent->off;
+        }
+
+        ret = writev(client->fd, iov, cnt);
+        metric_inc(M_SYS_WRITE);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                loop_mod_fd(client->server->ta->loop, client->fd, POLLIN | POLLOUT);
+                return 0;
+            }
+
+            server_client_free(client);
+            return -1;
+        }
+
+        metric_add(M_BYTES_WRITTEN, ret);
+        client->queued -= ret;
+
+        while((qent = client->qhead) != NULL && (size_t)ret >= qent->chunk->len - qent->off)
+        {
+            ret -= qent->chunk->len - qent->off;
+            client->qhead = qent->next;
+            chunk_unref(qent->chunk);
+            free(qent);
+        }
+
+        if(client->qhead == NULL)
+        {
+            client->qtail = NULL;
+        }else
+        {
+            client->qhead->off += ret;
+        }
+    }
+
+    loop_mod_fd(client->server->ta->loop, client->fd, POLLIN);
+
+    // drained, tell the client what it has missed
+    if(client->dropped > 0)
+    {
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf), "\n# tailall: %llu bytes dropped, client too slow\n",
+                (unsigned long long)client->dropped);
+        chunk_t *chunk = chunk_init(buf, len);
+        assert(chunk != NULL);
+
+        client->dropped = 0;
+        client->last_file_id = 0;
+        server_client_push(client, chunk);
+        chunk_unref(chunk);
+
+        return server_client_flush(client);
+    }
+
+    return 0;
+}
+
+static void server_client_line(server_client_t *client, char *line)
+{
+    server_sub_t *sub;
+    char *arg;
+    int glob;
+
+    if(strncmp(line, "prefix", 6) == 0 && (line[6] == ' ' || line[6] == '\0'))
+    {
+        glob = 0;
+        arg = line[6] ? line + 7 : line + 6;
+    }else if(strncmp(line, "glob ", 5) == 0)
+    {
+        glob = 1;
+        arg = line + 5;
+    }else if(strcmp(line, "stats") == 0)
+    {
+        char buf[STATS_BUF_SIZE];
+        chunk_t *chunk = chunk_init(buf, stats_format(client->server->ta, buf, sizeof(buf)));
+        assert(chunk != NULL);
+
+        // written on the next POLLOUT, flushing here could free the client
+        client->last_file_id = 0;
+        server_client_push(client, chunk);
+        chunk_unref(chunk);
+        loop_mod_fd(client->server->ta->loop, client->fd, POLLIN | POLLOUT);
+        return;
+    }else if(strcmp(line, "clear") == 0)
+    {
+        server_sub_t *sub2;
+
+        for(sub = client->subs; sub != NULL; sub = sub2)
+        {
+            sub2 = sub->next;
+            free(sub->pattern);
+            free(sub);
+        }
+        client->subs = NULL;
+        return;
+    }else
+    {
+        warnfn("server client %d unknown request '%s'", client->fd, line);
+        return;
+    }
+
+    sub = calloc(sizeof(server_sub_t), 1);
+    assert(sub != NULL);
+
+    sub->glob = glob;
+    sub->pattern = strdup(arg);
+    sub->len = strlen(arg);
+    sub->next = client->subs;
+    client->subs = sub;
+
+    debugfn("server client %d subscribed %s %s", client->fd, glob ? "glob" : "prefix", arg);
+}
+
+static void server_client_read(server_client_t *client)
+{
+    ssize_t ret;
+    char *line, *eol;
+
+    ret = read(client->fd, client->rbuf + client->rlen, SERVER_LINE_MAX - client->rlen);
+
+    if(ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        server_client_free(client);
+        return;
+    }
+
+    if(ret < 0)
+        return;
+
+    client->rlen += ret;
+    line = client->rbuf;
+
+    while((eol = memchr(line, '\n', client->rlen - (line - client->rbuf))) != NULL)
+    {
+        *eol = '\0';
+        server_client_line(client, line);
+        line = eol + 1;
+    }
+
+    client->rlen -= line - client->rbuf;
+    memmove(client->rbuf, line, client->rlen);
+
+    if(client->rlen == SERVER_LINE_MAX)
+    {
+        warnfn("server client %d request line too long", client->fd);
+        server_client_free(client);
+    }
+}
+
+static void server_client_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    server_client_t *client = arg;
+
+    if(revents & POLLOUT)
+    {
+        if(server_client_flush(client) < 0)
+            return;
+    }
+
+    if(revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        server_client_read(client);
+    }
+}
+
+static void server_accept_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    server_t *server = arg;
+    server_client_t *client;
+    int cfd;
+
+    while((cfd = accept(fd, NULL, NULL)) >= 0)
+    {
+        set_nonblock(cfd);
+
+        client = calloc(sizeof(server_client_t), 1);
+        assert(client != NULL);
+
+        client->server = server;
+        client->fd = cfd;
+        client->next = server->clients;
+
+        if(server->clients != NULL)
+            server->clients->prev = client;
+
+        server->clients = client;
+        server->client_count++;
+
+        loop_add_fd(loop, cfd, POLLIN, server_client_cb, client);
+
+        debugfn("server client %d connected", cfd);
+    }
+
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        warnfn("accept() %s", strerror(errno));
+    }
+}
+
+server_t* server_init(tailall_t *ta, const char *path)
+{
+    assert(ta != NULL);
+    assert(path != NULL);
+
+    struct sockaddr_un addr;
+    struct stat st;
+    server_t *server;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        errfn("Socket path too long %s", path);
+        return NULL;
+    }
+
+    // stale socket of a previous run
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        errfn("socket() %s", strerror(errno));
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SERVER_BACKLOG) < 0)
+    {
+        errfn("%s %s", strerror(errno), path);
+        close(fd);
+        return NULL;
+    }
+
+    set_nonblock(fd);
+
+    server = calloc(sizeof(server_t), 1);
+    assert(server != NULL);
+
+    server->ta = ta;
+    server->fd = fd;
+    server->path = strdup(path);
+    server->queue_limit = SERVER_QUEUE_LIMIT;
+
+    loop_add_fd(ta->loop, fd, POLLIN, server_accept_cb, server);
+
+    return server;
+}
+
+void server_free(server_t *server)
+{
+    if(server == NULL)
+        return;
+
+    while(server->clients != NULL)
+        server_client_free(server->clients);
+
+    loop_del_fd(server->ta->loop, server->fd);
+    close(server->fd);
+    unlink(server->path);
+    free(server->path);
+    free(server);
+}
+
+static int server_client_match(server_client_t *client, const char *path, size_t len)
+{
+    server_sub_t *sub;
+
+    for(sub = client->subs; sub != NULL; sub = sub->next)
+    {
+        if(sub->glob)
+        {
+            if(fnmatch(sub->pattern, path, 0) == 0)
+                return 1;
+        }else
+        {
+            if(sub->len <= len && memcmp(sub->pattern, path, sub->len) == 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+// One copy of buf into a shared chunk, then fan out by reference.
+int sink_server(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    server_t *server = ta->sink_data;
+    server_client_t *client, *next;
+    chunk_t *chunk = NULL, *header = NULL;
+    char path[MAX_DIR_NAME_LENGTH];
+    size_t plen;
+
+    if(server->clients == NULL)
+        return len;
+
+    file_prefix(file);
+    plen = file->prefix_len - 2;
+    memcpy(path, file->prefix, plen);
+    path[plen] = '\0';
+
+    for(client = server->clients; client != NULL; client = next)
+    {
+        next = client->next;
+
+        if(!server_client_match(client, path, plen))
+            continue;
+
+        if(client->queued + len > server->queue_limit)
+        {
+            client->dropped += len;
+            continue;
+        }
+
+        if(client->last_file_id != file->id)
+        {
+            if(header == NULL)
+            {
+                char hbuf[MAX_DIR_NAME_LENGTH + 8];
+                int hlen = snprintf(hbuf, sizeof(hbuf), " \n# %s\n", path);
+
+                header = chunk_init(hbuf, hlen);
+                assert(header != NULL);
+            }
+
+            server_client_push(client, header);
+            client->last_file_id = file->id;
+        }
+
+        if(chunk == NULL)
+        {
+            chunk = chunk_init(buf, len);
+            assert(chunk != NULL);
+        }
+
+        server_client_push(client, chunk);
+        server_client_flush(client);
+    }
+
+    if(header != NULL)
+        chunk_unref(header);
+
+    if(chunk != NULL)
+        chunk_unref(chunk);
+
+    return len;
+}
+
+int client_run(const char *path, int subc, char **subv)
+{
+    assert(path != NULL);
+
+    struct sockaddr_un addr;
+    char buf[FILE_BUF_SIZE];
+    ssize_t ret, off, w;
+    int fd, i;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        errfn("socket() %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        errfn("%s %s", strerror(errno), path);
+        close(fd);
+        return -1;
+    }
+
+    // no arguments : everything
+    if(subc == 0)
+    {
+        ret = write(fd, "prefix\n", 7);
+    }
+
+    for(i = 0; i < subc; i++)
+    {
+        int len = snprintf(buf, sizeof(buf), "%s %s\n", strpbrk(subv[i], "*?[") ? "glob" : "prefix", subv[i]);
+        ret = write(fd, buf, len);
+    }
+
+    while((ret = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            errfn("read() %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        for(off = 0; off < ret; off += w)
+        {
+            w = write(STDOUT_FILENO, buf + off, ret - off);
+            if(w < 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tailall.h"
+
+#define SERVER_BACKLOG              64
+#define SERVER_LINE_MAX             4096
+#define SERVER_CLIENT_IOV           64
+#define SERVER_QUEUE_LIMIT          (8*1024*1024)   // per client
+
+typedef struct _chunk chunk_t;
+typedef struct _server_sub server_sub_t;
+typedef struct _server_qent server_qent_t;
+typedef struct _server_client server_client_t;
+typedef struct _server server_t;
+
+// Read once, shared by every client it is queued on.
+struct _chunk
+{
+    int                 refcnt;
+    size_t              len;
+    char                data[];
+};
+
+struct _server_sub
+{
+    int                 glob;       // 1 : fnmatch() pattern, 0 : path prefix
+    char                *pattern;
+    size_t              len;
+    server_sub_t        *next;
+};
+
+struct _server_qent
+{
+    chunk_t             *chunk;
+    size_t              off;        // already written
+    server_qent_t       *next;
+};
+
+struct _server_client
+{
+    server_t            *server;
+    int                 fd;
+    server_sub_t        *subs;
+    server_qent_t       *qhead;
+    server_qent_t       *qtail;
+    size_t              queued;     // bytes not yet written
+    uint64_t            dropped;    // bytes dropped by backpressure
+    uint64_t            last_file_id;
+    size_t              rlen;
+    char                rbuf[SERVER_LINE_MAX];
+    server_client_t     *next;
+    server_client_t     *prev;
+};
+
+struct _server
+{
+    tailall_t           *ta;
+    int                 fd;
+    char                *path;
+    size_t              queue_limit;
+    int                 client_count;
+    server_client_t     *clients;
+};
+
+chunk_t*        chunk_init(const char *buf, size_t len);
+void            chunk_ref(chunk_t *chunk);
+void            chunk_unref(chunk_t *chunk);
+
+server_t*       server_init(tailall_t *ta, const char *path);
+void            server_free(server_t *server);
+int             sink_server(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+// Client side: subscribe and copy everything to stdout until EOF.
+// return
+//   0 : server closed the connection
+//  -1 : Error
+int             client_run(const char *path, int subc, char **subv);
+
+#endif // _SERVER_H_
@@ -0,0 +1,259 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "stats.h"
+#include "pollfs.h"
+#include "budget.h"
+
+static const char *event_names[] =
+{
+    "create", "delete", "delete_self", "modify", "close_write",
+    "moved_from", "moved_to", "move_self", "overflow", "other", "unknown_wd"
+};
+
+static const struct
+{
+    METRIC_COUNTER  id;
+    const char      *name;
+} syscall_names[] =
+{
+    { M_SYS_READ,               "read" },
+    { M_SYS_WRITE,              "write" },
+    { M_SYS_OPEN,               "open" },
+    { M_SYS_LSEEK,              "lseek" },
+    { M_SYS_COPY_FILE_RANGE,    "copy_file_range" },
+    { M_SYS_INOTIFY_READ,       "inotify_read" },
+    { M_SYS_INOTIFY_ADD_WATCH,  "inotify_add_watch" },
+    { M_SYS_FANOTIFY_READ,      "fanotify_read" },
+};
+
+static int count_fds()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *ent;
+    int n = 0;
+
+    if(dir == NULL)
+        return -1;
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        if(ent->d_name[0] != '.')
+            n++;
+    }
+
+    closedir(dir);
+
+    // the one opendir() holds
+    return n - 1;
+}
+
+#define fmt(...) \
+    do { if(len < size) len += snprintf(buf + len, size - len, __VA_ARGS__); } while(0)
+
+int stats_format(tailall_t *ta, char *buf, size_t size)
+{
+    metrics_t m;
+    size_t len = 0;
+    uint64_t cum;
+    int i;
+
+    metrics_collect(&m);
+
+    fmt("# TYPE tailall_inotify_events_total counter\n");
+    for(i = 0; i <= M_EV_UNKNOWN_WD; i++)
+        fmt("tailall_inotify_events_total{type=\"%s\"} %llu\n", event_names[i], (unsigned long long)m.counter[i]);
+
+    fmt("# TYPE tailall_bytes_read_total counter\n");
+    fmt("tailall_bytes_read_total %llu\n", (unsigned long long)m.counter[M_BYTES_READ]);
+    fmt("# TYPE tailall_bytes_written_total counter\n");
+    fmt("tailall_bytes_written_total %llu\n", (unsigned long long)m.counter[M_BYTES_WRITTEN]);
+
+    fmt("# TYPE tailall_syscalls_total counter\n");
+    for(i = 0; i < (int)(sizeof(syscall_names) / sizeof(syscall_names[0])); i++)
+        fmt("tailall_syscalls_total{call=\"%s\"} %llu\n", syscall_names[i].name, (unsigned long long)m.counter[syscall_names[i].id]);
+
+    fmt("# TYPE tailall_tailing_total counter\n");
+    fmt("tailall_tailing_total %llu\n", (unsigned long long)m.counter[M_TAILING]);
+    fmt("# TYPE tailall_stalls_total counter\n");
+    fmt("tailall_stalls_total %llu\n", (unsigned long long)m.counter[M_STALLS]);
+    fmt("# TYPE tailall_lazy_dropped_total counter\n");
+    fmt("tailall_lazy_dropped_total %llu\n", (unsigned long long)m.counter[M_LAZY_DROPPED]);
+    fmt("# TYPE tailall_poll_checks_total counter\n");
+    fmt("tailall_poll_checks_total %llu\n", (unsigned long long)m.counter[M_POLL_CHECKS]);
+    fmt("# TYPE tailall_binary_files_total counter\n");
+    fmt("tailall_binary_files_total %llu\n", (unsigned long long)m.counter[M_BINARY_FILES]);
+    fmt("# TYPE tailall_binary_skipped_bytes_total counter\n");
+    fmt("tailall_binary_skipped_bytes_total %llu\n", (unsigned long long)m.counter[M_BINARY_BYTES]);
+    fmt("# TYPE tailall_zero_skipped_bytes_total counter\n");
+    fmt("tailall_zero_skipped_bytes_total %llu\n", (unsigned long long)m.counter[M_ZERO_BYTES]);
+    fmt("# TYPE tailall_multiline_flushes_total counter\n");
+    fmt("tailall_multiline_flushes_total{why=\"idle\"} %llu\n", (unsigned long long)m.counter[M_MULTILINE_IDLE]);
+    fmt("tailall_multiline_flushes_total{why=\"full\"} %llu\n", (unsigned long long)m.counter[M_MULTILINE_FULL]);
+    fmt("# TYPE tailall_dedup_lines_total counter\n");
+    fmt("tailall_dedup_lines_total %llu\n", (unsigned long long)m.counter[M_DEDUP_LINES]);
+    fmt("# TYPE tailall_dedup_bytes_total counter\n");
+    fmt("tailall_dedup_bytes_total %llu\n", (unsigned long long)m.counter[M_DEDUP_BYTES]);
+    fmt("# TYPE tailall_budget_moves_total counter\n");
+    fmt("tailall_budget_moves_total{to=\"watch\"} %llu\n", (unsigned long long)m.counter[M_BUDGET_PROMOTED]);
+    fmt("tailall_budget_moves_total{to=\"poll\"} %llu\n", (unsigned long long)m.counter[M_BUDGET_DEMOTED]);
+
+    fmt("# TYPE tailall_files gauge\n");
+    fmt("tailall_files %llu\n", (unsigned long long)ta->file_count);
+    fmt("# TYPE tailall_lazy_files gauge\n");
+    fmt("tailall_lazy_files %llu\n", (unsigned long long)ta->lazy_count);
+    fmt("# TYPE tailall_poll_entries gauge\n");
+    fmt("tailall_poll_entries %d\n", ta->pollfs != NULL ? ((pollfs_t *)ta->pollfs)->count : 0);
+    fmt("# TYPE tailall_inotify_watches gauge\n");
+    fmt("tailall_inotify_watches %d\n", ta->budget != NULL ? ((budget_t *)ta->budget)->used : 0);
+    fmt("# TYPE tailall_polled_folders gauge\n");
+    fmt("tailall_polled_folders %d\n", ta->budget != NULL ? ((budget_t *)ta->budget)->demoted : 0);
+    fmt("# TYPE tailall_folders gauge\n");
+    fmt("tailall_folders %llu\n", (unsigned long long)ta->folder_table->data_count);
+    fmt("# TYPE tailall_open_fds gauge\n");
+    fmt("tailall_open_fds %d\n", count_fds());
+    fmt("# TYPE tailall_table_load_factor gauge\n");
+    fmt("tailall_table_load_factor{table=\"folder\"} %.4f\n",
+            (double)ta->folder_table->data_count / hashsize(ta->folder_table->power));
+
+    fmt("# TYPE tailall_inotify_batch_events histogram\n");
+    for(i = 0, cum = 0; i < METRIC_BATCH_BUCKETS; i++)
+    {
+        cum += m.batch[i];
+        if(i == METRIC_BATCH_BUCKETS - 1)
+            fmt("tailall_inotify_batch_events_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cum);
+        else
+            fmt("tailall_inotify_batch_events_bucket{le=\"%llu\"} %llu\n", 1ULL << i, (unsigned long long)cum);
+    }
+    fmt("tailall_inotify_batch_events_sum %llu\n", (unsigned long long)m.batch_sum);
+    fmt("tailall_inotify_batch_events_count %llu\n", (unsigned long long)cum);
+
+    fmt("# TYPE tailall_event_to_output_seconds histogram\n");
+    for(i = 0, cum = 0; i < METRIC_LATENCY_BUCKETS; i++)
+    {
+        cum += m.latency[i];
+        if(i == METRIC_LATENCY_BUCKETS - 1)
+            fmt("tailall_event_to_output_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cum);
+        else
+            fmt("tailall_event_to_output_seconds_bucket{le=\"%g\"} %llu\n", (double)(1ULL << i) / 1e6, (unsigned long long)cum);
+    }
+    fmt("tailall_event_to_output_seconds_sum %.6f\n", (double)m.latency_sum / 1e6);
+    fmt("tailall_event_to_output_seconds_count %llu\n", (unsigned long long)cum);
+
+    return len < size ? (int)len : (int)size - 1;
+}
+
+#undef fmt
+
+int stats_dump(stats_t *stats)
+{
+    char buf[STATS_BUF_SIZE], tmp[MAX_DIR_NAME_LENGTH];
+    int len, fd;
+    ssize_t ret;
+
+    len = stats_format(stats->ta, buf, sizeof(buf));
+
+    if(stats->path == NULL)
+    {
+        ret = write(STDERR_FILENO, buf, len);
+        return ret < 0 ? -1 : 0;
+    }
+
+    // scrapers never see a half written file
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats->path);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        warnfn("%s %s", strerror(errno), tmp);
+        return -1;
+    }
+
+    ret = write(fd, buf, len);
+    close(fd);
+
+    if(ret != len || rename(tmp, stats->path) < 0)
+    {
+        warnfn("%s %s", strerror(errno), stats->path);
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void stats_signal_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    struct signalfd_siginfo si;
+
+    while(read(fd, &si, sizeof(si)) == sizeof(si))
+        ;
+
+    stats_dump((stats_t *)arg);
+}
+
+static void stats_timer_cb(loop_t *loop, void *arg)
+{
+    stats_dump((stats_t *)arg);
+}
+
+stats_t* stats_init(tailall_t *ta, const char *path)
+{
+    assert(ta != NULL);
+
+    stats_t *stats;
+    sigset_t mask;
+
+    stats = calloc(sizeof(stats_t), 1);
+    assert(stats != NULL);
+
+    stats->ta = ta;
+    stats->path = path != NULL ? strdup(path) : NULL;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    stats->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(stats->sigfd < 0)
+    {
+        warnfn("signalfd() %s, no SIGUSR1 dump", strerror(errno));
+    }else
+    {
+        loop_add_fd(ta->loop, stats->sigfd, POLLIN, stats_signal_cb, stats);
+    }
+
+    if(stats->path != NULL)
+        stats->timer = loop_add_timer(ta->loop, STATS_INTERVAL, stats_timer_cb, stats);
+
+    return stats;
+}
+
+void stats_free(stats_t *stats)
+{
+    if(stats == NULL)
+        return;
+
+    if(stats->sigfd >= 0)
+    {
+        loop_del_fd(stats->ta->loop, stats->sigfd);
+        close(stats->sigfd);
+    }
+
+    if(stats->timer != NULL)
+    {
+        stats_dump(stats);
+        loop_del_timer(stats->ta->loop, stats->timer);
+    }
+
+    free(stats->path);
+    free(stats);
+}
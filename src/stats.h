@@ -0,0 +1,32 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "tailall.h"
+#include "metrics.h"
+
+#define STATS_INTERVAL      1000            // ms, stats file refresh
+#define STATS_BUF_SIZE      (1024*16)
+
+typedef struct _stats stats_t;
+
+struct _stats
+{
+    tailall_t           *ta;
+    char                *path;      // NULL : SIGUSR1 dumps to stderr
+    int                 sigfd;
+    loop_timer_t        *timer;
+};
+
+// Installs the SIGUSR1 dump, and a periodic stats file when path is set.
+// SIGUSR1 is blocked for the calling thread only, threads started before
+// have to block it themselves, main() does before any.
+stats_t*        stats_init(tailall_t *ta, const char *path);
+void            stats_free(stats_t *stats);
+int             stats_dump(stats_t *stats);
+
+// Prometheus text exposition format
+// return
+//   length written, without '\0'
+int             stats_format(tailall_t *ta, char *buf, size_t size);
+
+#endif // _STATS_H_
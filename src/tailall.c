@@ -5,6 +5,7 @@
  * URL      : https://github.com/jinoos/tailall
  */
 
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,104 +20,182 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <signal.h>
+#include <fnmatch.h>
 
 #include "tailall.h"
+#include "metrics.h"
+#include "trace.h"
+#include "follow.h"
+#include "pollfs.h"
+#include "fanwatch.h"
+#include "budget.h"
+#include "multiline.h"
+#include "dedup.h"
+#include "scan.h"
 
-int main( int argc, char **argv )
+char* intdup(const int i)
+{
+    char buf[37];
+    sprintf(buf, "int-%d", i);
+    return strdup(buf);
+}
+
+tailall_t* tailall_init(const char *path, tailall_sink_t sink)
 {
-    char dir[MAX_DIR_NAME_LENGTH]; /* monitoring directory name */
-    int fd, ret;
-    struct stat stat;
-    tailall_t *ta;
+    tailall_t       *ta;
 
-    int verbose;
+    int             inotify_fd;
 
-    fd = inotify_init();
+    folder_table_t  *folder_table;
 
-    if(fd < 0)
+    // the only one, every root shares it
+    inotify_fd = inotify_init();
+    if(inotify_fd < 0)
     {
         errfn("inotify_init(), %s", strerror(errno));
-        exit(-1);
+        return NULL;
     }
 
-    if(argc < 2)
-    {
-        debugfn("Watching under current directory");
-        strcpy (dir, "./");
-    }else
-    {
-        debugfn("Watching '%s' directory", argv[1]);
-        strcpy (dir, argv[1]);
-    }
+    folder_table = folder_table_init(FOLDER_TABLE_DEFAULT_POWER);
+    assert(folder_table != NULL);
 
-    ret = lstat(dir, &stat);
-    if(ret < 0)
-    {
-        errfn("%s %s", strerror(errno), dir);
+    ta = calloc(sizeof(tailall_t), 1);
+    assert(ta != NULL);
+
+    ta->inotify = inotify_fd;
+    ta->folder_table = folder_table;
+    ta->loop = loop_init();
+    assert(ta->loop != NULL);
+    ta->sink = sink;
+    ta->out = output_init(STDOUT_FILENO);
+    assert(ta->out != NULL);
+    ta->lazy_table = hashtable_init(LAZY_TABLE_DEFAULT_POWER, NULL);
+    assert(ta->lazy_table != NULL);
+    ta->last_tailing_file = NULL;
+    ta->open_line_file = NULL;
+    ta->tailing_count = 0;
+    ta->pseudo_wd = -1;
+    ta->wake = -1;
+
+    if(path != NULL && tailall_add_root(ta, path, NULL, NULL) == NULL)
         exit(-1);
+    
+    return ta;
+}
+
+root_t* tailall_add_root(tailall_t *ta, const char *path, const char *label, const char *filter)
+{
+    assert(ta != NULL);
+    assert(path != NULL);
+
+    root_t *root;
+    struct stat st;
+    size_t len = strlen(path);
+    int i;
+
+    if(stat(path, &st) < 0)
+    {
+        errfn("%s %s", strerror(errno), path);
+        return NULL;
     }
 
-    if(S_ISDIR(stat.st_mode))
+    for(i = 0; i < ta->nroots; i++)
     {
-        if(dir[(strlen(dir)-1)] != '/')
+        if(ta->roots[i].dev == st.st_dev && ta->roots[i].ino == st.st_ino)
         {
-            strcat(dir, "/");
+            warnfn("Ignored, %s is the same directory as %s", path, ta->roots[i].path);
+            return NULL;
         }
+    }
 
-        ta = tailall_init(dir);
+    if(ta->nroots == TAILALL_MAX_ROOTS)
+    {
+        errfn("Too many directories, %d at most", TAILALL_MAX_ROOTS);
+        return NULL;
+    }
 
-        ret = scan_dir(ta, dir);
+    root = &ta->roots[ta->nroots++];
+    root->path = malloc(len + 2);
+    assert(root->path != NULL);
+    sprintf(root->path, "%s%s", path, len > 0 && path[len - 1] == '/' ? "" : "/");
+    root->label = label != NULL && *label != '\0' ? strdup(label) : NULL;
+    root->filter = filter != NULL && *filter != '\0' ? strdup(filter) : NULL;
+    root->dev = st.st_dev;
+    root->ino = st.st_ino;
 
-        watching(ta);
+    if(ta->path == NULL)
+        ta->path = root->path;
 
-        exit(0);
-    }else if(S_ISREG(stat.st_mode))
-    {
-        errfn("Not allow to tail just a file. %s", dir);
-        help();
-        exit(-1);
-    }else
+    return root;
+}
+
+// return
+//   the root directory path is, NULL if none
+static root_t* root_find(tailall_t *ta, const char *path)
+{
+    struct stat st;
+    int i;
+
+    if(stat(path, &st) < 0)
+        return NULL;
+
+    for(i = 0; i < ta->nroots; i++)
     {
-        help();
-        exit(-1);
+        if(ta->roots[i].dev == st.st_dev && ta->roots[i].ino == st.st_ino)
+            return &ta->roots[i];
     }
 
-    return 0;
+    return NULL;
 }
 
-char* intdup(const int i)
+void tailall_stall(tailall_t *ta, file_t *file)
 {
-    char buf[37];
-    sprintf(buf, "int-%d", i);
-    return strdup(buf);
+    if(file->stalled)
+        return;
+
+    file->stalled = 1;
+    metric_inc(M_STALLS);
+    file->stall_prev = NULL;
+    file->stall_next = ta->stall_first;
+
+    if(ta->stall_first != NULL)
+        ta->stall_first->stall_prev = file;
+
+    ta->stall_first = file;
 }
 
-tailall_t* tailall_init(const char *path)
+void tailall_unstall(tailall_t *ta, file_t *file)
 {
-    assert(path != NULL);
+    if(!file->stalled)
+        return;
 
-    tailall_t       *ta;
+    if(file->stall_prev != NULL)
+        file->stall_prev->stall_next = file->stall_next;
+    else
+        ta->stall_first = file->stall_next;
 
-    int             inotify_fd;
+    if(file->stall_next != NULL)
+        file->stall_next->stall_prev = file->stall_prev;
 
-    folder_table_t  *folder_table;
+    file->stalled = 0;
+    file->stall_next = file->stall_prev = NULL;
+}
 
-    folder_table = folder_table_init(FOLDER_TABLE_DEFAULT_POWER);
-    assert(folder_table != NULL);
+// Tail again every file a full sink has pushed back on, they may not see
+// another inotify event. Stops as soon as the sink fills up again.
+void tailall_resume(tailall_t *ta)
+{
+    file_t *file;
 
-    inotify_fd = inotify_init();
-    assert(inotify_fd >= 0);
-    
-    ta = calloc(sizeof(tailall_t), 1);
-    assert(ta != NULL);
+    while((file = ta->stall_first) != NULL)
+    {
+        tailall_unstall(ta, file);
+        tailing(ta, file);
 
-    ta->inotify = inotify_fd;
-    ta->path = strdup(path);
-    ta->folder_table = folder_table;
-    ta->last_tailing_file = NULL;
-    ta->tailing_count = 0;
-    
-    return ta;
+        if(file->stalled)
+            break;
+    }
 }
 
 file_t* file_init(folder_t *folder, const char *name)
@@ -125,34 +204,84 @@ file_t* file_init(folder_t *folder, const char *name)
     assert(name != NULL);
 
     char buf[MAX_DIR_NAME_LENGTH];
-    file_t *file;
-    int fd;
+    tailall_t *ta = folder->ta;
+    file_t *file, *same;
+    struct stat st;
+    int fd, link = 0;
+
+    if(!folder_wants(folder, name))
+        return NULL;
 
-    strcpy(buf, folder->path);
-    strcat(buf, name);
+    snprintf(buf, sizeof(buf), "%s%s", folder_path(folder), name);
 
     debugf("file_t init %s\n", buf);
 
     fd = open(buf, O_RDONLY);
+    metric_inc(M_SYS_OPEN);
     if(fd < 0)
     {
         debugf("%s %s\n", strerror(errno), buf);
         return NULL;
     }
 
+    if(ta->follow)
+    {
+        link = is_link(buf);
+
+        if(fstat(fd, &st) < 0)
+        {
+            warnfn("%s %s", strerror(errno), buf);
+            close(fd);
+            return NULL;
+        }
+
+        // one descriptor per inode, hard links and links to the same file
+        same = follow_file_find(ta, &st);
+
+        if(same != NULL)
+        {
+            // the real path wins over one through a link
+            if(!link && !follow_folder_linked(folder) && follow_file_linked(same))
+            {
+                follow_file_del(same);
+                file_move(same, folder, name);
+                follow_file_add(same, &st, 0);
+            }
+
+            debugf("Ignored, already tailed as %s%s\n", folder_path(same->folder), same->name);
+            close(fd);
+            return NULL;
+        }
+    }
+
     file = calloc(sizeof(file_t), 1);
     assert(file != NULL);
 
+    file->id = ++ta->file_seq;
+    ta->file_count++;
     file->folder = folder;
     file->name = strdup(name);
     file->fd   = fd;
 
+    if(ta->follow)
+        follow_file_add(file, &st, link);
+
+    if(folder->poll != NULL)
+        pollfs_file_add(ta->pollfs, file);
+
     return file;
 }
 
 off_t file_move_eof(file_t *file)
 {
-    return lseek(file->fd, 0, SEEK_END);
+    off_t off = lseek(file->fd, 0, SEEK_END);
+
+    metric_inc(M_SYS_LSEEK);
+
+    if(off >= 0)
+        file->offset = off;
+
+    return off;
 }
 
 
@@ -160,248 +289,831 @@ void file_free(file_t *file)
 {
     assert(file != NULL);
 
+    tailall_t *ta = file->folder->ta;
+
+    // the record held goes out under the name of the file
+    if(file->multiline != NULL)
+        multiline_file_free(ta, file);
+
+    if(file->dedup_refs > 0)
+        dedup_file_free(ta, file);
+
+    if(ta->last_tailing_file == file)
+        ta->last_tailing_file = NULL;
+
+    if(ta->open_line_file == file)
+        ta->open_line_file = NULL;
+
+    if(ta->move_file == file)
+        ta->move_file = NULL;
+
+    if(file->stalled)
+        tailall_unstall(ta, file);
+
+    if(ta->follow)
+        follow_file_del(file);
+
+    if(file->poll != NULL)
+        pollfs_del(ta->pollfs, file->poll);
+
+    ta->file_count--;
+
     if(file->name != NULL)
         free(file->name);
 
+    if(file->prefix != NULL)
+        free(file->prefix);
+
+    if(file->sink_file != NULL && ta->sink_file_free != NULL)
+        ta->sink_file_free(file->sink_file);
+
     close(file->fd);
 
     free(file);
 }
 
-folder_t* folder_init(tailall_t *ta, const char *path)
+const char* file_prefix(file_t *file)
 {
-    assert(ta != NULL);
-    assert(path != NULL);
-
-    folder_t *folder;
-    folder_data_t *folder_data, *folder_datap;
-    char *wdstr;
-
-    folder = calloc(sizeof(folder_t), 1);
-    folder->ta = ta;
-    assert(folder != NULL);
+    assert(file != NULL);
 
-    folder->path = strdup(path);
-
-    folder->wd = inotify_add_watch(ta->inotify, path,   
-                                                        IN_CREATE |
-                                                        IN_CLOSE_WRITE |
-                                                        IN_DELETE |
-                                                        IN_DELETE_SELF |
-                                                        IN_MODIFY |
-                                                        IN_MOVE_SELF |
-                                                        IN_MOVED_FROM |
-                                                        IN_MOVED_TO
-                                                        );
-    if(folder->wd < 0)
-    {
-        warnfn("%s %s", strerror(errno), path);
-        free(folder->path);
-        free(folder);
-        return NULL;
+    // a directory above may have been renamed since
+    if(file->prefix != NULL && file->prefix_gen != file->folder->ta->path_gen)
+    {
+        free(file->prefix);
+        file->prefix = NULL;
     }
 
-    wdstr = intdup(folder->wd);
-
-    // must not be the folder in folder_table
-    assert(folder_data_get(ta->folder_table, wdstr) == NULL);
-
-    folder_data = folder_data_init(wdstr, folder);
-    assert(folder_data != NULL);
-
-    free(wdstr);
-
-    folder_datap = folder_data_set(ta->folder_table, folder_data);
-    assert(folder_datap != NULL);
+    if(file->prefix == NULL)
+    {
+        const char *path = folder_path2(file->folder, FOLDER_PATH_LABEL);
+        size_t plen = strlen(path);
+        size_t nlen = strlen(file->name);
+
+        file->prefix_len = plen + nlen + 2;
+        file->prefix = malloc(file->prefix_len + 1);
+        assert(file->prefix != NULL);
+
+        memcpy(file->prefix, path, plen);
+        memcpy(file->prefix + plen, file->name, nlen);
+        memcpy(file->prefix + plen + nlen, ": ", 3);
+        file->prefix_gen = file->folder->ta->path_gen;
+    }
 
-    return folder;
+    return file->prefix;
 }
 
-void folder_free(folder_t *folder)
+lazy_t* lazy_add(folder_t *folder, const char *name)
 {
     assert(folder != NULL);
+    assert(name != NULL);
 
-    debugf("folder_free %s\n", folder->path);
+    tailall_t *ta = folder->ta;
+    lazy_t *lazy;
+    char buf[MAX_DIR_NAME_LENGTH];
+    int len;
 
-    file_t *file, *file2;
-    int res;
-    char *wdstr;
-    
-    wdstr = intdup(folder->wd);
-    folder_data_del(folder->ta->folder_table, wdstr);
-    free(wdstr);
+    if(!folder_wants(folder, name))
+        return NULL;
 
-    file = folder->file_first;
+    len = snprintf(buf, sizeof(buf), "%p/", (void *)folder);
+    snprintf(buf + len, sizeof(buf) - len, "%s", name);
 
-    while(file != NULL)
-    {
-        file2 = file->next;
-        file_free(file);
-        file = file2;
-    }
+    lazy = calloc(sizeof(lazy_t), 1);
+    assert(lazy != NULL);
 
-    res = inotify_rm_watch(folder->ta->inotify, folder->wd);
+    lazy->key = strdup(buf);
+    lazy->name = lazy->key + len;
+    lazy->folder = folder;
 
-    if(res < 0)
+    if(hashtable_set(ta->lazy_table, hashtable_data_init(lazy->key, lazy, NULL)) == NULL)
     {
-        warnfn("inotify_rm_watch %s %d", strerror(errno), folder->wd);
+        free(lazy->key);
+        free(lazy);
+        return NULL;
     }
 
-    free(folder->path);
-    free(folder);
-}
+    lazy->next = folder->lazy_first;
+    if(folder->lazy_first != NULL)
+        folder->lazy_first->prev = lazy;
+    folder->lazy_first = lazy;
+
+    ta->lazy_count++;
 
+    return lazy;
+}
 
-folder_t* folder_find(tailall_t *ta, const char *path)
+lazy_t* lazy_find(folder_t *folder, const char *name)
 {
-    assert(path != NULL);
+    assert(folder != NULL);
+    assert(name != NULL);
 
-    folder_data_t *folder_data;
+    hashtable_data_t *hdata;
+    char buf[MAX_DIR_NAME_LENGTH];
+    int len;
 
-    folder_data = folder_data_get(ta->folder_table, path);
-    if(folder_data == NULL)
+    if(folder->lazy_first == NULL)
         return NULL;
 
-    return (folder_t *)folder_data->data;
+    len = snprintf(buf, sizeof(buf), "%p/", (void *)folder);
+    snprintf(buf + len, sizeof(buf) - len, "%s", name);
+
+    hdata = hashtable_get(folder->ta->lazy_table, buf);
+
+    return hdata != NULL ? hdata->data : NULL;
 }
 
-file_t* folder_put_file(folder_t *folder, file_t *file)
+// Opened by lazy_flush() at the end of the batch, a delete in the same
+// batch still costs nothing.
+void lazy_dirty(lazy_t *lazy)
 {
-    assert(folder != NULL);
-    assert(file != NULL);
+    tailall_t *ta = lazy->folder->ta;
 
-    file_t *filep;
+    if(lazy->dirty)
+        return;
 
-    filep = folder->file_last;
+    lazy->dirty = 1;
+    lazy->dirty_prev = NULL;
+    lazy->dirty_next = ta->dirty_first;
 
-    if(filep == NULL)
-    {
-        folder->file_first = folder->file_last = file;
-    }else
-    {
-        folder->file_last = filep->next = file;
-        file->prev = filep;
-    }
+    if(ta->dirty_first != NULL)
+        ta->dirty_first->dirty_prev = lazy;
 
-    return file;
+    ta->dirty_first = lazy;
 }
 
-file_t* folder_find_file(folder_t *folder, const char *filename)
+void lazy_free(lazy_t *lazy)
 {
-    assert(folder != NULL);
-    assert(filename != NULL);
+    assert(lazy != NULL);
 
-    file_t *file;
-
-    file = folder->file_last;
+    folder_t *folder = lazy->folder;
+    tailall_t *ta = folder->ta;
 
-    if(file == NULL)
-        return NULL;
+    if(ta->move_lazy == lazy)
+        ta->move_lazy = NULL;
 
-    do
+    if(lazy->dirty)
     {
-        if(strcmp(file->name, filename) == 0)
-        {
-            return file;
-        }
-    } while((file = file->next) != NULL);
+        if(lazy->dirty_prev != NULL)
+            lazy->dirty_prev->dirty_next = lazy->dirty_next;
+        else
+            ta->dirty_first = lazy->dirty_next;
 
-    return NULL;
+        if(lazy->dirty_next != NULL)
+            lazy->dirty_next->dirty_prev = lazy->dirty_prev;
+    }
+
+    if(lazy->prev != NULL)
+        lazy->prev->next = lazy->next;
+    else
+        folder->lazy_first = lazy->next;
+
+    if(lazy->next != NULL)
+        lazy->next->prev = lazy->prev;
+
+    hashtable_del(ta->lazy_table, lazy->key);
+    ta->lazy_count--;
+
+    free(lazy->key);
+    free(lazy);
 }
 
-// return
-//   NULL : if not exists file 
-file_t* folder_remove_file(folder_t *folder, const char *filename)
+// A lazy entry renamed within the tree, still lazy under the new name
+// unless written to already.
+void lazy_move(lazy_t *lazy, folder_t *folder, const char *name)
 {
+    assert(lazy != NULL);
     assert(folder != NULL);
-    assert(filename != NULL);
 
-    debugf("folder_remove_file %s %s\n", folder->path, filename);
+    int dirty = lazy->dirty;
 
-    file_t *file = folder_find_file(folder, filename);
+    lazy_free(lazy);
 
-    if(file == NULL)
-        return NULL;
+    // renamed over a tailed or lazy file
+    folder_forget(folder, name);
 
-    if(file == folder->file_first)
-        folder->file_first = file->next;
+    lazy = lazy_add(folder, name);
 
-    if(file == folder->file_last)
-        folder->file_last = file->prev;
+    if(lazy != NULL && dirty)
+        lazy_dirty(lazy);
+}
 
-    if(file->next != NULL)
-        file->next->prev = NULL;
+// Registers every lazy file modified in the batch, tails it from the start.
+void lazy_flush(tailall_t *ta)
+{
+    lazy_t *lazy;
+    file_t *file;
 
-    if(file->prev != NULL)
-        file->prev->next = NULL;
+    while((lazy = ta->dirty_first) != NULL)
+    {
+        file = file_init(lazy->folder, lazy->name);
 
-    file->next = file->prev = NULL;
+        if(file != NULL)
+            folder_put_file(lazy->folder, file);
 
-    return file;
+        lazy_free(lazy);
+
+        if(file != NULL)
+            tailing(ta, file);
+    }
 }
 
 // return
-//   1 : valid name
-//   0 : invalid name
-int is_valid_dirname(const char *ent)
+//   1 : folder is ancestor or ancestor's descendant
+static int folder_is_below(folder_t *folder, folder_t *ancestor)
 {
-    assert(ent != NULL);
+    for(; folder != NULL; folder = folder->parent)
+    {
+        if(folder == ancestor)
+            return 1;
+    }
 
-    if(ent[0] == '.')
-        return 0;
-    else
-        return 1;
+    return 0;
 }
 
-// return
-//   1 : directory
-//   0 : file
-//  -1 : others or error
-int is_dir(const char *path)
+folder_t* folder_init(tailall_t *ta, folder_t *parent, const char *name)
 {
-    assert(path != NULL);
+    assert(ta != NULL);
+    assert(name != NULL);
 
-    struct stat stat;
-    int ret;
+    folder_t *folder, *same;
+    folder_data_t *folder_data, *folder_datap;
+    const char *path;
+    char *wdstr;
+    struct stat st;
+    int i;
 
-    ret = lstat(path, &stat);
-    if(ret >= 0)
+    folder = calloc(sizeof(folder_t), 1);
+    assert(folder != NULL);
+    folder->ta = ta;
+    folder->name = strdup(name);
+    folder->parent = parent;
+
+    for(i = 0; parent == NULL && i < ta->nroots; i++)
+    {
+        if(strcmp(ta->roots[i].path, name) == 0)
+            folder->root = &ta->roots[i];
+    }
+
+    path = folder_path(folder);
+
+    // the top of another root, its subtree is that one's
+    if(parent != NULL && ta->nroots > 1 && root_find(ta, path) != NULL)
+    {
+        debugf("Ignored, a root of its own %s\n", path);
+        free(folder->name);
+        free(folder);
+        return NULL;
+    }
+
+    if(ta->follow)
+    {
+        if(stat(path, &st) < 0)
+        {
+            warnfn("%s %s", strerror(errno), path);
+            free(folder->name);
+            free(folder);
+            return NULL;
+        }
+
+        folder->link = is_link(path);
+
+        // a link cycle or another path to a directory already watched
+        same = follow_folder_find(ta, &st);
+
+        if(same != NULL)
+        {
+            // the real path wins over one through a link
+            if(parent != NULL && !follow_folder_linked(folder) && follow_folder_linked(same) &&
+                    !folder_is_below(parent, same))
+            {
+                folder_move(same, parent, name);
+                same->link = 0;
+            }
+
+            debugf("Ignored, already watched as %s\n", folder_path(same));
+            free(folder->name);
+            free(folder);
+            return NULL;
+        }
+    }
+
+    // covered by the fanotify mark of its filesystem, or a watch of its own
+    if(ta->fanwatch != NULL)
+        folder->wd = fanwatch_add(ta->fanwatch, folder, path);
+
+    // a watch of its own, or polled once the budget is spent
+    if(folder->wd == 0 && ta->budget != NULL)
+    {
+        folder->wd = budget_add(ta->budget, folder, path);
+    }else if(folder->wd == 0)
+    {
+        metric_inc(M_SYS_INOTIFY_ADD_WATCH);
+        folder->wd = inotify_add_watch(ta->inotify, path, FOLDER_WATCH_MASK);
+        if(folder->wd < 0)
+            warnfn("%s %s", strerror(errno), path);
+    }
+
+    if(folder->wd == -1)
+    {
+        free(folder->name);
+        free(folder);
+        return NULL;
+    }
+
+    wdstr = intdup(folder->wd);
+
+    // the same directory reached twice, e.g. a bind mount
+    if(folder_data_get(ta->folder_table, wdstr) != NULL)
+    {
+        warnfn("Ignored, already watched %s", path);
+        free(wdstr);
+        free(folder->name);
+        free(folder);
+        return NULL;
+    }
+
+    folder_data = folder_data_init(wdstr, folder);
+    assert(folder_data != NULL);
+
+    free(wdstr);
+
+    folder_datap = folder_data_set(ta->folder_table, folder_data);
+    assert(folder_datap != NULL);
+    (void)folder_datap;
+
+    if(ta->follow)
+        follow_folder_add(folder, &st);
+
+    if(ta->pollfs != NULL)
+        pollfs_folder_add2(ta->pollfs, folder, folder->demoted);
+
+    if(parent != NULL)
+    {
+        folder->next = parent->child_first;
+        if(parent->child_first != NULL)
+            parent->child_first->prev = folder;
+        parent->child_first = folder;
+    }else
+    {
+        if(folder->root != NULL)
+            folder->root->folder = folder;
+
+        if(folder->root == &ta->roots[0])
+            ta->root = folder;
+    }
+
+    return folder;
+}
+
+static void folder_unlink(folder_t *folder)
+{
+    if(folder->prev != NULL)
+        folder->prev->next = folder->next;
+    else if(folder->parent != NULL)
+        folder->parent->child_first = folder->next;
+
+    if(folder->next != NULL)
+        folder->next->prev = folder->prev;
+
+    folder->next = folder->prev = NULL;
+}
+
+// Tears down the folder and everything below it.
+void folder_free(folder_t *folder)
+{
+    assert(folder != NULL);
+
+    debugf("folder_free %s\n", folder_path(folder));
+
+    tailall_t *ta = folder->ta;
+    file_t *file, *file2;
+    int res;
+    char *wdstr;
+
+    while(folder->child_first != NULL)
+        folder_free(folder->child_first);
+
+    folder_unlink(folder);
+
+    if(ta->root == folder)
+        ta->root = NULL;
+
+    if(folder->root != NULL && folder->root->folder == folder)
+        folder->root->folder = NULL;
+
+    if(ta->move_folder == folder)
+        ta->move_folder = NULL;
+
+    if(ta->follow)
+        follow_folder_del(folder);
+
+    if(folder->poll != NULL)
+        pollfs_del(ta->pollfs, folder->poll);
+    
+    wdstr = intdup(folder->wd);
+    folder_data_del(ta->folder_table, wdstr);
+    free(wdstr);
+
+    file = folder->file_first;
+
+    while(file != NULL)
+    {
+        file2 = file->next;
+        file_free(file);
+        file = file2;
+    }
+
+    while(folder->lazy_first != NULL)
+        lazy_free(folder->lazy_first);
+
+    if(folder->handle != NULL)
+    {
+        fanwatch_del(ta->fanwatch, folder);
+        res = 0;
+    }else if(folder->demoted || ta->inotify < 0)
+    {
+        res = 0;
+    }else
+    {
+        res = inotify_rm_watch(ta->inotify, folder->wd);
+    }
+
+    if(ta->budget != NULL)
+        budget_del(ta->budget, folder);
+
+    // EINVAL, the kernel dropped the watch with the directory already
+    if(res < 0 && errno != EINVAL)
+    {
+        warnfn("inotify_rm_watch %s %d", strerror(errno), folder->wd);
+    }
+
+    free(folder->name);
+    free(folder);
+}
+
+// return
+//   full path of the folder ending with '/', valid until the next call
+const char* folder_path(folder_t *folder)
+{
+    return folder_path2(folder, 0);
+}
+
+// return
+//   path of the folder, mode of FOLDER_PATH_*, "" for a root relative to itself
+const char* folder_path2(folder_t *folder, int mode)
+{
+    assert(folder != NULL);
+
+    tailall_t *ta = folder->ta;
+    char *p = ta->path_buf + sizeof(ta->path_buf) - 1;
+    const char *name;
+    size_t len;
+    int sep;
+
+    *p = '\0';
+
+    // built backwards from the leaf, the root name carries its '/'
+    for(; folder != NULL; folder = folder->parent)
+    {
+        name = folder->name;
+        sep = folder->parent != NULL;
+
+        if(folder->parent == NULL && (mode & FOLDER_PATH_LABEL) && folder->root != NULL &&
+                folder->root->label != NULL)
+        {
+            name = folder->root->label;
+            sep = 1;
+        }else if(folder->parent == NULL && (mode & FOLDER_PATH_REL))
+        {
+            break;
+        }
+
+        len = strlen(name);
+
+        if(p - ta->path_buf < (ptrdiff_t)len + sep)
+            break;
+
+        if(sep)
+            *--p = '/';
+
+        p -= len;
+        memcpy(p, name, len);
+    }
+
+    return p;
+}
+
+root_t* folder_root(folder_t *folder)
+{
+    assert(folder != NULL);
+
+    while(folder->parent != NULL)
+        folder = folder->parent;
+
+    return folder->root;
+}
+
+int folder_wants(folder_t *folder, const char *name)
+{
+    assert(folder != NULL);
+    assert(name != NULL);
+
+    char buf[MAX_DIR_NAME_LENGTH];
+    root_t *root = folder_root(folder);
+
+    if(root == NULL || root->filter == NULL)
+        return 1;
+
+    snprintf(buf, sizeof(buf), "%s%s", folder_path2(folder, FOLDER_PATH_REL), name);
+
+    return fnmatch(root->filter, buf, 0) == 0;
+}
+
+folder_t* folder_find_child(folder_t *folder, const char *name)
+{
+    assert(folder != NULL);
+    assert(name != NULL);
+
+    folder_t *child;
+
+    for(child = folder->child_first; child != NULL; child = child->next)
+    {
+        if(strcmp(child->name, name) == 0)
+            return child;
+    }
+
+    return NULL;
+}
+
+// Rename, possibly into another parent. Paths below are not touched, the
+// cached prefixes are rebuilt on their next use.
+void folder_move(folder_t *folder, folder_t *parent, const char *name)
+{
+    assert(folder != NULL);
+    assert(parent != NULL);
+
+    folder_t *old;
+
+    folder_unlink(folder);
+
+    // renamed over an empty directory, or a link swapped with ln -sfn
+    old = folder_find_child(parent, name);
+    if(old != NULL)
+        folder_free(old);
+
+    free(folder->name);
+    folder->name = strdup(name);
+    folder->parent = parent;
+
+    folder->next = parent->child_first;
+    if(parent->child_first != NULL)
+        parent->child_first->prev = folder;
+    parent->child_first = folder;
+
+    folder->ta->path_gen++;
+}
+
+// Keeps the descriptor and offset, the file goes on from where it was.
+void file_move(file_t *file, folder_t *folder, const char *name)
+{
+    assert(file != NULL);
+    assert(folder != NULL);
+
+    folder_unlink_file(file->folder, file);
+
+    // renamed over a tailed or lazy file
+    folder_forget(folder, name);
+
+    free(file->name);
+    file->name = strdup(name);
+
+    if(file->prefix != NULL)
+    {
+        free(file->prefix);
+        file->prefix = NULL;
+    }
+
+    file->folder = folder;
+    folder_put_file(folder, file);
+
+    if(folder->ta->last_tailing_file == file)
+        folder->ta->last_tailing_file = NULL;
+}
+
+// Drops whatever is kept for name, its inode is replaced or gone.
+void folder_forget(folder_t *folder, const char *name)
+{
+    assert(folder != NULL);
+    assert(name != NULL);
+
+    lazy_t *lazy;
+    file_t *file;
+
+    lazy = lazy_find(folder, name);
+    if(lazy != NULL)
+        lazy_free(lazy);
+
+    file = folder_remove_file(folder, name);
+    if(file != NULL)
+        file_free(file);
+}
+
+// The queue overflowed, whatever changed meanwhile is found by diffing
+void rescan_roots(tailall_t *ta)
+{
+    int i;
+
+    // a replay, the events the rescan made are in the trace after it
+    if(ta->pollfs == NULL)
     {
-        if(S_ISDIR(stat.st_mode))
+        warnfn("Event queue overflow, not rescanned");
+        return;
+    }
+
+    warnfn("Event queue overflow, rescanning %d root(s)", ta->nroots);
+
+    for(i = 0; i < ta->nroots; i++)
+    {
+        if(ta->roots[i].folder != NULL)
+            pollfs_rescan(ta->pollfs, ta->roots[i].folder);
+    }
+}
+
+// An IN_MOVED_FROM not followed by its IN_MOVED_TO, moved out of the tree
+void move_flush(tailall_t *ta)
+{
+    file_t *file;
+
+    if(ta->move_folder != NULL)
+    {
+        folder_free(ta->move_folder);
+        ta->move_folder = NULL;
+    }
+
+    if(ta->move_file != NULL)
+    {
+        file = ta->move_file;
+        ta->move_file = NULL;
+        file_free(folder_unlink_file(file->folder, file));
+    }
+
+    if(ta->move_lazy != NULL)
+    {
+        metric_inc(M_LAZY_DROPPED);
+        lazy_free(ta->move_lazy);
+    }
+}
+
+file_t* folder_put_file(folder_t *folder, file_t *file)
+{
+    assert(folder != NULL);
+    assert(file != NULL);
+
+    file_t *filep;
+
+    filep = folder->file_last;
+
+    if(filep == NULL)
+    {
+        folder->file_first = folder->file_last = file;
+    }else
+    {
+        folder->file_last = filep->next = file;
+        file->prev = filep;
+    }
+
+    return file;
+}
+
+file_t* folder_find_file(folder_t *folder, const char *filename)
+{
+    assert(folder != NULL);
+    assert(filename != NULL);
+
+    file_t *file;
+
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        if(strcmp(file->name, filename) == 0)
+        {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+// return
+//   NULL : if not exists file 
+file_t* folder_remove_file(folder_t *folder, const char *filename)
+{
+    assert(folder != NULL);
+    assert(filename != NULL);
+
+    debugf("folder_remove_file %s %s\n", folder_path(folder), filename);
+
+    file_t *file = folder_find_file(folder, filename);
+
+    if(file == NULL)
+        return NULL;
+
+    return folder_unlink_file(folder, file);
+}
+
+file_t* folder_unlink_file(folder_t *folder, file_t *file)
+{
+    assert(folder != NULL);
+    assert(file != NULL);
+
+    if(file == folder->file_first)
+        folder->file_first = file->next;
+
+    if(file == folder->file_last)
+        folder->file_last = file->prev;
+
+    if(file->next != NULL)
+        file->next->prev = file->prev;
+
+    if(file->prev != NULL)
+        file->prev->next = file->next;
+
+    file->next = file->prev = NULL;
+
+    return file;
+}
+
+// return
+//   1 : valid name
+//   0 : invalid name
+int is_valid_dirname(const char *ent)
+{
+    assert(ent != NULL);
+
+    if(ent[0] == '.')
+        return 0;
+    else
+        return 1;
+}
+
+// return
+//   1 : directory
+//   0 : file
+//  -1 : others or error
+int is_dir(const char *path)
+{
+    return is_dir2(path, 0);
+}
+
+// Same with is_dir(), symbolic links are resolved when follow is set.
+int is_dir2(const char *path, int follow)
+{
+    assert(path != NULL);
+
+    struct stat st;
+    int ret;
+
+    ret = follow ? stat(path, &st) : lstat(path, &st);
+    if(ret >= 0)
+    {
+        if(S_ISDIR(st.st_mode))
             return 1;
 
-        if(S_ISREG(stat.st_mode))
+        if(S_ISREG(st.st_mode))
             return 0;
 
-        if(S_ISLNK(stat.st_mode))
+        if(S_ISLNK(st.st_mode))
         {
             warnfn("Ignored, due to a symbolic link %s", path);
             return -1;
         }
 
-        if(S_ISFIFO(stat.st_mode))
+        if(S_ISFIFO(st.st_mode))
         {
             warnfn("Ignored, due to a FIFO %s", path);
             return -1;
         }
 
-        if(S_ISBLK(stat.st_mode))
+        if(S_ISBLK(st.st_mode))
         {
             warnfn("Ignored, due to a block device %s", path);
             return -1;
         }
         
-        if(S_ISCHR(stat.st_mode))
+        if(S_ISCHR(st.st_mode))
         {
             warnfn("Ignored, due to a charictor device %s", path);
             return -1;
         }
 
-        if(S_ISSOCK(stat.st_mode))
+        if(S_ISSOCK(st.st_mode))
         {
             warnfn("Ignored, due to a socket %s", path);
             return -1;
         }
+    }else if(follow && is_link(path))
+    {
+        warnfn("Ignored, due to a dangling symbolic link %s", path);
+        return -1;
     }else
     {
         // error
@@ -412,266 +1124,533 @@ int is_dir(const char *path)
     return -1;
 }
 
+// Adds name under parent (the root if parent is NULL) and everything below.
 // return
 //   1 : Success
 //   0 : Permission denied
 //  -1 : Error
-int scan_dir(tailall_t *ta, const char *path)
+int scan_dir(tailall_t *ta, folder_t *parent, const char *name)
 {
-    assert(path != NULL);
+    assert(name != NULL);
+
+    char buf[MAX_DIR_NAME_LENGTH], *bufp = buf;
+    int ret;
+    DIR *dir;
+    struct dirent *ent;
+    folder_t *folder;
+    file_t *file;
+
+    folder = folder_init(ta, parent, name);
+    if(folder == NULL)
+    {
+        return -1;
+    }
+
+    // folder_path() is reused by the recursion
+    memset(buf, 0, MAX_DIR_NAME_LENGTH);
+    strcpy(buf, folder_path(folder));
+    bufp += strlen(buf);
+
+    debugf("Start to scan directory %s\n", buf);
+
+    dir = opendir(buf);
+
+    if(dir == NULL)
+    {
+        warnfn("%s, %s", strerror(errno), buf);
+
+        // gone again before it could be read
+        if(errno == EACCES || errno == ENOENT)
+            return 0;
+
+        // out of descriptors or the like, the caller decides
+        folder_free(folder);
+        return -1;
+    }
+
+    while((ent = readdir(dir)) != NULL)
+    {
+
+        strcpy(bufp, ent->d_name);
+
+        ret = is_dir2(buf, ta->follow);
+
+        if(ret > 0)
+        {
+            // directory
+            if(is_valid_dirname(bufp))
+            {
+                // valid directory
+                debugf("D %s\n", buf);
+
+                scan_dir(ta, folder, ent->d_name);
+                continue;
+            }
+
+            // ignored invalid directory as '.', '..'
+        }else if(ret == 0)
+        {
+            // file
+            debugf("F %s\n", buf);
+            
+            file = file_init(folder, ent->d_name);
+            if(file != NULL)
+            {
+                folder_put_file(folder, file);
+                file_move_eof(file);
+            }
+        }
+    }
+
+    closedir(dir);
+
+    return 0;
+}
+
+static void watching_cb(loop_t *loop, int fd, short revents, void *arg)
+{
+    watching_read((tailall_t *)arg);
+}
+
+void watching(tailall_t *ta)
+{
+    assert(ta != NULL);
+
+    loop_add_fd(ta->loop, ta->inotify, POLLIN, watching_cb, ta);
+}
+
+// Drain one read() worth of inotify events
+void watching_read(tailall_t *ta)
+{
+    int length, i = 0;
+    struct inotify_event *event;
+
+    uint64_t count = 0;
+
+    length = read(ta->inotify, ta->ebuf, BUF_LEN);
+
+    metric_inc(M_SYS_INOTIFY_READ);
+    ta->event_us = metrics_now_us();
+
+    while (i < length)
+    {
+        event = (struct inotify_event *) &ta->ebuf[i];
+
+        if(ta->trace != NULL)
+            trace_event(ta->trace, event);
+
+        watching_event(ta, event);
+
+        i += EVENT_SIZE + event->len;
+        count++;
+    }
+
+    if(ta->move_folder != NULL || ta->move_file != NULL || ta->move_lazy != NULL)
+        move_flush(ta);
+
+    if(ta->dirty_first != NULL)
+        lazy_flush(ta);
+
+    metric_batch(count);
+    ta->event_us = 0;
+}
+
+static METRIC_COUNTER event_metric(uint32_t mask)
+{
+    if(mask & IN_Q_OVERFLOW)    return M_EV_OVERFLOW;
+    if(mask & IN_CREATE)        return M_EV_CREATE;
+    if(mask & IN_DELETE)        return M_EV_DELETE;
+    if(mask & IN_DELETE_SELF)   return M_EV_DELETE_SELF;
+    if(mask & IN_MODIFY)        return M_EV_MODIFY;
+    if(mask & IN_CLOSE_WRITE)   return M_EV_CLOSE_WRITE;
+    if(mask & IN_MOVED_FROM)    return M_EV_MOVED_FROM;
+    if(mask & IN_MOVED_TO)      return M_EV_MOVED_TO;
+    if(mask & IN_MOVE_SELF)     return M_EV_MOVE_SELF;
+
+    return M_EV_OTHER;
+}
+
+// -L, a link to a directory comes without IN_ISDIR
+static int event_isdir(tailall_t *ta, folder_t *folder, struct inotify_event *event)
+{
+    char buf[MAX_DIR_NAME_LENGTH];
+    struct stat st;
+
+    if(event->mask & IN_ISDIR)
+        return 1;
+
+    if(!ta->follow)
+        return 0;
+
+    if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+        return folder_find_child(folder, event->name) != NULL;
+
+    if(event->mask & IN_MOVED_TO && ta->move_folder != NULL)
+        return 1;
+
+    if(event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        snprintf(buf, sizeof(buf), "%s%s", folder_path(folder), event->name);
+        return stat(buf, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    return 0;
+}
+
+void watching_event(tailall_t *ta, struct inotify_event *event)
+{
+    folder_t *folder;
+    folder_data_t *folder_data;
+    char *wdstr;
+    int isdir;
 
-    debugf("Start to scan directory %s\n", path);
+    debugf("watching() WD=%d MASK=%d COOKIE=%d LEN=%d DIR=%s\n", event->wd, event->mask, event->cookie, event->len, (event->mask & IN_ISDIR)?"yes":"no");
 
-    char buf[MAX_DIR_NAME_LENGTH], *bufp = buf;
-    int ret;
-    DIR *dir;
-    struct dirent *ent;
-    folder_t *folder;
-    file_t *file;
+    metric_inc(event_metric(event->mask));
 
-    memset(buf, 0, MAX_DIR_NAME_LENGTH);
-    strcpy(buf, path);
-    bufp += strlen(path);
+    // a move only pairs with the event right after it
+    if((ta->move_folder != NULL || ta->move_file != NULL || ta->move_lazy != NULL) &&
+            (!(event->mask & IN_MOVED_TO) || event->cookie != ta->move_cookie))
+    {
+        move_flush(ta);
+    }
 
-    folder = folder_init(ta, buf);
-    if(folder == NULL)
+    if(event->mask & IN_Q_OVERFLOW)
     {
-        return -1;
+        rescan_roots(ta);
+        return;
     }
 
-    dir = opendir(path);
+    wdstr = intdup(event->wd);
+    folder_data = folder_data_get(ta->folder_table, wdstr);
+    free(wdstr);
 
-    if(dir == NULL)
+    if(folder_data == NULL)
     {
-        warnfn("%s, %s", strerror(errno), path);
+        if(ta->follow && follow_event(ta, event))
+            return;
 
-        if(errno & EACCES)
-        {
-            return 0;
-        }else
-        {
-            exit(-1);
-        }
+        // the watch of a folder already torn down with its parent
+        if(event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+            return;
+
+        metric_inc(M_EV_UNKNOWN_WD);
+        warnfn("Cannot find folder_data for WD %d", event->wd);
+        return;
     }
 
-    while((ent = readdir(dir)) != NULL)
+    folder = (folder_t*) folder_data->data;
+
+    if(folder == NULL)
     {
+        warnfn("folder_data doesn't include folder. folder_data_key:%s", folder_data->key);
+        return;
+    }
 
-        strcpy(bufp, ent->d_name);
+    // the last event of a watch the budget gave up
+    if(event->wd == folder->old_wd && (event->mask & IN_IGNORED))
+    {
+        wdstr = intdup(event->wd);
+        folder_data_del(ta->folder_table, wdstr);
+        free(wdstr);
+        folder->old_wd = 0;
+        return;
+    }
 
-        ret = is_dir(buf);
+    folder->activity++;
 
-        if(ret > 0)
-        {
-            // directory
-            if(is_valid_dirname(bufp))
-            {
-                // valid directory
-                debugf("D %s\n", buf);
+    debugf("Rise Path : %s\n", folder_path(folder));
 
-                strcat(buf, "/");
-                scan_dir(ta, buf);
-                continue;
-            }
+    if(event->len)
+    {
+        isdir = event_isdir(ta, folder, event);
 
-            // ignored invalid directory as '.', '..'
-        }else if(ret == 0)
+        //
+        if (event->mask & IN_CREATE)
         {
-            // file
-            debugf("F %s\n", buf);
-            
-            file = file_init(folder, ent->d_name);
-            if(file != NULL)
+            if (isdir)
             {
-                folder_put_file(folder, file);
-                file_move_eof(file);
-            }
-        }
-    }
-
-    closedir(dir);
+                debugf("The directory %s%s was created.\n", folder_path(folder), event->name);      
 
-    return 0;
-}
+                if(folder_find_child(folder, event->name) == NULL)
+                    scan_dir(ta, folder, event->name);
+            } else {
+                debugf("The file %s%s was created.\n", folder_path(folder), event->name);
 
-void watching(tailall_t *ta)
-{
-    while(1)
-    {
-        int length, i = 0;
-        folder_t *folder;
-        folder_data_t *folder_data;
-        char *wdstr;
-        struct inotify_event *event;
+                if(ta->lazy)
+                {
+                    if(folder_find_file(folder, event->name) == NULL && lazy_find(folder, event->name) == NULL)
+                        lazy_add(folder, event->name);
+                    return;
+                }
 
-        length = read(ta->inotify, ta->ebuf, BUF_LEN);
+                file_t *file = file_init(folder, event->name);
+                if(file != NULL)
+                {
+                    folder_put_file(folder, file);
+                    tailing(ta, file);
+                }
+            }
 
-        while (i < length)
+        // 
+        } else if (event->mask & IN_DELETE)
         {
-            event = (struct inotify_event *) &ta->ebuf[i];
-
-            debugf("watching() WD=%d MASK=%d COOKIE=%d LEN=%d DIR=%s\n", event->wd, event->mask, event->cookie, event->len, (event->mask & IN_ISDIR)?"yes":"no");
+            if(isdir)
+            {
+                debugf("The directory %s%s was deleted.\n", folder_path(folder), event->name);      
 
-            wdstr = intdup(event->wd);
-            folder_data = folder_data_get(ta->folder_table, wdstr);
-            free(wdstr);
+                folder_t *child = folder_find_child(folder, event->name);
 
-            if(folder_data == NULL)
+                if(child != NULL)
+                {
+                    folder_free(child);
+                }
+            }else
             {
-                warnfn("Cannot find folder_data for WD %d", event->wd);
-                continue;
-            }
+                debugf("The file %s%s was deleted.\n", folder_path(folder), event->name);
 
-            folder = (folder_t*) folder_data->data;
+                lazy_t *lazy = lazy_find(folder, event->name);
 
-            if(folder_data == NULL)
-            {
-                warnfn("folder_data doesn't include folder. folder_data_key:%s", folder_data->key);
-                continue;
-            }
+                if(lazy != NULL)
+                {
+                    metric_inc(M_LAZY_DROPPED);
+                    lazy_free(lazy);
+                    return;
+                }
 
-            debugf("Rise Path : %s\n", folder->path);
+                file_t *file = folder_remove_file(folder, event->name);
 
-            if(event->len)
+                if(file != NULL)
+                {
+                    file_free(file);
+                }
+            }
+
+        //
+        } else if (event->mask & IN_MODIFY || event->mask & IN_CLOSE_WRITE)
+        {
+            if(event->mask & IN_ISDIR)
+            {
+                debugf("The directory %s - %s was modified.\n", folder_path(folder), event->name);
+                // can be ignored.
+                debugf("Ignored, %s - %s/ directory modified.\n", folder_path(folder), event->name);
+            }else
             {
-                char buf[MAX_DIR_NAME_LENGTH];
+                debugf("The file %s - %s was modified.\n", folder_path(folder), event->name);
+                file_t *file = folder_find_file(folder, event->name);
+                lazy_t *lazy;
 
-                //
-                if (event->mask & IN_CREATE)
+                if(file != NULL)
+                {
+                    tailing(ta, file);
+                }else if((lazy = lazy_find(folder, event->name)) != NULL)
+                {
+                    // closing a file nobody wrote to leaves it lazy
+                    if(event->mask & IN_MODIFY)
+                        lazy_dirty(lazy);
+                }else
                 {
-                    if (event->mask & IN_ISDIR)
+                    file = file_init(folder, event->name);
+                    if(file != NULL)
                     {
-                        debugf("The directory %s%s was created.\n", folder->path, event->name);      
-
-                        strcpy(buf, folder->path);
-                        strcat(buf, event->name);
-                        strcat(buf, "/");
-                        scan_dir(ta, buf);
-                    } else {
-                        debugf("The file %s%s was created.\n", folder->path, event->name);
-
-                        file_t *file = file_init(folder, event->name);
-                        if(file != NULL)
-                        {
-                            folder_put_file(folder, file);
-                            tailing(ta, file);
-                        }
+                        file = folder_put_file(folder, file);
+                        file_move_eof(file);
                     }
 
-                // 
-                } else if (event->mask & IN_DELETE)
-                {
-                    if(event->mask & IN_ISDIR)
-                    {
-                        debugf("The directory %s%s was deleted.\n", folder->path, event->name);      
-                        strcpy(buf, folder->path);
-                        strcat(buf, event->name);
-                        strcat(buf, "/");
-
-                        folder_t *folder = folder_find(ta, buf);
-
-                        if(folder != NULL)
-                        {
-                            folder_free(folder);
-                        }
-                    }else
-                    {
-                        debugf("The file %s%s was deleted.\n", folder->path, event->name);
+                }
+            }
 
-                        file_t *file = folder_remove_file(folder, event->name);
+        //
+        } else if (event->mask & IN_MOVED_FROM)
+        {
+            ta->move_cookie = event->cookie;
 
-                        if(file != NULL)
-                        {
-                            file_free(file);
-                        }
-                    }
+            if (isdir)
+            {
+                debugf("The directory %s%s was moved from.\n", folder_path(folder), event->name);
 
-                //
-                } else if (event->mask & IN_DELETE_SELF)
-                {
-                    if(event->mask & IN_ISDIR)
-                    {
-                        debugf("The directory %s%s was deleted itself.\n", folder->path, event->name);      
-                        strcpy(buf, folder->path);
-                        strcat(buf, event->name);
-                        strcat(buf, "/");
+                ta->move_folder = folder_find_child(folder, event->name);
+            } else
+            {
+                debugf("The file %s%s was moved from.\n", folder_path(folder), event->name);
 
-                        folder_t *folder = folder_find(ta, buf);
+                // gone from here already, a lazy entry is carried to
+                // the new name with its pending write
+                ta->move_lazy = lazy_find(folder, event->name);
+                ta->move_file = folder_find_file(folder, event->name);
+            }
 
-                        if(folder != NULL)
-                        {
-                            folder_free(folder);
-                        }
-                    }
+        //
+        } else if (event->mask & IN_MOVED_TO)
+        {
+            if (isdir)
+            {
+                debugf("The directory %s%s was moved to.\n", folder_path(folder), event->name);
 
-                //
-                } else if (event->mask & IN_MODIFY || event->mask & IN_CLOSE_WRITE)
+                if(ta->move_folder != NULL)
                 {
-                    if(event->mask & IN_ISDIR)
-                    {
-                        debugf("The directory %s - %s was modified.\n", folder->path, event->name);
-                        // can be ignored.
-                        debugf("Ignored, %s - %s/ directory modified.\n", folder->path, event->name);
-                    }else
-                    {
-                        debugf("The file %s - %s was modified.\n", folder->path, event->name);
-                        file_t *file = folder_find_file(folder, event->name);
-
-                        if(file != NULL)
-                        {
-                            tailing(ta, file);
-                        }else
-                        {
-                            file = file_init(folder, event->name);
-                            if(file != NULL)
-                            {
-                                file = folder_put_file(folder, file);
-                                file_move_eof(file);
-                            }
-
-                        }
-                    }
-
-                //
-                } else if (event->mask & IN_MOVED_FROM)
+                    // the whole subtree keeps its watches and files
+                    folder_move(ta->move_folder, folder, event->name);
+                    ta->move_folder = NULL;
+                }else
                 {
-                    if (event->mask & IN_ISDIR)
-                    {
-                        debugf("The directory %s%s was moved from.\n", folder->path, event->name);
-                    } else
-                    {
-                        debugf("The file %s%s was moved from.\n", folder->path, event->name);
-                    }
+                    // moved in from outside, maybe over an old entry
+                    folder_t *child = folder_find_child(folder, event->name);
+
+                    if(child != NULL)
+                        folder_free(child);
+
+                    scan_dir(ta, folder, event->name);
+                }
+            } else
+            {
+                debugf("The file %s%s was moved to.\n", folder_path(folder), event->name);
 
-                //
-                } else if (event->mask & IN_MOVED_TO)
+                if(ta->move_file != NULL)
                 {
-                    if (event->mask & IN_ISDIR)
-                    {
-                        debugf("The directory %s%s was moved to.\n", folder->path, event->name);
-                    } else
+                    file_move(ta->move_file, folder, event->name);
+                    ta->move_file = NULL;
+                }else if(ta->move_lazy != NULL)
+                {
+                    lazy_move(ta->move_lazy, folder, event->name);
+                }else
+                {
+                    // moved in from outside, maybe over an old entry,
+                    // tailed from the start like a directory moved in
+                    folder_forget(folder, event->name);
+
+                    if(ta->lazy)
                     {
-                        debugf("The file %s%s was moved to.\n", folder->path, event->name);
+                        lazy_t *lazy = lazy_add(folder, event->name);
+                        if(lazy != NULL)
+                            lazy_dirty(lazy);
+                        return;
                     }
 
-                //
-                } else if (event->mask & IN_MOVE_SELF)
-                {
-                    if (event->mask & IN_ISDIR)
+                    file_t *file = file_init(folder, event->name);
+                    if(file != NULL)
                     {
-                        debugf("The directory %s%s was moved.\n", folder->path, event->name);
-                        if(folder != NULL)
-                        {
-                            folder_free(folder);
-                        }
+                        folder_put_file(folder, file);
+                        tailing(ta, file);
                     }
                 }
             }
+        }
+    }else if(event->mask & IN_DELETE_SELF)
+    {
+        // usually torn down already by IN_DELETE in the parent
+        debugf("The directory %s was deleted itself.\n", folder_path(folder));
+
+        folder_free(folder);
+    }
+}
+
+// return
+//   1 : the start of buf looks like binary content
+static int is_binary(const char *buf, size_t len)
+{
+    size_t bad;
+
+    if(len > BINARY_BLOCK)
+        len = BINARY_BLOCK;
+
+    bad = scan_binary(buf, len);
+
+    return bad >= BINARY_MIN_BYTES && bad * BINARY_RATIO > len;
+}
+
+static void binary_mark(file_t *file)
+{
+    if(file->binary == 0)
+        warnfn("Binary content, not tailed for a while %s%s", folder_path(file->folder), file->name);
+
+    file->binary = loop_now_ms();
+    metric_inc(M_BINARY_FILES);
+}
+
+// Past the new bytes without reading them
+static void binary_skip(file_t *file)
+{
+    off_t offset = file->offset;
+
+    if(file_move_eof(file) > offset)
+        metric_add(M_BINARY_BYTES, file->offset - offset);
+}
+
+// buf ended with tail zeros at file->offset. Where the filesystem knows
+// its holes the next data is sought, elsewhere the run is read through.
+// return
+//   0 : nothing written past file->offset yet, stop there
+//   1 : a hole skipped, file->offset is at the data after it
+//   2 : written zeros with data after them, go on reading
+static int zero_run(file_t *file, size_t tail)
+{
+    char probe[4096];
+    struct stat st;
+    ssize_t n;
+    off_t data;
+
+    metric_inc(M_SYS_LSEEK);
+    data = lseek(file->fd, file->offset, SEEK_DATA);
+
+    if(data < 0 && errno == ENXIO)
+    {
+        lseek(file->fd, file->offset, SEEK_SET);
+        return 0;
+    }
+
+    // the zeros read fill the data block up to a hole, data is past it
+    if(data == file->offset)
+    {
+        metric_inc(M_SYS_LSEEK);
+        data = lseek(file->fd, file->offset, SEEK_HOLE);
+
+        if(data >= 0 && data <= file->offset + (off_t)tail)
+        {
+            metric_inc(M_SYS_LSEEK);
+            data = lseek(file->fd, data, SEEK_DATA);
 
-            i += EVENT_SIZE + event->len;
+            if(data < 0 && errno == ENXIO)
+            {
+                lseek(file->fd, file->offset, SEEK_SET);
+                return 0;
+            }
+        }else
+        {
+            data = file->offset;
         }
     }
 
+    if(data > file->offset)
+    {
+        metric_add(M_ZERO_BYTES, data - file->offset);
+        file->offset = data;
+        lseek(file->fd, data, SEEK_SET);
+        return 1;
+    }
+
+    // written zeros, a preallocated tail if the end of the file is zeros too
+    if(fstat(file->fd, &st) < 0 || st.st_size <= file->offset + (off_t)tail)
+    {
+        lseek(file->fd, file->offset, SEEK_SET);
+        return 0;
+    }
+
+    data = st.st_size - (off_t)sizeof(probe);
+    if(data < file->offset + (off_t)tail)
+        data = file->offset + tail;
+
+    n = pread(file->fd, probe, sizeof(probe), data);
+
+    if(n > 0 && scan_zero_tail(probe, n) == (size_t)n)
+    {
+        lseek(file->fd, file->offset, SEEK_SET);
+        return 0;
+    }
+
+    lseek(file->fd, file->offset + tail, SEEK_SET);
+
+    return 2;
 }
 
 int tailing(tailall_t *ta, file_t *file)
@@ -679,31 +1658,176 @@ int tailing(tailall_t *ta, file_t *file)
     assert(file != NULL);
     assert(ta != NULL);
 
-    int ret, total;
-
-    memset(ta->buf, 0, FILE_BUF_SIZE);
+    int ret, total, res, hole = 0;
+    size_t len, tail, n;
+    off_t zero = -1;
+    char *p;
 
     total = 0;
-    while( (ret = read(file->fd, ta->buf, FILE_BUF_SIZE-1)) > 0)
+    ret = -1;
+
+    // a stalled file is resumed by tailall_resume() only, keeps the order
+    if(file->stalled)
+        return 0;
+
+    // judged again on its next append once the while is over
+    if(file->binary != 0)
     {
-        if(total == 0 && ta->last_tailing_file != file)
+        if(loop_now_ms() - file->binary < BINARY_RECHECK_MS)
         {
-            outfn(" ");
-            outfn("# %s%s", file->folder->path, file->name);
+            binary_skip(file);
+            return 0;
         }
 
-        outf("%.*s", ret, ta->buf);
-        memset(ta->buf, 0, FILE_BUF_SIZE);
-        total += ret;
+        file->binary = 0;
+        file->judged = 0;
     }
 
-    ta->last_tailing_file = file;
+    // nothing is read for a splice sink, one look of a block now and then
+    if(ta->splice != NULL && ta->skip_binary && loop_now_ms() - file->judged >= BINARY_RECHECK_MS)
+    {
+        ret = pread(file->fd, ta->buf, BINARY_BLOCK, file->offset);
+
+        // nothing new yet, looked at again with the bytes
+        if(ret > 0)
+            file->judged = loop_now_ms();
+
+        if(ret > 0 && is_binary(ta->buf, ret))
+        {
+            binary_mark(file);
+            binary_skip(file);
+            return 0;
+        }
+
+        ret = -1;
+    }
+
+    if(ta->splice != NULL)
+        ret = ta->splice(ta, file);
+
+    if(ret >= 0)
+    {
+        if(ret > 0 && ta->trace != NULL)
+            trace_data(ta->trace, file, file->offset, NULL, ret);
+
+        total = ret;
+        file->offset += ret;
+        ret = 0;
+    }else
+    {
+        // file->offset is the offset of p while the sink runs
+        while( (ret = read(file->fd, ta->buf, FILE_BUF_SIZE)) > 0)
+        {
+            metric_inc(M_SYS_READ);
+            metric_add(M_BYTES_READ, ret);
+
+            p = ta->buf;
+            len = ret;
+
+            // within a run of written zeros, dropped up to the next byte
+            if(zero >= 0)
+            {
+                n = scan_zero_lead(p, len);
+                p += n;
+                len -= n;
+                file->offset += n;
+
+                if(len == 0)
+                    continue;
+
+                metric_add(M_ZERO_BYTES, file->offset - zero);
+                zero = -1;
+            }
+
+            // a run of zeros ahead of an append or past a hole, a crash
+            // left it, within the bytes it is content
+            n = total == 0 || hole ? scan_zero_lead(p, len) : 0;
+            if(n >= ZERO_RUN_MIN && n < len)
+            {
+                metric_add(M_ZERO_BYTES, n);
+                p += n;
+                len -= n;
+                file->offset += n;
+            }
+
+            hole = 0;
+
+            tail = scan_zero_tail(p, len);
+            if(tail < ZERO_RUN_MIN && tail < len)
+                tail = 0;
+
+            len -= tail;
+
+            // the first block of every append
+            if(total == 0 && len > 0 && ta->skip_binary && is_binary(p, len))
+            {
+                binary_mark(file);
+                binary_skip(file);
+                ret = 0;
+                break;
+            }
+
+            if(len > 0)
+            {
+                if(ta->trace != NULL)
+                    trace_data(ta->trace, file, file->offset, p, len);
+
+                int done = ta->sink(ta, file, p, len);
+
+                if(done >= 0 && done < (int)len)
+                {
+                    // sink is full, rewind the rest and come back later
+                    file->offset += done;
+                    lseek(file->fd, file->offset, SEEK_SET);
+                    tailall_stall(ta, file);
+                    total += done;
+                    ret = 0;
+                    break;
+                }
+
+                file->offset += len;
+                total += len;
+            }
+
+            if(tail == 0)
+                continue;
+
+            res = zero_run(file, tail);
+
+            if(res == 0)
+            {
+                ret = 0;
+                break;
+            }
+
+            if(res == 1)
+                hole = 1;
+
+            if(res == 2)
+            {
+                zero = file->offset;
+                file->offset += tail;
+            }
+        }
+
+        // zeros up to the end, the writer has not got there yet
+        if(ret == 0 && zero >= 0)
+        {
+            file->offset = zero;
+            lseek(file->fd, file->offset, SEEK_SET);
+        }
+    }
 
     if(ret < 0)
     {
         warnfn("tailing() %s",strerror(errno));
     }
 
+    metric_inc(M_TAILING);
+
+    if(total > 0 && ta->event_us != 0)
+        metric_latency(metrics_now_us() - ta->event_us);
+
     if((++ta->tailing_count % MALLOC_TRIM_TERM) == 0)
     {
         malloc_trim(0);
@@ -713,21 +1837,74 @@ int tailing(tailall_t *ta, file_t *file)
     return total;
 }
 
+// "# path" header whenever the source file changes.
+int sink_header(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    static const char head[] = " \n# ", nl = '\n';
+
+    if(ta->last_tailing_file != file)
+    {
+        file_prefix(file);
+        output_add(ta->out, head, sizeof(head) - 1);
+        output_add(ta->out, file->prefix, file->prefix_len - 2);
+        output_add(ta->out, &nl, 1);
+        ta->last_tailing_file = file;
+    }
+
+    output_add(ta->out, buf, len);
+
+    if(output_flush(ta->out) < 0)
+    {
+        warnfn("sink_header() %s", strerror(errno));
+        return -1;
+    }
+
+    return len;
+}
 
-void help()
+// Every line is written as (prefix, line) iovecs pointing into buf, so
+// nothing is copied. The batch must be flushed before buf is reused.
+int sink_prefix(tailall_t *ta, file_t *file, const char *buf, size_t len)
 {
-    outf("\n");
-    outf("Usage: [DIRECTORY]\n");
-    outf("\n");
-    outf("Example: ./tailall \n");
-    outf("\n");
-    outf("Tailing all files(only normal file) under a directory such as UNIX tail command,\n");
-    outf("even in sub-directories recursively.\n");
-    outf("\n");
-    outf("NFS(Network File System) file, symbolic link, FIFO and block device will be\n");
-    outf("ignored, due to some reasons.");
-    outf("\n");
-    outf("DIRECTORY is the target to be watched. It watchs current directory (./), if\n");
-    outf("no DIRECTORY.\n");
-    outf("\n");
+    static const char nl = '\n';
+    const char *p = buf, *end = buf + len, *eol;
+
+    // another file left a line open, terminate it first
+    if(ta->open_line_file != NULL && ta->open_line_file != file)
+    {
+        output_add(ta->out, &nl, 1);
+        ta->open_line_file = NULL;
+    }
+
+    file_prefix(file);
+
+    while(p < end)
+    {
+        if(ta->open_line_file != file)
+            output_add(ta->out, file->prefix, file->prefix_len);
+
+        eol = memchr(p, '\n', end - p);
+
+        if(eol != NULL)
+        {
+            output_add(ta->out, p, eol + 1 - p);
+            ta->open_line_file = NULL;
+            p = eol + 1;
+        }else
+        {
+            output_add(ta->out, p, end - p);
+            ta->open_line_file = file;
+            p = end;
+        }
+    }
+
+    ta->last_tailing_file = file;
+
+    if(output_flush(ta->out) < 0)
+    {
+        warnfn("sink_prefix() %s", strerror(errno));
+        return -1;
+    }
+
+    return len;
 }
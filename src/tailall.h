@@ -7,7 +7,20 @@
 #ifndef _TALLALL_H_
 #define _TALLALL_H_
 
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+
 #include "hashtable.h"
+#include "output.h"
+#include "loop.h"
+#include "log.h"
+
+#ifdef    __cplusplus
+extern "C"
+{
+#endif
 
 #define MAX_DIR_NAME_LENGTH     8192
 #define FILE_BUF_SIZE           1024*64
@@ -15,23 +28,6 @@
 #define EVENT_SIZE  ( sizeof (struct inotify_event) )
 #define BUF_LEN     ( 1024 * ( EVENT_SIZE + 16 ) )
 
-#ifdef DEBUG
-#define debugf(...) { fprintf(stdout, "DBUG - "); fprintf(stdout, __VA_ARGS__); fflush(stdout); }
-#define debugfn(...) { fprintf(stdout, "DBUG - "); fprintf(stdout, __VA_ARGS__); fprintf(stdout, "\n"); fflush(stdout); }
-#else
-#define debugf(...) 
-#define debugfn(...) 
-#endif
-
-#define errf(...) { fprintf(stderr, "ERR  - "); fprintf(stderr, __VA_ARGS__); fflush(stderr); }
-#define errfn(...) { fprintf(stderr, "ERR  - "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n");}
-
-#define warnf(...) { fprintf(stderr, "WARN - "); fprintf(stderr, __VA_ARGS__); fflush(stderr); }
-#define warnfn(...) { fprintf(stderr, "WARN - "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); fflush(stderr); }
-
-#define infof(...) { fprintf(stderr, "INFO - "); fprintf(stdout, __VA_ARGS__); fflush(stdout); }
-#define infofn(...) { fprintf(stderr, "INFO - "); fprintf(stdout, __VA_ARGS__); fprintf(stdout, "\n"); fflush(stdout); }
-
 #define outf(...) { fprintf(stdout, __VA_ARGS__); fflush(stdout); }
 #define outfn(...) { fprintf(stdout, __VA_ARGS__); fprintf(stdout, "\n"); fflush(stdout); }
 
@@ -57,39 +53,171 @@
 #define folder_data_del(x,y)    hashtable_del(x,y)
 
 typedef struct _file_t file_t;
+typedef struct _lazy_t lazy_t;
 typedef struct _folder_t folder_t;
 typedef struct _tailall_t tailall_t;
+typedef struct _root_t root_t;
 
 struct _file_t
 {
+    uint64_t        id;             // unique for the process life time
     char            *name;
     int             fd;
+    char            *prefix;        // "<path><name>: ", rendered once on demand
+    size_t          prefix_len;
+    uint64_t        prefix_gen;     // ta->path_gen the prefix was rendered at
+    off_t           offset;         // next byte to be tailed
+    void            *sink_file;     // per file state of the sink
+    void            *multiline;     // multiline_file_t, -M
+    int             dedup_open;     // -u, the last chunk ended inside a line
+    uint32_t        dedup_refs;     // -u, slots last seeing a line here
+    off_t           dedup_seen;     // -u, lines before were judged, read again after a full sink
+    int             stalled;        // sink is full, resume from offset later
+    uint64_t        binary;         // loop_now_ms() it was judged binary, 0 for text
+    uint64_t        judged;         // splice sinks, loop_now_ms() of the last look
+    file_t          *stall_next;
+    file_t          *stall_prev;
+    dev_t           dev;            // -L or polled, (dev, ino) in file_index
+    ino_t           ino;
+    int             link_wd;        // -L, watch of a file reached by a link
+    void            *poll;          // pollfs_ent_t on a polled mount
     folder_t        *folder;
     file_t          *next;
     file_t          *prev;
 };
 
+// A created file that has not been written to yet (-l), opened at the end
+// of the batch that first modifies it. Nothing is opened or read before.
+struct _lazy_t
+{
+    char            *key;           // "<folder pointer>/<name>" in lazy_table, a wd changes with the budget
+    const char      *name;          // points into key
+    folder_t        *folder;
+    int             dirty;          // modified, on the dirty list
+    lazy_t          *next;          // folder list
+    lazy_t          *prev;
+    lazy_t          *dirty_next;
+    lazy_t          *dirty_prev;
+};
+
+// Folders form a tree mirroring the watched directories. Only the name
+// relative to the parent is kept, full paths are built by folder_path().
 struct _folder_t
 {
     tailall_t       *ta;
-    char            *path;
+    char            *name;          // ta->path for the root
+    folder_t        *parent;
+    folder_t        *child_first;
+    folder_t        *next;          // siblings
+    folder_t        *prev;
     int             wd;     // watch desc
+    dev_t           dev;            // -L or polled, (dev, ino) in dir_index
+    ino_t           ino;
+    int             link;           // -L, the entry itself is a symbolic link
+    root_t          *root;          // top folders, the root they stand for
+    char            *handle;        // -f, key in the fanotify handle table
+    void            *poll;          // pollfs_ent_t on a polled mount
+    int             demoted;        // out of watch budget, polled instead
+    int             old_wd;         // watch given up, until its IN_IGNORED
+    int             priority;       // -W, kept watched whatever its activity
+    uint32_t        activity;       // events lately, halved every rebalance
     file_t          *file_first;
     file_t          *file_last;
+    lazy_t          *lazy_first;
 };
 
+// One per DIRECTORY argument, all served by the same inotify instance and
+// output. A root inside another one keeps its subtree, the outer one skips it.
+struct _root_t
+{
+    char            *path;          // as given, ends with '/'
+    char            *label;         // shown instead of path, NULL for none
+    char            *filter;        // fnmatch glob on paths relative to path, NULL for all
+    dev_t           dev;
+    ino_t           ino;
+    folder_t        *folder;        // NULL until scanned, or once deleted
+};
+
+#define TAILALL_MAX_ROOTS           64
+
+// folder_path2() modes, or-ed
+#define FOLDER_PATH_REL             1   // without the root path
+#define FOLDER_PATH_LABEL           2   // "<label>/" for the root path, if labelled
+
 #define FOLDER_TABLE_DEFAULT_POWER  14
 #define FILE_TABLE_DEFAULT_POWER    16
 #define MALLOC_TRIM_TERM            100
+#define LAZY_TABLE_DEFAULT_POWER    16
+
+#define BINARY_BLOCK                4096    // judged of every append
+#define BINARY_MIN_BYTES            8       // and more than 1 in BINARY_RATIO
+#define BINARY_RATIO                32
+#define BINARY_RECHECK_MS           60000   // a binary file is looked at again after
+
+#define ZERO_RUN_MIN                64      // NULs ending a read, a hole or an unwritten tail
 
+#define FOLDER_WATCH_MASK   (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_DELETE_SELF | \
+                             IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+
+// Receives every chunk read by tailing(), buf is only valid during the call.
+// return
+//   len      : consumed
+//   0 .. len : sink is full, the rest is read again after tailall_resume()
+//  -1        : Error, the chunk is lost
+typedef int (*tailall_sink_t)(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+// Optional, moves the new bytes of file without read(), returns -1 to fall
+// back to read() and the sink.
+typedef ssize_t (*tailall_splice_t)(tailall_t *ta, file_t *file);
 
 struct _tailall_t
 {
-    char            *path;
+    char            *path;              // of the first root
+    root_t          roots[TAILALL_MAX_ROOTS];
+    int             nroots;
     folder_table_t  *folder_table;
     file_table_t    *file_table;
     int             inotify;
+    loop_t          *loop;
+    tailall_sink_t  sink;
+    tailall_splice_t splice;
+    void            *sink_data;
+    void            (*sink_free)(void *);
+    void            (*sink_file_free)(void *);
+    void            *trace;             // trace_t while recording
+    void            *pollfs;            // pollfs_t
+    void            *fanwatch;          // fanwatch_t, NULL with inotify only
+    void            *budget;            // budget_t, NULL while replaying
+    void            *multiline;         // multiline_t, -M
+    void            *dedup;             // dedup_t, -u
+    int             pseudo_wd;          // last watch desc handed out without inotify, counts down
+    int             wake;               // eventfd, tailall_stop() breaks poll() with it
+    pthread_t       thread;             // tailall_run_thread()
+    int             threaded;
+    output_t        *out;
     file_t          *last_tailing_file;
+    file_t          *open_line_file;    // last line written without '\n'
+    file_t          *stall_first;
+    int             skip_binary;        // binary content is not tailed
+    int             lazy;               // register created files on first write
+    hashtable_t     *lazy_table;
+    lazy_t          *dirty_first;
+    uint64_t        lazy_count;
+    folder_t        *root;              // of the first root
+    int             follow;             // -L, follow symbolic links
+    hashtable_t     *dir_index;         // "<dev>:<ino>" to folder_t
+    hashtable_t     *file_index;        // "<dev>:<ino>" to file_t
+    hashtable_t     *link_table;        // "int-<wd>" of link watches to file_t
+    uint64_t        path_gen;           // bumped by every rename, stales prefixes
+    uint32_t        move_cookie;        // IN_MOVED_FROM waiting for its IN_MOVED_TO
+    folder_t        *move_folder;
+    file_t          *move_file;
+    lazy_t          *move_lazy;
+    char            path_buf[MAX_DIR_NAME_LENGTH];
+    uint64_t        file_seq;
+    uint64_t        file_count;
+    uint64_t        event_us;           // when the current inotify batch was read
     uint64_t        tailing_count;
     char            buf[FILE_BUF_SIZE];
     char            ebuf[BUF_LEN];
@@ -102,23 +230,59 @@ struct _tailall_t
 // Integer to char*, same with strdup
 char*           intdup(const int i);
 
-tailall_t*      tailall_init(const char *path);
+// path, the first root, may be NULL and roots added after
+tailall_t*      tailall_init(const char *path, tailall_sink_t sink);
+// return
+//   NULL : Error, or the same directory as another root
+root_t*         tailall_add_root(tailall_t *ta, const char *path, const char *label, const char *filter);
+void            tailall_stall(tailall_t *ta, file_t *file);
+void            tailall_unstall(tailall_t *ta, file_t *file);
+void            tailall_resume(tailall_t *ta);
 
 file_t*         file_init(folder_t *folder, const char *name);
 void            file_free(file_t *file);
+const char*     file_prefix(file_t *file);
 off_t           file_move_eof(file_t *file);
 
-folder_t*       folder_init(tailall_t *ta, const char *path);
+lazy_t*         lazy_add(folder_t *folder, const char *name);
+lazy_t*         lazy_find(folder_t *folder, const char *name);
+void            lazy_dirty(lazy_t *lazy);
+void            lazy_free(lazy_t *lazy);
+void            lazy_move(lazy_t *lazy, folder_t *folder, const char *name);
+void            lazy_flush(tailall_t *ta);
+
+folder_t*       folder_init(tailall_t *ta, folder_t *parent, const char *name);
 void            folder_free(folder_t *folder);
-folder_t*       folder_find(tailall_t *ta, const char *path);
+const char*     folder_path(folder_t *folder);
+const char*     folder_path2(folder_t *folder, int mode);
+root_t*         folder_root(folder_t *folder);
+// return
+//   1 : the file name in folder passes the filter of its root
+int             folder_wants(folder_t *folder, const char *name);
+folder_t*       folder_find_child(folder_t *folder, const char *name);
+void            folder_move(folder_t *folder, folder_t *parent, const char *name);
+void            file_move(file_t *file, folder_t *folder, const char *name);
+void            move_flush(tailall_t *ta);
+void            rescan_roots(tailall_t *ta);
+void            folder_forget(folder_t *folder, const char *name);
 file_t*         folder_put_file(folder_t *folder, file_t *file);
 file_t*         folder_find_file(folder_t *folder, const char *filename);
 file_t*         folder_remove_file(folder_t *folder, const char *filename);
+file_t*         folder_unlink_file(folder_t *folder, file_t *file);
 int             is_valid_dirname(const char *ent);
 int             is_dir(const char *path);
-int             scan_dir(tailall_t *ta, const char *path);
+int             is_dir2(const char *path, int follow);
+int             scan_dir(tailall_t *ta, folder_t *parent, const char *name);
+// Registers the inotify instance with ta->loop, the loop is run by the caller
 void            watching(tailall_t *ta);
+void            watching_read(tailall_t *ta);
+void            watching_event(tailall_t *ta, struct inotify_event *event);
 int             tailing(tailall_t *ta, file_t *file);
-void            help();
+int             sink_header(tailall_t *ta, file_t *file, const char *buf, size_t len);
+int             sink_prefix(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+#ifdef    __cplusplus
+}
+#endif
 
 #endif // _TALLALL_H_
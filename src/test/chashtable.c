@@ -0,0 +1,175 @@
+/*
+ * chashtable.c under concurrent replace and delete. Writers replace, set
+ * and delete a few keys sharing buckets while readers look them up and
+ * check what they get is the data of the key and not freed yet, until
+ * their read section ends. Every data made has to be freed once, by
+ * reclaim or chashtable_free().
+ *
+ *   test/chashtable
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "chashtable.h"
+
+#define POWER       4           // 16 buckets, chains of 4 under the keys
+#define NKEYS       64
+#define READERS     3
+#define WRITERS     2
+#define WRITES      200000      // per writer
+
+#define LIVE        0x4c495645ULL
+#define DEAD        0x44454144ULL
+
+typedef struct _value
+{
+    uint64_t            magic;
+    int                 n;          // key number
+} value_t;
+
+static chashtable_t *table;
+static char keys[NKEYS][16];
+static int stop;
+static uint64_t made, freed, bad, hits;
+
+#define check(cond, ...) \
+    do { if(!(cond)) { fprintf(stderr, "chashtable: " __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } } while(0)
+
+static void value_free(void *arg)
+{
+    value_t *v = arg;
+
+    if(__atomic_exchange_n(&v->magic, DEAD, __ATOMIC_RELAXED) != LIVE)
+        __atomic_add_fetch(&bad, 1, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+    free(v);
+}
+
+static hashtable_data_t* value_init(int n)
+{
+    value_t *v = malloc(sizeof(value_t));
+
+    v->magic = LIVE;
+    v->n = n;
+    __atomic_add_fetch(&made, 1, __ATOMIC_RELAXED);
+
+    return hashtable_data_init_alloc(keys[n], v, value_free);
+}
+
+static void* reader(void *arg)
+{
+    chashtable_reader_t *r = chashtable_reader_init(table);
+    hashtable_data_t *hdata;
+    value_t *v;
+    uint64_t n = 0;
+    int i;
+
+    check(r != NULL, "no reader slot");
+
+    while(!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+    {
+        for(i = 0; i < NKEYS; i++)
+        {
+            chashtable_read_begin(table, r);
+
+            hdata = chashtable_get(table, keys[i]);
+            if(hdata != NULL)
+            {
+                v = hdata->data;
+
+                if(strcmp(hdata->key, keys[i]) != 0 || v->n != i ||
+                        __atomic_load_n(&v->magic, __ATOMIC_RELAXED) != LIVE)
+                    __atomic_add_fetch(&bad, 1, __ATOMIC_RELAXED);
+
+                // writers run meanwhile, still not freed at the end
+                if((i & 7) == 0)
+                    sched_yield();
+
+                if(__atomic_load_n(&v->magic, __ATOMIC_RELAXED) != LIVE)
+                    __atomic_add_fetch(&bad, 1, __ATOMIC_RELAXED);
+
+                n++;
+            }
+
+            chashtable_read_end(r);
+        }
+    }
+
+    chashtable_reader_free(r);
+    __atomic_add_fetch(&hits, n, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+static void* writer(void *arg)
+{
+    unsigned int seed = (uintptr_t)arg;
+    hashtable_data_t *hdata;
+    int i, n;
+
+    for(i = 0; i < WRITES; i++)
+    {
+        n = rand_r(&seed) % NKEYS;
+
+        switch(rand_r(&seed) % 3)
+        {
+            case 0:
+                chashtable_replace(table, value_init(n));
+                break;
+            case 1:
+                hdata = value_init(n);
+                if(chashtable_set(table, hdata) == NULL)
+                    hashtable_data_free(hdata);
+                break;
+            default:
+                chashtable_del(table, keys[n]);
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t readers[READERS], writers[WRITERS];
+    int i;
+
+    for(i = 0; i < NKEYS; i++)
+        snprintf(keys[i], sizeof(keys[i]), "key-%d", i);
+
+    table = chashtable_init(POWER);
+    check(table != NULL, "init");
+
+    for(i = 0; i < READERS; i++)
+        pthread_create(&readers[i], NULL, reader, NULL);
+
+    for(i = 0; i < WRITERS; i++)
+        pthread_create(&writers[i], NULL, writer, (void *)(uintptr_t)(i + 1));
+
+    for(i = 0; i < WRITERS; i++)
+        pthread_join(writers[i], NULL);
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+
+    for(i = 0; i < READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    check(bad == 0, "%llu lookups saw a wrong or freed data", (unsigned long long)bad);
+    check(table->data_count <= NKEYS, "%llu data for %d keys", (unsigned long long)table->data_count, NKEYS);
+
+    chashtable_free(table);
+
+    check(made == freed, "%llu data made, %llu freed", (unsigned long long)made, (unsigned long long)freed);
+    check(hits > 0, "no lookup hit");
+
+    printf("chashtable: ok\n");
+
+    return 0;
+}
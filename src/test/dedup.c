@@ -0,0 +1,137 @@
+/*
+ * Rewinds of dedup.c after a full sink. The same bytes are fed the way
+ * tailing() does, once to a sink taking everything and once to one
+ * taking a few bytes a call, and both have to get the same output: no
+ * line dropped as a repeat of itself when read again, none written twice.
+ *
+ *   test/dedup
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dedup.h"
+
+#define OUT_SIZE    4096
+
+static char out[OUT_SIZE];
+static size_t out_len;
+static int room = -1;           // bytes the sink takes a call, -1 all
+
+static const char input[] =
+    "alpha line one\n"
+    "alpha line one\n"
+    "beta line two\n"
+    "alpha line one\n"
+    "short\n"
+    "short\n"
+    "gamma line three\n"
+    "alpha line one\n"
+    "gamma line three\n"
+    "delta line four\n";
+
+// what passes, the summaries come after in slot order
+static const char expected[] =
+    "alpha line one\n"
+    "beta line two\n"
+    "short\n"
+    "short\n"
+    "gamma line three\n"
+    "delta line four\n";
+
+#define check(cond, ...) \
+    do { if(!(cond)) { fprintf(stderr, "dedup: " __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } } while(0)
+
+static int capture(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    if(room >= 0 && len > (size_t)room)
+        len = room;
+
+    check(out_len + len <= OUT_SIZE, "too much output");
+
+    memcpy(out + out_len, buf, len);
+    out_len += len;
+
+    return len;
+}
+
+// As tailing(): what the sink left is read again from the file offset.
+static void run(tailall_t *ta, file_t *file, int limit)
+{
+    size_t len = sizeof(input) - 1;
+    int done, calls = 0;
+    dedup_t *dd;
+
+    out_len = 0;
+    room = limit;
+    file->offset = 0;
+    file->dedup_open = 0;
+    file->dedup_seen = 0;
+
+    dd = dedup_init(ta, 60000);
+
+    while((size_t)file->offset < len)
+    {
+        done = ta->sink(ta, file, input + file->offset, len - file->offset);
+        check(done >= 0, "sink error at %lld", (long long)file->offset);
+
+        file->offset += done;
+        check(++calls < 1000, "no progress at %lld", (long long)file->offset);
+    }
+
+    room = -1;
+    dedup_free(dd);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/tailall-dedup-XXXXXX";
+    char path[MAX_DIR_NAME_LENGTH], whole[OUT_SIZE];
+    size_t whole_len;
+    tailall_t *ta;
+    file_t *file;
+    FILE *fp;
+    int limit;
+
+    log_level = LOG_WARN;
+
+    if(mkdtemp(dir) == NULL)
+        return 1;
+
+    snprintf(path, sizeof(path), "%s/a.log", dir);
+    fp = fopen(path, "w");
+    fclose(fp);
+
+    ta = tailall_init(dir, capture);
+    scan_dir(ta, NULL, ta->path);
+    file = folder_find_file(ta->roots[0].folder, "a.log");
+    check(file != NULL, "a.log not found in %s", dir);
+
+    run(ta, file, -1);
+
+    check(out_len > sizeof(expected) - 1 && memcmp(out, expected, sizeof(expected) - 1) == 0,
+            "got \"%.*s\"", (int)out_len, out);
+    check(strstr(out, "[repeated 3 times] alpha line one\n") != NULL, "no summary of alpha");
+    check(strstr(out, "[repeated 1 times] gamma line three\n") != NULL, "no summary of gamma");
+
+    memcpy(whole, out, out_len);
+    whole_len = out_len;
+
+    // cut inside lines, at their ends and across dropped ones
+    for(limit = 1; limit <= 20; limit++)
+    {
+        run(ta, file, limit);
+
+        check(out_len == whole_len && memcmp(out, whole, whole_len) == 0,
+                "%d bytes a call, got \"%.*s\"", limit, (int)out_len, out);
+    }
+
+    unlink(path);
+    rmdir(dir);
+
+    printf("dedup: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# -F across a reconnect. The first collector takes a batch of lines and
+# closes the connection once idle, the next batch is written while nothing
+# listens and has to reach the second collector once tailall reconnects.
+#
+#   forward.sh TAILALL
+
+set -e
+
+BIN=$1
+HERE=$(cd "$(dirname "$0")" && pwd)
+DIR=${TEST_DIR:-/tmp/tailall-test}/forward
+PORT=${TEST_PORT:-17651}
+
+fail()
+{
+    echo "forward: $*" >&2
+    kill $PID 2>/dev/null || true
+    exit 1
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR/root"
+: > "$DIR/root/a.log"
+
+"$HERE/../bench/tacollect" -i 1500 $PORT > "$DIR/first.out" 2> "$DIR/first.json" &
+FIRST=$!
+sleep 0.2
+
+$BIN -F 127.0.0.1:$PORT "$DIR/root" > /dev/null 2> "$DIR/stderr" &
+PID=$!
+sleep 0.5
+
+for i in $(seq 1 100); do echo "first $i" >> "$DIR/root/a.log"; done
+wait $FIRST
+
+# refused meanwhile, tailall keeps the frames and backs off
+for i in $(seq 1 100); do echo "second $i" >> "$DIR/root/a.log"; done
+sleep 0.5
+
+"$HERE/../bench/tacollect" -i 2500 $PORT > "$DIR/second.out" 2> "$DIR/second.json"
+
+kill $PID
+wait $PID || true
+
+[ "$(grep -c '^first ' "$DIR/first.out")" = 100 ] || fail "first batch $(cat "$DIR/first.json")"
+[ "$(grep -c '^second ' "$DIR/second.out")" = 100 ] || fail "second batch $(cat "$DIR/second.json")"
+[ "$(grep -c '^first ' "$DIR/second.out")" = 0 ] || fail "first batch sent again"
+grep -q '"bad":0' "$DIR/first.json" "$DIR/second.json" || fail "bad frames"
+
+echo "forward: ok"
@@ -0,0 +1,148 @@
+/*
+ * Record cuts of multiline.c. Bytes are fed to ta->sink the way tailing()
+ * does and the sink behind it, full now and then, has to get whole
+ * records, every byte once and in order.
+ *
+ *   test/multiline
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "multiline.h"
+
+#define OUT_SIZE    (MULTILINE_BUF_MAX * 4)
+
+static char out[OUT_SIZE];
+static size_t out_len;
+static size_t last_len;         // of the last call
+static int calls;
+static int room = -1;           // bytes the sink takes, -1 all
+
+static char in[OUT_SIZE];
+static size_t in_len;
+
+#define check(cond, ...) \
+    do { if(!(cond)) { fprintf(stderr, "multiline: " __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } } while(0)
+
+static int capture(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    if(room >= 0 && len > (size_t)room)
+        len = room;
+
+    memcpy(out + out_len, buf, len);
+    out_len += len;
+    last_len = len;
+    calls++;
+
+    return len;
+}
+
+static void feed(tailall_t *ta, file_t *file, const char *buf)
+{
+    size_t len = strlen(buf);
+    int done;
+
+    memcpy(in + in_len, buf, len);
+    in_len += len;
+
+    done = ta->sink(ta, file, buf, len);
+    check(done == (int)len, "took %d of %zu bytes", done, len);
+}
+
+// the last call handed exactly s
+static void got(const char *s)
+{
+    size_t len = strlen(s);
+
+    check(last_len == len && memcmp(out + out_len - len, s, len) == 0,
+            "expected \"%s\", got \"%.*s\"", s, (int)last_len, out + out_len - last_len);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/tailall-multiline-XXXXXX";
+    char path[MAX_DIR_NAME_LENGTH], *line;
+    multiline_t *ml;
+    tailall_t *ta;
+    file_t *file;
+    FILE *fp;
+    int n, i;
+
+    log_level = LOG_WARN;
+
+    if(mkdtemp(dir) == NULL)
+        return 1;
+
+    snprintf(path, sizeof(path), "%s/a.log", dir);
+    fp = fopen(path, "w");
+    fclose(fp);
+
+    ta = tailall_init(dir, capture);
+    scan_dir(ta, NULL, ta->path);
+    file = folder_find_file(ta->roots[0].folder, "a.log");
+    check(file != NULL, "a.log not found in %s", dir);
+
+    ml = multiline_init(ta);
+    check(multiline_rule(ml, "^####") == 0, "rule refused");
+
+    // a record is whole once the next one starts
+    feed(ta, file, "2024 one\n  at x\n2025 two\n");
+    check(calls == 1, "%d calls", calls);
+    got("2024 one\n  at x\n");
+
+    feed(ta, file, "  cont\n");
+    check(calls == 1, "a continued record went out");
+
+    feed(ta, file, "2026 three\n");
+    got("2025 two\n  cont\n");
+
+    // a start line split by a read is judged once its pattern is there
+    n = calls;
+    feed(ta, file, "20");
+    check(calls == n, "judged on 2 bytes");
+    feed(ta, file, "27 four\n");
+    got("2026 three\n");
+
+    // a full sink takes a part, the rest goes first on the next call
+    room = 5;
+    feed(ta, file, "2028 five\n");
+    got("2027 ");
+
+    room = -1;
+    feed(ta, file, "  more five\n");
+    check(memcmp(out + out_len - 5, "four\n", 5) == 0, "rest of a cut record lost");
+
+    feed(ta, file, "2029 six\n");
+    got("2028 five\n  more five\n");
+
+    // a record longer than MULTILINE_BUF_MAX is cut where the buffer is full
+    line = malloc(4096);
+    memset(line, 'x', 4094);
+    line[0] = ' ';
+    line[4094] = '\n';
+    line[4095] = '\0';
+
+    for(i = 0; i < MULTILINE_BUF_MAX / 4096 + 1; i++)
+        feed(ta, file, line);
+
+    check(last_len <= MULTILINE_BUF_MAX, "a cut of %zu bytes", last_len);
+    check(memcmp(out + out_len - last_len, "2029 six\n", 9) == 0, "the cut is not the held record");
+    free(line);
+
+    // the rest goes out with the end
+    feed(ta, file, "2030 seven");
+    multiline_free(ml);
+
+    check(out_len == in_len && memcmp(out, in, in_len) == 0,
+            "%zu bytes out of %zu, or not in order", out_len, in_len);
+
+    unlink(path);
+    rmdir(dir);
+
+    printf("multiline: ok\n");
+
+    return 0;
+}
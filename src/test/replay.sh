@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# -R then -P. A small tree is changed by a script while recorded with the
+# bytes, the replay into a scratch directory has to print the same lines
+# as the live run, under the scratch paths. The script ends with a storm
+# of creates that overflows the inotify queue, the trace holds the
+# overflow and what the rescan found.
+#
+#   replay.sh TAILALL
+
+set -e
+
+BIN=$1
+DIR=${TEST_DIR:-/tmp/tailall-test}/replay
+
+fail()
+{
+    echo "replay: $*" >&2
+    kill $PID 2>/dev/null || true
+    exit 1
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR/root/app" "$DIR/root/storm"
+echo "old" > "$DIR/root/app/a.log"
+
+$BIN -v warn -p -R "$DIR/trace" -B "$DIR/root" > "$DIR/live.out" 2> "$DIR/live.err" &
+PID=$!
+sleep 0.5
+
+for i in 1 2 3; do echo "a $i" >> "$DIR/root/app/a.log"; done
+sleep 0.2
+echo "b 1" > "$DIR/root/b.log"
+sleep 0.2
+mkdir "$DIR/root/new"
+sleep 0.2
+echo "n 1" > "$DIR/root/new/n.log"
+sleep 0.2
+mv "$DIR/root/app/a.log" "$DIR/root/app/a.log.1"
+echo "a 4" >> "$DIR/root/app/a.log.1"
+sleep 0.2
+rm "$DIR/root/b.log"
+echo "n 2" >> "$DIR/root/new/n.log"
+sleep 0.5
+
+# more creates than the queue holds while nothing reads it
+STORM=$(($(cat /proc/sys/fs/inotify/max_queued_events) + 1000))
+kill -STOP $PID
+seq 1 $STORM | sed "s#^#$DIR/root/storm/f#" | xargs touch
+echo "lost 1" > "$DIR/root/storm/lost.log"
+kill -CONT $PID
+sleep 1.5
+
+kill $PID
+wait $PID || true
+
+cat > "$DIR/expected" <<END
+app/a.log: a 1
+app/a.log: a 2
+app/a.log: a 3
+b.log: b 1
+new/n.log: n 1
+app/a.log.1: a 4
+new/n.log: n 2
+storm/lost.log: lost 1
+END
+
+sed "s#^$DIR/root/##" "$DIR/live.out" > "$DIR/live"
+cmp -s "$DIR/expected" "$DIR/live" || fail "live run, $(diff "$DIR/expected" "$DIR/live" | tr '\n' ' ')"
+grep -q "queue overflow" "$DIR/live.err" || fail "no overflow in the live run"
+
+$BIN -v warn -p -P "$DIR/trace" "$DIR/scratch" > "$DIR/replay.out" 2> "$DIR/replay.err" || fail "replay exited $?"
+
+sed "s#^$DIR/scratch/##" "$DIR/replay.out" > "$DIR/replay"
+cmp -s "$DIR/expected" "$DIR/replay" || fail "replay, $(diff "$DIR/expected" "$DIR/replay" | tr '\n' ' ')"
+
+echo "replay: ok"
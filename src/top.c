@@ -0,0 +1,254 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "top.h"
+#include "scan.h"
+
+int sink_top(tailall_t *ta, file_t *file, const char *buf, size_t len)
+{
+    top_file_t *tf = file->sink_file;
+
+    if(tf == NULL)
+    {
+        tf = file->sink_file = calloc(sizeof(top_file_t), 1);
+        assert(tf != NULL);
+    }
+
+    tf->bytes += len;
+    tf->lines += scan_count(buf, len, '\n');
+
+    return len;
+}
+
+// keep the k largest bps_short, smallest on top
+static void top_heap_push(top_row_t *heap, int *n, int k, const top_row_t *row)
+{
+    int i, p;
+    top_row_t tmp;
+
+    if(*n == k)
+    {
+        if(row->bps_short <= heap[0].bps_short)
+            return;
+
+        // replace the smallest and sift down
+        heap[0] = *row;
+        i = 0;
+
+        while(1)
+        {
+            int l = 2 * i + 1, r = l + 1, m = i;
+
+            if(l < k && heap[l].bps_short < heap[m].bps_short)
+                m = l;
+            if(r < k && heap[r].bps_short < heap[m].bps_short)
+                m = r;
+            if(m == i)
+                break;
+
+            tmp = heap[i];
+            heap[i] = heap[m];
+            heap[m] = tmp;
+            i = m;
+        }
+        return;
+    }
+
+    i = (*n)++;
+    heap[i] = *row;
+
+    while(i > 0 && heap[p = (i - 1) / 2].bps_short > heap[i].bps_short)
+    {
+        tmp = heap[i];
+        heap[i] = heap[p];
+        heap[p] = tmp;
+        i = p;
+    }
+}
+
+static int top_row_cmp(const void *a, const void *b)
+{
+    const top_row_t *ra = a, *rb = b;
+
+    if(ra->bps_short == rb->bps_short)
+        return 0;
+
+    return ra->bps_short < rb->bps_short ? 1 : -1;
+}
+
+static const char* human(double v, char *buf, size_t size)
+{
+    const char *unit = " KMGT";
+    int i = 0;
+
+    while(v >= 1024 && i < 4)
+    {
+        v /= 1024;
+        i++;
+    }
+
+    if(i == 0)
+        snprintf(buf, size, "%.0f", v);
+    else
+        snprintf(buf, size, "%.1f%c", v, unit[i]);
+
+    return buf;
+}
+
+struct top_tick
+{
+    top_t               *top;
+    double              dt;
+    double              a_short;
+    double              a_long;
+};
+
+static void top_folder_cb(hashtable_data_t *hdata, void *arg)
+{
+    struct top_tick *tick = arg;
+    top_t *top = tick->top;
+    folder_t *folder = hdata->data;
+    top_row_t row;
+    file_t *file;
+
+    memset(&top->dir, 0, sizeof(top_row_t));
+    top->dir.folder = folder;
+
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        top_file_t *tf = file->sink_file;
+
+        top->total_files++;
+
+        if(tf == NULL)
+            continue;
+
+        double bps = (tf->bytes - tf->last_bytes) / tick->dt;
+        double lps = (tf->lines - tf->last_lines) / tick->dt;
+
+        tf->last_bytes = tf->bytes;
+        tf->last_lines = tf->lines;
+        tf->bps = bps;
+        tf->bps_short = tf->bps_short * tick->a_short + bps * (1 - tick->a_short);
+        tf->bps_long = tf->bps_long * tick->a_long + bps * (1 - tick->a_long);
+        tf->lps_short = tf->lps_short * tick->a_short + lps * (1 - tick->a_short);
+
+        top->total_bps += bps;
+
+        top->dir.bps += tf->bps;
+        top->dir.bps_short += tf->bps_short;
+        top->dir.bps_long += tf->bps_long;
+        top->dir.lps_short += tf->lps_short;
+
+        if(tf->bps_short < 0.5 && tf->bps_long < 0.5)
+            continue;
+
+        row.file = file;
+        row.folder = folder;
+        row.bps = tf->bps;
+        row.bps_short = tf->bps_short;
+        row.bps_long = tf->bps_long;
+        row.lps_short = tf->lps_short;
+
+        top_heap_push(top->files, &top->nfiles, top->k, &row);
+    }
+
+    if(top->dir.bps_short >= 0.5 || top->dir.bps_long >= 0.5)
+        top_heap_push(top->dirs, &top->ndirs, top->k, &top->dir);
+}
+
+static int top_rows(char *buf, size_t size, top_row_t *rows, int n, const char *title)
+{
+    char b1[16], b2[16], b3[16];
+    int len = 0, i;
+
+    qsort(rows, n, sizeof(top_row_t), top_row_cmp);
+
+    len += snprintf(buf + len, size - len, "%9s %9s %9s %9s  %s\n", "B/s", "10s B/s", "60s B/s", "lines/s", title);
+
+    for(i = 0; i < n && len < (int)size; i++)
+    {
+        len += snprintf(buf + len, size - len, "%9s %9s %9s %9.1f  %s%s\n",
+                human(rows[i].bps, b1, sizeof(b1)),
+                human(rows[i].bps_short, b2, sizeof(b2)),
+                human(rows[i].bps_long, b3, sizeof(b3)),
+                rows[i].lps_short,
+                folder_path2(rows[i].folder, FOLDER_PATH_LABEL),
+                rows[i].file != NULL ? rows[i].file->name : "");
+    }
+
+    return len < (int)size ? len : (int)size - 1;
+}
+
+static void top_timer_cb(loop_t *loop, void *arg)
+{
+    top_t *top = arg;
+    struct top_tick tick;
+    char buf[TOP_BUF_SIZE], tbuf[32], b1[16];
+    uint64_t now = loop_now_ms();
+    time_t t = time(NULL);
+    int len = 0;
+    ssize_t ret;
+
+    tick.top = top;
+    tick.dt = (now - top->last_ms) / 1000.0;
+    if(tick.dt <= 0)
+        return;
+    tick.a_short = exp(-tick.dt / TOP_WINDOW_SHORT);
+    tick.a_long = exp(-tick.dt / TOP_WINDOW_LONG);
+    top->last_ms = now;
+
+    top->nfiles = top->ndirs = 0;
+    top->total_files = 0;
+    top->total_bps = 0;
+
+    hashtable_foreach(top->ta->folder_table, top_folder_cb, &tick);
+
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+
+    len += snprintf(buf + len, sizeof(buf) - len, "\n# %s  %llu files  %llu folders  %s B/s\n", tbuf,
+            (unsigned long long)top->total_files,
+            (unsigned long long)top->ta->folder_table->data_count,
+            human(top->total_bps, b1, sizeof(b1)));
+    len += top_rows(buf + len, sizeof(buf) - len, top->files, top->nfiles, "FILE");
+    len += snprintf(buf + len, sizeof(buf) - len, "\n");
+    len += top_rows(buf + len, sizeof(buf) - len, top->dirs, top->ndirs, "DIRECTORY");
+
+    ret = write(STDOUT_FILENO, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+    (void)ret;
+}
+
+top_t* top_init(tailall_t *ta, int interval, int k)
+{
+    assert(ta != NULL);
+
+    top_t *top = calloc(sizeof(top_t), 1);
+    assert(top != NULL);
+
+    top->ta = ta;
+    top->interval = interval;
+    top->k = k > 0 ? k : TOP_DEFAULT_K;
+    top->files = calloc(top->k, sizeof(top_row_t));
+    top->dirs = calloc(top->k, sizeof(top_row_t));
+    assert(top->files != NULL && top->dirs != NULL);
+    top->last_ms = loop_now_ms();
+    top->timer = loop_add_timer(ta->loop, interval, top_timer_cb, top);
+
+    return top;
+}
+
+void top_free(top_t *top)
+{
+    if(top == NULL)
+        return;
+
+    loop_del_timer(top->ta->loop, top->timer);
+    free(top->files);
+    free(top->dirs);
+    free(top);
+}
@@ -0,0 +1,63 @@
+#ifndef _TOP_H_
+#define _TOP_H_
+
+#include <stdint.h>
+
+#include "tailall.h"
+
+#define TOP_DEFAULT_K           20
+#define TOP_WINDOW_SHORT        10.0    // s, EWMA windows
+#define TOP_WINDOW_LONG         60.0
+#define TOP_BUF_SIZE            (1024*64)
+
+typedef struct _top_file top_file_t;
+typedef struct _top_row top_row_t;
+typedef struct _top top_t;
+
+// hung on file->sink_file
+struct _top_file
+{
+    uint64_t            bytes;
+    uint64_t            lines;
+    uint64_t            last_bytes;
+    uint64_t            last_lines;
+    double              bps;        // last interval
+    double              bps_short;
+    double              bps_long;
+    double              lps_short;
+};
+
+struct _top_row
+{
+    file_t              *file;      // NULL for a directory row
+    folder_t            *folder;
+    double              bps;
+    double              bps_short;
+    double              bps_long;
+    double              lps_short;
+};
+
+struct _top
+{
+    tailall_t           *ta;
+    int                 interval;   // ms
+    int                 k;
+    uint64_t            last_ms;
+    loop_timer_t        *timer;
+    top_row_t           *files;     // min-heaps of the k largest
+    int                 nfiles;
+    top_row_t           *dirs;
+    int                 ndirs;
+    top_row_t           dir;        // folder being summed
+    uint64_t            total_files;
+    double              total_bps;
+};
+
+// Prints the k busiest files and directories every interval ms.
+top_t*          top_init(tailall_t *ta, int interval, int k);
+void            top_free(top_t *top);
+
+// Counts bytes and lines only, nothing is written.
+int             sink_top(tailall_t *ta, file_t *file, const char *buf, size_t len);
+
+#endif // _TOP_H_
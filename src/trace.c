@@ -0,0 +1,612 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "metrics.h"
+
+#define TRACE_FILL_LINE         100     // filler line length when no bytes were recorded
+
+static const char* trace_rel(tailall_t *ta, const char *path)
+{
+    size_t len = strlen(ta->path);
+
+    return strncmp(path, ta->path, len) == 0 ? path + len : path;
+}
+
+static void trace_write(trace_t *trace, trace_rec_t *rec, const char *dir, const char *name, const char *data)
+{
+    fwrite(rec, sizeof(trace_rec_t), 1, trace->fp);
+    fwrite(dir, 1, rec->dir_len, trace->fp);
+    fwrite(name, 1, rec->name_len, trace->fp);
+
+    if(rec->flags & TRACE_F_BYTES)
+        fwrite(data, 1, rec->data_len, trace->fp);
+}
+
+static void trace_snapshot_cb(hashtable_data_t *hdata, void *arg)
+{
+    trace_t *trace = arg;
+    folder_t *folder = hdata->data;
+    const char *dir = trace_rel(trace->ta, folder_path(folder));
+    trace_rec_t rec;
+    file_t *file;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = TRACE_DIR;
+    rec.wd = folder->wd;
+    rec.dir_len = strlen(dir);
+    trace_write(trace, &rec, dir, "", NULL);
+
+    for(file = folder->file_first; file != NULL; file = file->next)
+    {
+        rec.type = TRACE_FILE;
+        rec.name_len = strlen(file->name);
+        rec.offset = file->offset;
+        trace_write(trace, &rec, dir, file->name, NULL);
+    }
+}
+
+trace_t* trace_open(tailall_t *ta, const char *path, int bytes)
+{
+    assert(ta != NULL);
+    assert(path != NULL);
+
+    trace_t *trace = calloc(sizeof(trace_t), 1);
+    assert(trace != NULL);
+
+    trace->fp = fopen(path, "w");
+    if(trace->fp == NULL)
+    {
+        errfn("%s %s", strerror(errno), path);
+        free(trace);
+        return NULL;
+    }
+
+    trace->buf = malloc(TRACE_BUF_SIZE);
+    assert(trace->buf != NULL);
+    setvbuf(trace->fp, trace->buf, _IOFBF, TRACE_BUF_SIZE);
+
+    trace->ta = ta;
+    trace->bytes = bytes;
+    trace->start_us = metrics_now_us();
+
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC) - 1, trace->fp);
+    hashtable_foreach(ta->folder_table, trace_snapshot_cb, trace);
+
+    return trace;
+}
+
+void trace_close(trace_t *trace)
+{
+    if(trace == NULL)
+        return;
+
+    if(fclose(trace->fp) != 0)
+        warnfn("trace_close() %s", strerror(errno));
+
+    free(trace->buf);
+    free(trace);
+}
+
+// Every event of one inotify read() gets the same timestamp, replay keeps
+// them in one batch.
+void trace_event(trace_t *trace, const struct inotify_event *event)
+{
+    tailall_t *ta = trace->ta;
+    folder_data_t *folder_data;
+    const char *dir = "";
+    trace_rec_t rec;
+    char *wdstr;
+
+    wdstr = intdup(event->wd);
+    folder_data = folder_data_get(ta->folder_table, wdstr);
+    free(wdstr);
+
+    if(folder_data != NULL)
+        dir = trace_rel(ta, folder_path(folder_data->data));
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = TRACE_EVENT;
+    rec.wd = event->wd;
+    rec.mask = event->mask;
+    rec.cookie = event->cookie;
+    rec.dir_len = strlen(dir);
+    rec.name_len = event->len ? strlen(event->name) : 0;
+    rec.us = (ta->event_us != 0 ? ta->event_us : metrics_now_us()) - trace->start_us;
+
+    trace_write(trace, &rec, dir, event->name, NULL);
+    trace->events++;
+}
+
+void trace_data(trace_t *trace, file_t *file, off_t offset, const char *buf, size_t len)
+{
+    const char *dir = trace_rel(trace->ta, folder_path(file->folder));
+    trace_rec_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = TRACE_DATA;
+    rec.flags = trace->bytes && buf != NULL ? TRACE_F_BYTES : 0;
+    rec.dir_len = strlen(dir);
+    rec.name_len = strlen(file->name);
+    rec.data_len = len;
+    rec.offset = offset;
+    rec.us = metrics_now_us() - trace->start_us;
+
+    trace_write(trace, &rec, dir, file->name, buf);
+}
+
+
+//
+// Replay
+//
+
+typedef struct
+{
+    tailall_t           *ta;
+    FILE                *fp;
+    double              speed;
+    uint64_t            start_us;
+    hashtable_t         *dirs;          // "d:<dir>" -> live wd
+    int                 scanned;
+    char                path[MAX_DIR_NAME_LENGTH];
+    char                *data;
+    size_t              data_size;
+    int                 data_fd;
+    char                data_path[MAX_DIR_NAME_LENGTH];
+    uint32_t            move_cookie;
+    char                move_path[MAX_DIR_NAME_LENGTH];
+    trace_rec_t         pending;        // event waiting for its data records
+    char                pending_dir[UINT16_MAX + 1];
+    char                pending_name[UINT16_MAX + 1];
+    int                 has_pending;
+    uint64_t            batch_us;
+    uint64_t            batch;
+    uint64_t            events;
+    uint64_t            bytes;
+} replay_t;
+
+static int replay_read(replay_t *rp, void *buf, size_t len)
+{
+    return len == 0 || fread(buf, len, 1, rp->fp) == 1 ? 0 : -1;
+}
+
+// return
+//   full path of dir/name under the scratch root, in rp->path
+static const char* replay_path(replay_t *rp, const char *dir, const char *name)
+{
+    snprintf(rp->path, sizeof(rp->path), "%s%s%s", rp->ta->path, dir, name);
+    return rp->path;
+}
+
+static void mkdir_p(const char *path)
+{
+    char buf[MAX_DIR_NAME_LENGTH], *p;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+
+    for(p = buf + 1; *p != '\0'; p++)
+    {
+        if(*p == '/')
+        {
+            *p = '\0';
+            mkdir(buf, 0755);
+            *p = '/';
+        }
+    }
+
+    mkdir(buf, 0755);
+}
+
+static int rm_rf_cb(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if(remove(path) < 0 && errno != ENOENT)
+        warnfn("%s %s", strerror(errno), path);
+
+    return 0;
+}
+
+// children first, links removed and not followed
+static void rm_rf(const char *path)
+{
+    if(rmdir(path) == 0 || errno != ENOTEMPTY)
+        return;
+
+    nftw(path, rm_rf_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// return
+//   1 : dir/name stays under the scratch root, dir relative with no ".."
+//       and name a single component
+static int replay_safe(const char *dir, size_t dir_len, const char *name, size_t name_len)
+{
+    const char *p;
+
+    // a '\0' inside would hide the rest from the checks
+    if(strlen(dir) != dir_len || strlen(name) != name_len)
+        return 0;
+
+    if(dir[0] == '/' || strchr(name, '/') != NULL || strcmp(name, "..") == 0 || strcmp(name, ".") == 0)
+        return 0;
+
+    for(p = dir; *p != '\0'; p = strchrnul(p, '/'), p += *p == '/')
+    {
+        if(p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            return 0;
+    }
+
+    return 1;
+}
+
+static void replay_touch(replay_t *rp, const char *dir, const char *name, off_t size)
+{
+    struct stat st;
+    int fd;
+
+    mkdir_p(replay_path(rp, dir, ""));
+    replay_path(rp, dir, name);
+
+    fd = open(rp->path, O_WRONLY | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        warnfn("%s %s", strerror(errno), rp->path);
+        return;
+    }
+
+    if(size > 0 && fstat(fd, &st) == 0 && st.st_size < size)
+    {
+        if(ftruncate(fd, size) < 0)
+            warnfn("%s %s", strerror(errno), rp->path);
+    }
+
+    close(fd);
+}
+
+static void replay_data(replay_t *rp, trace_rec_t *rec, const char *dir, const char *name)
+{
+    size_t i;
+
+    replay_path(rp, dir, name);
+
+    // consecutive records mostly hit the same file
+    if(rp->data_fd < 0 || strcmp(rp->data_path, rp->path) != 0)
+    {
+        if(rp->data_fd >= 0)
+            close(rp->data_fd);
+
+        mkdir_p(replay_path(rp, dir, ""));
+        replay_path(rp, dir, name);
+
+        rp->data_fd = open(rp->path, O_WRONLY | O_CREAT, 0644);
+        if(rp->data_fd < 0)
+        {
+            warnfn("%s %s", strerror(errno), rp->path);
+            return;
+        }
+
+        strcpy(rp->data_path, rp->path);
+    }
+
+    if(!(rec->flags & TRACE_F_BYTES))
+    {
+        for(i = 0; i < rec->data_len; i++)
+            rp->data[i] = (i + 1) % TRACE_FILL_LINE == 0 ? '\n' : 'x';
+    }
+
+    if(pwrite(rp->data_fd, rp->data, rec->data_len, rec->offset) < 0)
+        warnfn("%s %s", strerror(errno), rp->path);
+
+    rp->bytes += rec->data_len;
+}
+
+struct replay_find
+{
+    const char          *dir;
+    size_t              root_len;
+    int                 wd;
+};
+
+static void replay_find_cb(hashtable_data_t *hdata, void *arg)
+{
+    struct replay_find *find = arg;
+    folder_t *folder = hdata->data;
+
+    if(strcmp(folder_path(folder) + find->root_len, find->dir) == 0)
+        find->wd = folder->wd;
+}
+
+// Recorded folder -> wd of the same folder in the scratch tree
+static int replay_wd(replay_t *rp, const char *dir)
+{
+    tailall_t *ta = rp->ta;
+    size_t root_len = strlen(ta->path);
+    hashtable_data_t *hdata;
+    folder_data_t *folder_data;
+    struct replay_find find;
+    char key[MAX_DIR_NAME_LENGTH + 2], *wdstr;
+    int *wd;
+
+    snprintf(key, sizeof(key), "d:%s", dir);
+
+    hdata = hashtable_get(rp->dirs, key);
+    if(hdata != NULL)
+    {
+        wdstr = intdup(*(int *)hdata->data);
+        folder_data = folder_data_get(ta->folder_table, wdstr);
+        free(wdstr);
+
+        if(folder_data != NULL && strcmp(folder_path(folder_data->data) + root_len, dir) == 0)
+            return *(int *)hdata->data;
+    }
+
+    find.dir = dir;
+    find.root_len = root_len;
+    find.wd = -1;
+    hashtable_foreach(ta->folder_table, replay_find_cb, &find);
+
+    if(find.wd != -1)
+    {
+        wd = malloc(sizeof(int));
+        assert(wd != NULL);
+        *wd = find.wd;
+        hashtable_replace(rp->dirs, hashtable_data_init_alloc(key, wd, free));
+    }
+
+    return find.wd;
+}
+
+static void replay_batch_end(replay_t *rp)
+{
+    if(rp->batch == 0)
+        return;
+
+    if(rp->ta->dirty_first != NULL)
+        lazy_flush(rp->ta);
+
+    metric_batch(rp->batch);
+    rp->batch = 0;
+    rp->ta->event_us = 0;
+
+    // timers and sockets of the sink
+    loop_run_once(rp->ta->loop, 0);
+}
+
+static void replay_wait(replay_t *rp, uint64_t us)
+{
+    uint64_t due, now;
+    struct timespec ts;
+
+    if(rp->speed <= 0)
+        return;
+
+    due = rp->start_us + (uint64_t)(us / rp->speed);
+    now = metrics_now_us();
+
+    if(due > now)
+    {
+        ts.tv_sec = (due - now) / 1000000;
+        ts.tv_nsec = (due - now) % 1000000 * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Makes the scratch tree look like it did when the event was read, then
+// hands the event to watching_event().
+static void replay_event(replay_t *rp)
+{
+    static union
+    {
+        struct inotify_event    event;
+        char                    buf[EVENT_SIZE + UINT16_MAX + 1];
+    } u;
+
+    trace_rec_t *rec = &rp->pending;
+    const char *dir = rp->pending_dir, *name = rp->pending_name;
+    struct inotify_event *event = &u.event;
+
+    rp->has_pending = 0;
+
+    if(rec->us != rp->batch_us)
+    {
+        replay_batch_end(rp);
+        replay_wait(rp, rec->us);
+        rp->batch_us = rec->us;
+    }
+
+    if(rp->batch == 0)
+        rp->ta->event_us = metrics_now_us();
+
+    if(rec->name_len > 0)
+    {
+        if(rec->mask & IN_CREATE)
+        {
+            if(rec->mask & IN_ISDIR)
+                mkdir_p(replay_path(rp, dir, name));
+            else
+                replay_touch(rp, dir, name, 0);
+        }else if(rec->mask & IN_DELETE)
+        {
+            if(rec->mask & IN_ISDIR)
+                rm_rf(replay_path(rp, dir, name));
+            else
+                unlink(replay_path(rp, dir, name));
+        }else if(rec->mask & IN_MOVED_FROM)
+        {
+            rp->move_cookie = rec->cookie;
+            strcpy(rp->move_path, replay_path(rp, dir, name));
+        }else if(rec->mask & IN_MOVED_TO)
+        {
+            if(rp->move_cookie == rec->cookie && rp->move_path[0] != '\0')
+                rename(rp->move_path, replay_path(rp, dir, name));
+            else if(!(rec->mask & IN_ISDIR))
+                replay_touch(rp, dir, name, 0);
+
+            rp->move_path[0] = '\0';
+        }else if(!(rec->mask & IN_ISDIR))
+        {
+            replay_touch(rp, dir, name, 0);
+        }
+    }
+
+    // the data of the file may still sit in the cached descriptor
+    if(rp->data_fd >= 0 && (rec->mask & (IN_DELETE | IN_MOVED_FROM)))
+    {
+        close(rp->data_fd);
+        rp->data_fd = -1;
+    }
+
+    memset(event, 0, EVENT_SIZE);
+    // -1 is no watch at all (IN_Q_OVERFLOW), -f pseudo watch descs are below
+    event->wd = rec->wd == -1 ? -1 : replay_wd(rp, dir);
+    event->mask = rec->mask;
+    event->cookie = rec->cookie;
+    event->len = rec->name_len > 0 ? rec->name_len + 1 : 0;
+    memcpy(event->name, name, rec->name_len);
+    event->name[rec->name_len] = '\0';
+
+    watching_event(rp->ta, event);
+
+    rp->batch++;
+    rp->events++;
+}
+
+int trace_replay(tailall_t *ta, const char *path, double speed)
+{
+    assert(ta != NULL);
+    assert(path != NULL);
+
+    replay_t *rp;
+    trace_rec_t rec;
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    char dir[UINT16_MAX + 1], name[UINT16_MAX + 1];
+    uint64_t start;
+    double secs;
+    int ret = -1;
+
+    rp = calloc(sizeof(replay_t), 1);
+    assert(rp != NULL);
+
+    rp->ta = ta;
+    rp->speed = speed;
+    rp->data_fd = -1;
+    rp->dirs = hashtable_init(FOLDER_TABLE_DEFAULT_POWER, NULL);
+    assert(rp->dirs != NULL);
+
+    rp->fp = fopen(path, "r");
+    if(rp->fp == NULL)
+    {
+        errfn("%s %s", strerror(errno), path);
+        goto out;
+    }
+
+    if(replay_read(rp, magic, sizeof(magic)) < 0 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        errfn("Not a tailall trace, %s", path);
+        goto out;
+    }
+
+    start = rp->start_us = metrics_now_us();
+
+    while(replay_read(rp, &rec, sizeof(rec)) == 0)
+    {
+        if(replay_read(rp, dir, rec.dir_len) < 0 || replay_read(rp, name, rec.name_len) < 0)
+            break;
+
+        dir[rec.dir_len] = '\0';
+        name[rec.name_len] = '\0';
+
+        if(rec.data_len > rp->data_size)
+        {
+            rp->data_size = rec.data_len;
+            rp->data = realloc(rp->data, rp->data_size);
+            assert(rp->data != NULL);
+        }
+
+        if((rec.flags & TRACE_F_BYTES) && replay_read(rp, rp->data, rec.data_len) < 0)
+            break;
+
+        // replay creates, writes and removes what the trace names
+        if(!replay_safe(dir, rec.dir_len, name, rec.name_len))
+        {
+            warnfn("Skipped a record outside of the tree, %s%s", dir, name);
+            continue;
+        }
+
+        if(rec.type == TRACE_DIR)
+        {
+            mkdir_p(replay_path(rp, dir, ""));
+            continue;
+        }
+
+        if(rec.type == TRACE_FILE)
+        {
+            replay_touch(rp, dir, name, rec.offset);
+            continue;
+        }
+
+        // snapshot is over, watch it like a fresh start would
+        if(!rp->scanned)
+        {
+            scan_dir(ta, NULL, ta->path);
+            rp->scanned = 1;
+            start = rp->start_us = metrics_now_us();
+        }
+
+        if(rec.type == TRACE_DATA)
+        {
+            replay_data(rp, &rec, dir, name);
+        }else if(rec.type == TRACE_EVENT)
+        {
+            if(rp->has_pending)
+                replay_event(rp);
+
+            rp->pending = rec;
+            memcpy(rp->pending_dir, dir, rec.dir_len + 1);
+            memcpy(rp->pending_name, name, rec.name_len + 1);
+            rp->has_pending = 1;
+        }
+
+        if(ta->loop->stop)
+            break;
+    }
+
+    if(!rp->scanned)
+        scan_dir(ta, NULL, ta->path);
+
+    if(rp->has_pending)
+        replay_event(rp);
+
+    replay_batch_end(rp);
+
+    if(!feof(rp->fp) && !ta->loop->stop)
+        warnfn("Truncated trace %s", path);
+
+    secs = (metrics_now_us() - start) / 1e6;
+
+    fprintf(stderr, "replay: %llu events, %llu bytes in %.3f s, %.0f events/s\n",
+            (unsigned long long)rp->events, (unsigned long long)rp->bytes, secs,
+            secs > 0 ? rp->events / secs : 0.0);
+
+    ret = 0;
+
+out:
+    if(rp->fp != NULL)
+        fclose(rp->fp);
+
+    if(rp->data_fd >= 0)
+        close(rp->data_fd);
+
+    free(rp->data);
+    hashtable_free(rp->dirs);
+    free(rp);
+
+    return ret;
+}
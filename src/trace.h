@@ -0,0 +1,67 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tailall.h"
+
+#define TRACE_MAGIC             "TATRACE1"
+#define TRACE_BUF_SIZE          (1024*1024)     // stdio buffer of the trace file
+
+#define TRACE_DIR               1       // snapshot, a watched folder
+#define TRACE_FILE              2       // snapshot, a tailed file, offset = size
+#define TRACE_EVENT             3       // one inotify event
+#define TRACE_DATA              4       // bytes tailed from a file at offset
+
+#define TRACE_F_BYTES           0x01    // TRACE_DATA carries the bytes
+
+typedef struct _trace_rec trace_rec_t;
+typedef struct _trace trace_t;
+
+// Native endian, followed by dir_len + name_len + (data_len if
+// TRACE_F_BYTES) bytes. dir is relative to the watched root and ends with
+// '/' unless it is the root itself.
+struct _trace_rec
+{
+    uint8_t             type;
+    uint8_t             flags;
+    uint16_t            dir_len;
+    uint16_t            name_len;
+    uint16_t            reserved;
+    int32_t             wd;
+    uint32_t            mask;
+    uint32_t            cookie;
+    uint32_t            data_len;
+    uint64_t            us;         // since the trace started
+    uint64_t            offset;
+};
+
+struct _trace
+{
+    tailall_t           *ta;
+    FILE                *fp;
+    char                *buf;
+    int                 bytes;      // record the tailed bytes too
+    uint64_t            start_us;
+    uint64_t            events;
+};
+
+// Starts recording, writes a snapshot of the folders and files already
+// being watched. Call it after scan_dir().
+trace_t*        trace_open(tailall_t *ta, const char *path, int bytes);
+void            trace_close(trace_t *trace);
+void            trace_event(trace_t *trace, const struct inotify_event *event);
+
+// buf is NULL when the bytes did not pass through tailall (splice)
+void            trace_data(trace_t *trace, file_t *file, off_t offset, const char *buf, size_t len);
+
+// Rebuilds the recorded tree under ta->path and feeds the events to
+// watching_event() without the kernel. speed 0 is as fast as possible, 1
+// real time, 2 twice as fast...
+// return
+//   0  : Success
+//  -1  : Error
+int             trace_replay(tailall_t *ta, const char *path, double speed);
+
+#endif // _TRACE_H_